@@ -0,0 +1,192 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*=========================================================================
+  =                             Includes                                  =
+  =========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <mama/mama.h>
+
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+#include "Accounting.h"
+
+/*=========================================================================
+  =                Typedefs, structs, enums and globals                   =
+  =========================================================================*/
+
+// Ties a set of gauges to a thread for its lifetime
+class OmnmGaugesBinding
+{
+public:
+    OmnmGaugesBinding ();
+    ~OmnmGaugesBinding ();
+
+    OmnmGauges* mGauges;
+};
+
+thread_local OmnmGauges* tOmnmGauges = NULL;
+static thread_local OmnmGaugesBinding tGaugesBinding;
+
+// Peaks of the totals, as seen by getMemoryStats - guarded by registryLock
+static mama_u64_t gPeakPayloads      = 0;
+static mama_u64_t gPeakBytesReserved = 0;
+
+/*=========================================================================
+  =                  Private implementation functions                     =
+  =========================================================================*/
+
+/*
+ * Gauges hold counts which only make sense summed over every thread there
+ * has ever been, so they are never destroyed, and neither is the registry.
+ */
+static std::mutex&
+registryLock ()
+{
+    static std::mutex* lock = new std::mutex();
+    return *lock;
+}
+
+static std::vector<OmnmGauges*>&
+registry ()
+{
+    static std::vector<OmnmGauges*>* gauges = new std::vector<OmnmGauges*>();
+    return *gauges;
+}
+
+// Gauges left behind by exited threads - guarded by registryLock
+static OmnmGauges* gSpareGauges = NULL;
+
+static OmnmGauges*
+newGauges (bool shared)
+{
+    OmnmGauges* gauges = new OmnmGauges();
+    for (int i = 0; i < OMNM_GAUGE_COUNT; i++)
+    {
+        gauges->mValues[i].store (0, std::memory_order_relaxed);
+    }
+    gauges->mLargestBuffer.store (0, std::memory_order_relaxed);
+    gauges->mShared    = shared;
+    gauges->mNextSpare = NULL;
+    registry().push_back (gauges);
+    return gauges;
+}
+
+// Used by threads after their own gauges have been handed back
+static OmnmGauges*
+sharedGauges ()
+{
+    static OmnmGauges* gauges = NULL;
+    if (NULL == gauges)
+    {
+        gauges = newGauges (true);
+    }
+    return gauges;
+}
+
+OmnmGaugesBinding::OmnmGaugesBinding () : mGauges (NULL)
+{
+    std::lock_guard<std::mutex> lock (registryLock());
+    if (NULL != gSpareGauges)
+    {
+        mGauges             = gSpareGauges;
+        gSpareGauges        = mGauges->mNextSpare;
+        mGauges->mNextSpare = NULL;
+    }
+    else
+    {
+        mGauges = newGauges (false);
+    }
+}
+
+OmnmGaugesBinding::~OmnmGaugesBinding ()
+{
+    std::lock_guard<std::mutex> lock (registryLock());
+    tOmnmGauges         = sharedGauges();
+    mGauges->mNextSpare = gSpareGauges;
+    gSpareGauges        = mGauges;
+}
+
+/*=========================================================================
+  =                   Public implementation functions                     =
+  =========================================================================*/
+
+OmnmGauges*
+omnmmsgAccountingImpl_bind ()
+{
+    tOmnmGauges = tGaugesBinding.mGauges;
+    return tOmnmGauges;
+}
+
+mama_status
+omnmmsgPayloadImpl_getMemoryStats (omnmMemoryStats* stats)
+{
+    if (NULL == stats) return MAMA_STATUS_NULL_ARG;
+
+    int64_t  totals[OMNM_GAUGE_COUNT] = { 0 };
+    uint64_t largest                  = 0;
+
+    std::lock_guard<std::mutex> lock (registryLock());
+    for (OmnmGauges* gauges : registry())
+    {
+        for (int i = 0; i < OMNM_GAUGE_COUNT; i++)
+        {
+            totals[i] += gauges->mValues[i].load (std::memory_order_relaxed);
+        }
+        uint64_t buffer = gauges->mLargestBuffer.load (std::memory_order_relaxed);
+        largest = buffer > largest ? buffer : largest;
+    }
+
+    // Reads of other threads' gauges race with their updates, so a total
+    // caught mid-flight is clamped rather than wrapping round
+    for (int i = 0; i < OMNM_GAUGE_COUNT; i++)
+    {
+        totals[i] = totals[i] < 0 ? 0 : totals[i];
+    }
+
+    stats->mPayloads      = (mama_u64_t) totals[OMNM_GAUGE_PAYLOADS];
+    stats->mBytesReserved = (mama_u64_t) totals[OMNM_GAUGE_BYTES_RESERVED];
+    stats->mBytesUsed     = (mama_u64_t) totals[OMNM_GAUGE_BYTES_USED];
+    stats->mCacheBytes    = (mama_u64_t) totals[OMNM_GAUGE_CACHE_BYTES];
+    stats->mArenaBytes    = (mama_u64_t) totals[OMNM_GAUGE_ARENA_BYTES];
+    stats->mLargestBuffer = largest;
+
+    if (stats->mPayloads > gPeakPayloads)
+    {
+        gPeakPayloads = stats->mPayloads;
+    }
+    if (stats->mBytesReserved > gPeakBytesReserved)
+    {
+        gPeakBytesReserved = stats->mBytesReserved;
+    }
+    stats->mPeakPayloads      = gPeakPayloads;
+    stats->mPeakBytesReserved = gPeakBytesReserved;
+    return MAMA_STATUS_OK;
+}
@@ -0,0 +1,101 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MAMA_BRIDGE_OMNM_ACCOUNTING_H__
+#define MAMA_BRIDGE_OMNM_ACCOUNTING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+/*
+ * Memory gauges kept per thread and only summed when somebody asks. Memory
+ * freed on another thread than the one which allocated it simply leaves one
+ * thread's gauge high and the other's low, which cancels out in the sum.
+ */
+typedef enum omnmGauge
+{
+    OMNM_GAUGE_PAYLOADS,        /* payload objects from the allocator */
+    OMNM_GAUGE_BYTES_RESERVED,  /* those objects plus every heap buffer */
+    OMNM_GAUGE_BYTES_USED,      /* bytes up to the tail of every buffer */
+    OMNM_GAUGE_CACHE_BYTES,     /* field cache blocks and what they hold */
+    OMNM_GAUGE_ARENA_BYTES,     /* arena blocks */
+    OMNM_GAUGE_COUNT
+} omnmGauge;
+
+typedef struct OmnmGauges
+{
+    // Atomic purely so they can be read from other threads
+    std::atomic<int64_t>    mValues[OMNM_GAUGE_COUNT];
+    std::atomic<uint64_t>   mLargestBuffer;
+
+    // Set for the gauges shared by threads which are exiting
+    bool                    mShared;
+
+    // Next in the list of gauges left behind by exited threads
+    OmnmGauges*             mNextSpare;
+} OmnmGauges;
+
+extern thread_local OmnmGauges* tOmnmGauges;
+
+// Binds gauges to the calling thread the first time it needs them
+OmnmGauges*
+omnmmsgAccountingImpl_bind ();
+
+static inline OmnmGauges*
+omnmmsgAccountingImpl_local ()
+{
+    OmnmGauges* gauges = tOmnmGauges;
+    return NULL != gauges ? gauges : omnmmsgAccountingImpl_bind ();
+}
+
+static inline void
+omnmmsgAccountingImpl_add (omnmGauge gauge, int64_t delta)
+{
+    OmnmGauges*           gauges = omnmmsgAccountingImpl_local ();
+    std::atomic<int64_t>& value  = gauges->mValues[gauge];
+    if (gauges->mShared)
+    {
+        value.fetch_add (delta, std::memory_order_relaxed);
+    }
+    else
+    {
+        // Only the owning thread writes, so this needs no locked instruction
+        value.store (value.load (std::memory_order_relaxed) + delta,
+                     std::memory_order_relaxed);
+    }
+}
+
+static inline void
+omnmmsgAccountingImpl_noteBuffer (size_t size)
+{
+    OmnmGauges* gauges = omnmmsgAccountingImpl_local ();
+    if (size > gauges->mLargestBuffer.load (std::memory_order_relaxed) && !gauges->mShared)
+    {
+        gauges->mLargestBuffer.store (size, std::memory_order_relaxed);
+    }
+}
+
+#endif /* MAMA_BRIDGE_OMNM_ACCOUNTING_H__ */
@@ -0,0 +1,127 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*=========================================================================
+  =                             Includes                                  =
+  =========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#include <mama/mama.h>
+
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+#include "Allocator.h"
+
+/*=========================================================================
+  =                  Private implementation functions                     =
+  =========================================================================*/
+
+static void*
+heapMalloc (mama_size_t size, void* closure)
+{
+    return malloc (size);
+}
+
+static void*
+heapRealloc (void* memory, mama_size_t size, void* closure)
+{
+    return realloc (memory, size);
+}
+
+static void
+heapFree (void* memory, void* closure)
+{
+    free (memory);
+}
+
+/*=========================================================================
+  =                Typedefs, structs, enums and globals                   =
+  =========================================================================*/
+
+const omnmAllocator gOmnmHeapAllocator = { heapMalloc, heapRealloc, heapFree, NULL };
+
+static std::atomic<const omnmAllocator*> gDefaultAllocator (&gOmnmHeapAllocator);
+
+/*=========================================================================
+  =                   Public implementation functions                     =
+  =========================================================================*/
+
+const omnmAllocator*
+omnmmsgAllocatorImpl_getDefault ()
+{
+    return gDefaultAllocator.load (std::memory_order_acquire);
+}
+
+int
+omnmmsgAllocatorImpl_allocateBufferMemory (const omnmAllocator*  allocator,
+                                           void**                buffer,
+                                           size_t*               size,
+                                           size_t                newSize)
+{
+    if (newSize <= *size)
+    {
+        return 0;
+    }
+
+    allocator = omnmmsgAllocatorImpl_resolve (allocator);
+    void* grown = allocator->mRealloc (*buffer, newSize, allocator->mClosure);
+    if (NULL == grown)
+    {
+        return 1;
+    }
+
+    memset ((uint8_t*) grown + *size, 0, newSize - *size);
+    *buffer = grown;
+    *size   = newSize;
+    return 0;
+}
+
+mama_status
+omnmmsgPayloadImpl_setAllocator (const omnmAllocator* allocator)
+{
+    if (NULL == allocator)
+    {
+        allocator = &gOmnmHeapAllocator;
+    }
+    else if (NULL == allocator->mMalloc ||
+             NULL == allocator->mRealloc ||
+             NULL == allocator->mFree)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    gDefaultAllocator.store (allocator, std::memory_order_release);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_getAllocator (const omnmAllocator** allocator)
+{
+    if (NULL == allocator) return MAMA_STATUS_NULL_ARG;
+    *allocator = omnmmsgAllocatorImpl_getDefault ();
+    return MAMA_STATUS_OK;
+}
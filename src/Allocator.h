@@ -0,0 +1,90 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef MAMA_BRIDGE_OMNM_ALLOCATOR_H__
+#define MAMA_BRIDGE_OMNM_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <string.h>
+
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+
+// Plain malloc / realloc / free, used unless something else is registered
+extern const omnmAllocator gOmnmHeapAllocator;
+
+/**
+ * Returns the allocator which payloads created through the bridge use.
+ */
+const omnmAllocator*
+omnmmsgAllocatorImpl_getDefault ();
+
+// Owners which were never given an allocator (e.g. zero initialized structs)
+// use the heap
+static inline const omnmAllocator*
+omnmmsgAllocatorImpl_resolve (const omnmAllocator* allocator)
+{
+    return NULL == allocator ? &gOmnmHeapAllocator : allocator;
+}
+
+static inline void*
+omnmmsgAllocatorImpl_malloc (const omnmAllocator* allocator, size_t size)
+{
+    allocator = omnmmsgAllocatorImpl_resolve (allocator);
+    return allocator->mMalloc (size, allocator->mClosure);
+}
+
+static inline void*
+omnmmsgAllocatorImpl_calloc (const omnmAllocator* allocator, size_t size)
+{
+    void* memory = omnmmsgAllocatorImpl_malloc (allocator, size);
+    if (NULL != memory)
+    {
+        memset (memory, 0, size);
+    }
+    return memory;
+}
+
+static inline void
+omnmmsgAllocatorImpl_free (const omnmAllocator* allocator, void* memory)
+{
+    allocator = omnmmsgAllocatorImpl_resolve (allocator);
+    allocator->mFree (memory, allocator->mClosure);
+}
+
+/**
+ * Same contract as wombat's allocateBufferMemory, but through the given
+ * allocator: grows the buffer to at least newSize, zero filling the new
+ * bytes, and updates size. Never shrinks.
+ *
+ * @return 0 on success, non-zero if the memory could not be allocated (in
+ *         which case the buffer is left untouched).
+ */
+int
+omnmmsgAllocatorImpl_allocateBufferMemory (const omnmAllocator*  allocator,
+                                           void**                buffer,
+                                           size_t*               size,
+                                           size_t                newSize);
+
+#endif /* MAMA_BRIDGE_OMNM_ALLOCATOR_H__ */
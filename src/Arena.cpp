@@ -0,0 +1,273 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*=========================================================================
+  =                             Includes                                  =
+  =========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#include <mama/mama.h>
+
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+#include "Payload.h"
+#include "Arena.h"
+#include "Allocator.h"
+#include "Accounting.h"
+
+/*=========================================================================
+  =                Typedefs, structs, enums and globals                   =
+  =========================================================================*/
+
+// Every allocation is rounded up to this so anything may be placed in it
+#define OMNM_ARENA_ALIGNMENT    16
+
+struct omnmArenaBlock
+{
+    omnmArenaBlock*     mNext;
+    size_t              mSize;      /* Usable bytes following the header */
+    size_t              mUsed;
+};
+
+// Header rounded up so the first allocation in a block is aligned too
+#define OMNM_ARENA_BLOCK_HEADER_SIZE                                           \
+    ((sizeof(omnmArenaBlock) + OMNM_ARENA_ALIGNMENT - 1) & ~(size_t)(OMNM_ARENA_ALIGNMENT - 1))
+
+// Epochs are unique across all arenas, so a field cache can never mistake
+// another arena's objects for its own
+static std::atomic<mama_u64_t> gArenaEpoch (0);
+
+/*=========================================================================
+  =                  Private implementation functions                     =
+  =========================================================================*/
+
+static inline uint8_t*
+blockData (omnmArenaBlock* block)
+{
+    return (uint8_t*) block + OMNM_ARENA_BLOCK_HEADER_SIZE;
+}
+
+static void
+destroyPayloads (omnmArena* arena)
+{
+    OmnmPayloadImpl* impl = arena->mPayloads;
+    while (NULL != impl)
+    {
+        OmnmPayloadImpl* next = impl->mPoolNext;
+        impl->~OmnmPayloadImpl();
+        impl = next;
+    }
+    arena->mPayloads = NULL;
+    if (NULL != arena->mRef)
+    {
+        arena->mRef->mFreeCount = 0;
+    }
+}
+
+static void
+freeRecycled (omnmArenaRef* ref)
+{
+    if (NULL == ref->mFree)
+    {
+        return;
+    }
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_ARENA_BYTES, -(int64_t) ref->mFreeSize);
+    omnmmsgAllocatorImpl_free (ref->mAllocator, ref->mFree);
+    ref->mFree      = NULL;
+    ref->mFreeCount = 0;
+    ref->mFreeSize  = 0;
+}
+
+/*=========================================================================
+  =                   Public implementation functions                     =
+  =========================================================================*/
+
+void*
+omnmmsgArenaImpl_allocate (omnmArena*            arena,
+                           const omnmAllocator*  allocator,
+                           size_t                size)
+{
+    omnmArenaBlock* block = arena->mBlocks;
+
+    size = (size + OMNM_ARENA_ALIGNMENT - 1) & ~(size_t)(OMNM_ARENA_ALIGNMENT - 1);
+    if (NULL == block || block->mSize - block->mUsed < size)
+    {
+        // Each new block at least doubles the last so a busy payload soon
+        // settles on a single one
+        size_t blockSize = OMNM_ARENA_MIN_BLOCK_SIZE;
+        if (NULL != block && block->mSize * 2 > blockSize)
+        {
+            blockSize = block->mSize * 2;
+        }
+        if (size > blockSize)
+        {
+            blockSize = size;
+        }
+
+        omnmArenaBlock* grown = (omnmArenaBlock*) omnmmsgAllocatorImpl_malloc (
+                allocator, OMNM_ARENA_BLOCK_HEADER_SIZE + blockSize);
+        if (NULL == grown)
+        {
+            return NULL;
+        }
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_ARENA_BYTES,
+                                   OMNM_ARENA_BLOCK_HEADER_SIZE + blockSize);
+        grown->mNext  = block;
+        grown->mSize  = blockSize;
+        grown->mUsed  = 0;
+        arena->mBlocks = block = grown;
+    }
+
+    if (0 == arena->mEpoch)
+    {
+        arena->mEpoch = gArenaEpoch.fetch_add (1, std::memory_order_relaxed) + 1;
+    }
+
+    void* memory = blockData (block) + block->mUsed;
+    block->mUsed += size;
+    return memory;
+}
+
+void
+omnmmsgArenaImpl_track (omnmArena* arena, OmnmPayloadImpl* impl)
+{
+    impl->mPoolNext  = arena->mPayloads;
+    arena->mPayloads = impl;
+}
+
+void
+omnmmsgArenaImpl_recycle (omnmArenaRef* ref, OmnmPayloadImpl* impl)
+{
+    size_t needed = (ref->mFreeCount + 1) * sizeof(OmnmPayloadImpl*);
+    if (needed > ref->mFreeSize)
+    {
+        size_t previous = ref->mFreeSize;
+        if (0 != omnmmsgAllocatorImpl_allocateBufferMemory (ref->mAllocator,
+                                                            (void**) &ref->mFree,
+                                                            &ref->mFreeSize,
+                                                            needed * 2))
+        {
+            return;
+        }
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_ARENA_BYTES,
+                                   (int64_t) (ref->mFreeSize - previous));
+    }
+    ref->mFree[ref->mFreeCount++] = impl;
+}
+
+OmnmPayloadImpl*
+omnmmsgArenaImpl_reuse (omnmArena* arena)
+{
+    omnmArenaRef* ref = arena->mRef;
+    return NULL == ref || 0 == ref->mFreeCount ? NULL : ref->mFree[--ref->mFreeCount];
+}
+
+omnmArenaRef*
+omnmmsgArenaImpl_acquireRef (omnmArena* arena, const omnmAllocator* allocator)
+{
+    if (NULL == arena->mRef)
+    {
+        omnmArenaRef* ref = (omnmArenaRef*) omnmmsgAllocatorImpl_malloc (allocator,
+                                                                         sizeof(omnmArenaRef));
+        if (NULL == ref)
+        {
+            return NULL;
+        }
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_ARENA_BYTES, sizeof(omnmArenaRef));
+        ref->mArena     = arena;
+        ref->mRefs      = 1;
+        ref->mAllocator = allocator;
+        ref->mFree      = NULL;
+        ref->mFreeCount = 0;
+        ref->mFreeSize  = 0;
+        arena->mRef     = ref;
+    }
+    arena->mRef->mRefs++;
+    return arena->mRef;
+}
+
+void
+omnmmsgArenaImpl_releaseRef (omnmArenaRef* ref)
+{
+    if (NULL == ref || 0 != --ref->mRefs)
+    {
+        return;
+    }
+    freeRecycled (ref);
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_ARENA_BYTES, -(int64_t) sizeof(omnmArenaRef));
+    omnmmsgAllocatorImpl_free (ref->mAllocator, ref);
+}
+
+void
+omnmmsgArenaImpl_reset (omnmArena* arena, const omnmAllocator* allocator)
+{
+    if (0 == arena->mEpoch)
+    {
+        return;
+    }
+    destroyPayloads (arena);
+
+    // Only the newest (and largest) block is worth keeping
+    omnmArenaBlock* block = arena->mBlocks->mNext;
+    while (NULL != block)
+    {
+        omnmArenaBlock* next = block->mNext;
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_ARENA_BYTES,
+                                   -(int64_t) (OMNM_ARENA_BLOCK_HEADER_SIZE + block->mSize));
+        omnmmsgAllocatorImpl_free (allocator, block);
+        block = next;
+    }
+    arena->mBlocks->mNext = NULL;
+    arena->mBlocks->mUsed = 0;
+    arena->mEpoch         = 0;
+}
+
+void
+omnmmsgArenaImpl_release (omnmArena* arena, const omnmAllocator* allocator)
+{
+    omnmmsgArenaImpl_reset (arena, allocator);
+    if (NULL != arena->mRef)
+    {
+        arena->mRef->mArena = NULL;
+        freeRecycled (arena->mRef);
+        omnmmsgArenaImpl_releaseRef (arena->mRef);
+        arena->mRef = NULL;
+    }
+    if (NULL != arena->mBlocks)
+    {
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_ARENA_BYTES,
+                                   -(int64_t) (OMNM_ARENA_BLOCK_HEADER_SIZE + arena->mBlocks->mSize));
+        omnmmsgAllocatorImpl_free (allocator, arena->mBlocks);
+        arena->mBlocks = NULL;
+    }
+}
+
+size_t
+omnmmsgArenaImpl_getCapacity (const omnmArena* arena)
+{
+    return NULL == arena->mBlocks ? 0 : arena->mBlocks->mSize;
+}
@@ -0,0 +1,144 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MAMA_BRIDGE_OMNM_ARENA_H__
+#define MAMA_BRIDGE_OMNM_ARENA_H__
+
+#include <stddef.h>
+
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+
+// Smallest block the arena takes from the allocator at a time
+#define OMNM_ARENA_MIN_BLOCK_SIZE   1024
+
+class OmnmPayloadImpl;
+
+typedef struct omnmArenaBlock omnmArenaBlock;
+typedef struct omnmArena      omnmArena;
+
+/*
+ * How a field cache refers to the arena its sub-payloads came from. The cache
+ * may outlive the arena, such as an iterator destroyed after its message, so
+ * this stays around until the last of them lets go and only points at the
+ * arena for as long as it exists. It also holds the sub-payloads handed back
+ * to the arena, which only matter once there is a cache to hand them back.
+ */
+typedef struct omnmArenaRef
+{
+    omnmArena*              mArena;     /* NULL once the arena is gone */
+    mama_u32_t              mRefs;      /* The arena's and each cache's */
+    const omnmAllocator*    mAllocator;
+    OmnmPayloadImpl**       mFree;      /* Handed back, still tracked */
+    size_t                  mFreeCount;
+    size_t                  mFreeSize;  /* In bytes */
+} omnmArenaRef;
+
+/*
+ * Bump allocator owned by a payload for the objects its getters hand out
+ * (sub messages, vector message elements). Everything in it is released in
+ * one go when the payload is cleared, unserialized into or destroyed, at
+ * which point the epoch changes so field caches can tell that whatever they
+ * took from it is gone.
+ *
+ * The arena takes nothing from the allocator until it is first used, and
+ * keeps its newest block across resets. Sub-payloads a field cache is done
+ * with before then are handed back and reused, so a payload read through
+ * one short lived iterator after another doesn't keep growing its arena.
+ */
+struct omnmArena
+{
+    omnmArenaBlock*     mBlocks;    /* Newest first */
+    OmnmPayloadImpl*    mPayloads;  /* Constructed in the arena */
+    mama_u64_t          mEpoch;     /* 0 while nothing has been handed out */
+    omnmArenaRef*       mRef;       /* NULL until a field cache needs one */
+};
+
+/**
+ * Takes memory from the arena, suitably aligned for any object.
+ *
+ * @return The memory, or NULL if the allocator failed.
+ */
+void*
+omnmmsgArenaImpl_allocate (omnmArena*            arena,
+                           const omnmAllocator*  allocator,
+                           size_t                size);
+
+/**
+ * Has the arena run the destructor of a payload constructed in its memory
+ * when it is next reset.
+ */
+void
+omnmmsgArenaImpl_track (omnmArena* arena, OmnmPayloadImpl* impl);
+
+/**
+ * Hands back a sub-payload constructed in the arena, for the next one to be
+ * created to reuse. It is still destroyed when the arena is next reset, so
+ * a failure to hold on to it loses nothing.
+ */
+void
+omnmmsgArenaImpl_recycle (omnmArenaRef* ref, OmnmPayloadImpl* impl);
+
+/**
+ * Takes back a sub-payload handed back since the last reset.
+ *
+ * @return The payload, or NULL if there are none.
+ */
+OmnmPayloadImpl*
+omnmmsgArenaImpl_reuse (omnmArena* arena);
+
+/**
+ * Takes a reference to the arena for a field cache to hold.
+ *
+ * @return The reference, or NULL if the allocator failed.
+ */
+omnmArenaRef*
+omnmmsgArenaImpl_acquireRef (omnmArena* arena, const omnmAllocator* allocator);
+
+/**
+ * Lets go of a reference taken by omnmmsgArenaImpl_acquireRef.
+ */
+void
+omnmmsgArenaImpl_releaseRef (omnmArenaRef* ref);
+
+/**
+ * Destroys everything handed out since the last reset and rewinds the arena
+ * to the start of its newest block.
+ */
+void
+omnmmsgArenaImpl_reset (omnmArena* arena, const omnmAllocator* allocator);
+
+/**
+ * As reset, but hands all of the arena's blocks back to the allocator, and
+ * detaches it from any references field caches still hold.
+ */
+void
+omnmmsgArenaImpl_release (omnmArena* arena, const omnmAllocator* allocator);
+
+/**
+ * Size of the block the arena currently allocates from, or 0 if none.
+ */
+size_t
+omnmmsgArenaImpl_getCapacity (const omnmArena* arena);
+
+#endif /* MAMA_BRIDGE_OMNM_ARENA_H__ */
@@ -0,0 +1,489 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*=========================================================================
+  =                             Includes                                  =
+  =========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <mama/mama.h>
+
+#include "mama/integration/bridge/omnmmsgpayloadfunctions.h"
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+#include "Payload.h"
+#include "Batch.h"
+#include "ByteOrder.h"
+#include "Allocator.h"
+#include "Accounting.h"
+
+/*=========================================================================
+  =                  Private implementation functions                     =
+  =========================================================================*/
+
+static void
+releaseRetired (omnmBatchImpl* batch)
+{
+    if (NULL == batch->mRetired)
+    {
+        return;
+    }
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, -(int64_t) batch->mRetiredSize);
+    omnmmsgAllocatorImpl_free (batch->mAllocator, batch->mRetired);
+    batch->mRetired     = NULL;
+    batch->mRetiredSize = 0;
+}
+
+// Moves the first keep bytes into a buffer of at least capacity bytes. The
+// old buffer is retired rather than freed, for the caller to free once it
+// has finished with it.
+static mama_status
+growBuffer (omnmBatchImpl* batch, size_t capacity, size_t keep)
+{
+    size_t   grown  = batch->mBufferSize * 2;
+    size_t   size   = capacity > grown ? capacity : grown;
+    uint8_t* buffer = (uint8_t*) omnmmsgAllocatorImpl_malloc (batch->mAllocator, size);
+    if (NULL == buffer)
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, size);
+    if (0 != keep)
+    {
+        memcpy (buffer, batch->mBuffer, keep);
+    }
+
+    releaseRetired (batch);
+    batch->mRetired     = batch->mBuffer;
+    batch->mRetiredSize = batch->mBufferSize;
+    batch->mBuffer      = buffer;
+    batch->mBufferSize  = size;
+    return MAMA_STATUS_OK;
+}
+
+static mama_status
+ensureCapacity (omnmBatchImpl* batch, size_t capacity)
+{
+    if (capacity <= batch->mBufferSize)
+    {
+        return MAMA_STATUS_OK;
+    }
+    mama_status status = growBuffer (batch, capacity, batch->mTail);
+    releaseRetired (batch);
+    return status;
+}
+
+// Makes sure there is an offset for one more payload, moving those already
+// added along if the table has to grow
+static mama_status
+reserveOffset (omnmBatchImpl* batch)
+{
+    if (batch->mCount < batch->mTableCapacity)
+    {
+        return MAMA_STATUS_OK;
+    }
+
+    mama_u32_t capacity = batch->mTableCapacity * 2;
+    size_t     shift    = (capacity - batch->mTableCapacity) * sizeof(mama_u32_t);
+    if (MAMA_STATUS_OK != ensureCapacity (batch, batch->mTail + shift))
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    mama_u32_t* offsets = (mama_u32_t*) omnmmsgAllocatorImpl_malloc (
+                              batch->mAllocator, capacity * sizeof(mama_u32_t));
+    if (NULL == offsets)
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    memcpy (offsets, batch->mOffsets, batch->mCount * sizeof(mama_u32_t));
+    omnmmsgAllocatorImpl_free (batch->mAllocator, batch->mOffsets);
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, shift);
+
+    // Offsets are from the start of the payloads, so moving them all along
+    // leaves them as they were
+    memmove (batch->mBuffer + batch->mDataStart + shift,
+             batch->mBuffer + batch->mDataStart,
+             batch->mTail - batch->mDataStart);
+    batch->mDataStart     += shift;
+    batch->mTail          += shift;
+    batch->mOffsets        = offsets;
+    batch->mTableCapacity  = capacity;
+    return MAMA_STATUS_OK;
+}
+
+static mama_status
+recordPayload (omnmBatchImpl* batch, size_t length)
+{
+    size_t offset = batch->mTail - batch->mDataStart;
+    if (offset > UINT32_MAX)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    batch->mOffsets[batch->mCount++] = (mama_u32_t) offset;
+    batch->mTail += length;
+    return MAMA_STATUS_OK;
+}
+
+// The payload being built has outgrown what is left of the buffer. Whatever
+// it has written so far is moved across by the payload itself.
+static void*
+growForBuilder (msgPayload   msg,
+                mama_size_t  required,
+                mama_size_t* capacity,
+                void*        closure)
+{
+    omnmBatchImpl* batch = (omnmBatchImpl*) closure;
+    size_t         start = batch->mTail;
+    if (MAMA_STATUS_OK != growBuffer (batch, start + required, start))
+    {
+        return NULL;
+    }
+    *capacity = batch->mBufferSize - start;
+    return batch->mBuffer + start;
+}
+
+static mama_u32_t
+readU32 (const uint8_t* data, bool swap)
+{
+    mama_u32_t value;
+    memcpy (&value, data, sizeof(value));
+    return swap ? OMNM_BSWAP32(value) : value;
+}
+
+// Checks the header and that the frame is long enough for the table
+static mama_status
+readBatchHeader (const void*  buffer,
+                 mama_size_t  bufferLength,
+                 mama_u32_t*  count,
+                 bool*        swap)
+{
+    omnmBatchHeader header;
+
+    if (bufferLength < sizeof(header))
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    memcpy (&header, buffer, sizeof(header));
+    if (OMNM_BATCH_ID != header.mType || OMNM_BATCH_VERSION != header.mVersion)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+
+    *swap  = 0 != omnmmsgByteOrderImpl_needsSwap (header.mFlags);
+    *count = readU32 ((const uint8_t*) &header.mCount, *swap);
+    if ((bufferLength - sizeof(header)) / sizeof(mama_u32_t) < *count)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    return MAMA_STATUS_OK;
+}
+
+/*=========================================================================
+  =                   Public implementation functions                     =
+  =========================================================================*/
+
+mama_status
+omnmmsgPayloadImpl_createBatch (omnmBatch* batch, mama_u32_t capacity)
+{
+    if (NULL == batch) return MAMA_STATUS_NULL_ARG;
+
+    const omnmAllocator* allocator = omnmmsgAllocatorImpl_getDefault ();
+    omnmBatchImpl*       impl      = (omnmBatchImpl*) omnmmsgAllocatorImpl_calloc (
+                                         allocator, sizeof(omnmBatchImpl));
+    if (NULL == impl)
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+
+    impl->mAllocator     = allocator;
+    impl->mTableCapacity = 0 == capacity ? OMNM_BATCH_DEFAULT_CAPACITY : capacity;
+    impl->mDataStart     = sizeof(omnmBatchHeader) + impl->mTableCapacity * sizeof(mama_u32_t);
+    impl->mOffsets       = (mama_u32_t*) omnmmsgAllocatorImpl_malloc (
+                               allocator, impl->mTableCapacity * sizeof(mama_u32_t));
+    if (NULL == impl->mOffsets
+        || MAMA_STATUS_OK != ensureCapacity (impl, impl->mDataStart))
+    {
+        omnmmsgPayloadImpl_destroyBatch (impl);
+        return MAMA_STATUS_NOMEM;
+    }
+    impl->mTail          = impl->mDataStart;
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED,
+                               impl->mTableCapacity * sizeof(mama_u32_t));
+    *batch = impl;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_destroyBatch (omnmBatch batch)
+{
+    if (NULL == batch) return MAMA_STATUS_NULL_ARG;
+
+    const omnmAllocator* allocator = batch->mAllocator;
+    if (NULL != batch->mBuilder)
+    {
+        omnmmsgPayload_destroy (batch->mBuilder);
+    }
+    releaseRetired (batch);
+    if (NULL != batch->mBuffer)
+    {
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, -(int64_t) batch->mBufferSize);
+        omnmmsgAllocatorImpl_free (allocator, batch->mBuffer);
+    }
+    if (NULL != batch->mOffsets)
+    {
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED,
+                                   -(int64_t) (batch->mTableCapacity * sizeof(mama_u32_t)));
+        omnmmsgAllocatorImpl_free (allocator, batch->mOffsets);
+    }
+    omnmmsgAllocatorImpl_free (allocator, batch);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_appendToBatch (omnmBatch batch, msgPayload msg)
+{
+    omnmIoVec   segments[16];
+    mama_u32_t  count  = sizeof(segments) / sizeof(segments[0]);
+    mama_size_t length = 0;
+
+    if (NULL == batch || NULL == msg) return MAMA_STATUS_NULL_ARG;
+    if (batch->mBuilding) return MAMA_STATUS_INVALID_ARG;
+
+    mama_status status = reserveOffset (batch);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+
+    // A payload with more references than there are segments here is
+    // flattened by serializing it as usual
+    status = omnmmsgPayloadImpl_serializeSegments (msg, segments, &count, &length);
+    if (MAMA_STATUS_INVALID_ARG == status)
+    {
+        count  = 1;
+        status = omnmmsgPayload_serialize (msg, &segments[0].mBase, &length);
+        segments[0].mLength = length;
+    }
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    if (MAMA_STATUS_OK != ensureCapacity (batch, batch->mTail + length))
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+
+    uint8_t* target = batch->mBuffer + batch->mTail;
+    for (mama_u32_t i = 0; i < count; i++)
+    {
+        memcpy (target, segments[i].mBase, segments[i].mLength);
+        target += segments[i].mLength;
+    }
+    return recordPayload (batch, length);
+}
+
+mama_status
+omnmmsgPayloadImpl_beginBatchPayload (omnmBatch batch, msgPayload* msg)
+{
+    if (NULL == batch || NULL == msg) return MAMA_STATUS_NULL_ARG;
+    if (batch->mBuilding) return MAMA_STATUS_INVALID_ARG;
+
+    mama_status status = reserveOffset (batch);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    if (MAMA_STATUS_OK != ensureCapacity (batch, batch->mTail + sizeof(omnmHeader)))
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    if (NULL == batch->mBuilder)
+    {
+        status = omnmmsgPayloadImpl_createWithAllocator (&batch->mBuilder, batch->mAllocator);
+        if (MAMA_STATUS_OK != status)
+        {
+            return status;
+        }
+    }
+
+    status = omnmmsgPayloadImpl_attachBuffer (batch->mBuilder,
+                                              batch->mBuffer + batch->mTail,
+                                              batch->mBufferSize - batch->mTail,
+                                              growForBuilder,
+                                              batch);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    batch->mBuilding = true;
+    *msg = batch->mBuilder;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_endBatchPayload (omnmBatch batch)
+{
+    void*       region = NULL;
+    mama_size_t length = 0;
+
+    if (NULL == batch) return MAMA_STATUS_NULL_ARG;
+    if (!batch->mBuilding) return MAMA_STATUS_INVALID_ARG;
+
+    // Whatever happens the payload is finished with, and has long since
+    // been moved out of any buffer the batch grew out of
+    batch->mBuilding = false;
+    mama_status status = omnmmsgPayloadImpl_finishBuffer (batch->mBuilder, &region, &length);
+    releaseRetired (batch);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    return recordPayload (batch, length);
+}
+
+mama_status
+omnmmsgPayloadImpl_finishBatch (omnmBatch     batch,
+                                const void**  buffer,
+                                mama_size_t*  bufferLength)
+{
+    omnmBatchHeader header;
+
+    if (NULL == batch || NULL == buffer || NULL == bufferLength)
+        return MAMA_STATUS_NULL_ARG;
+    if (batch->mBuilding) return MAMA_STATUS_INVALID_ARG;
+
+    size_t   table = batch->mCount * sizeof(mama_u32_t);
+    uint8_t* frame = batch->mBuffer + batch->mDataStart - table - sizeof(header);
+
+    header.mType     = OMNM_BATCH_ID;
+    header.mVersion  = OMNM_BATCH_VERSION;
+    header.mFlags    = OMNM_HOST_BYTE_ORDER_FLAG;
+    header.mReserved = 0;
+    header.mCount    = batch->mCount;
+    memcpy (frame, &header, sizeof(header));
+    memcpy (frame + sizeof(header), batch->mOffsets, table);
+
+    *buffer       = frame;
+    *bufferLength = batch->mBuffer + batch->mTail - frame;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_clearBatch (omnmBatch batch)
+{
+    void*       region = NULL;
+    mama_size_t length = 0;
+
+    if (NULL == batch) return MAMA_STATUS_NULL_ARG;
+
+    if (batch->mBuilding)
+    {
+        batch->mBuilding = false;
+        omnmmsgPayloadImpl_finishBuffer (batch->mBuilder, &region, &length);
+        releaseRetired (batch);
+    }
+    batch->mCount = 0;
+    batch->mTail  = batch->mDataStart;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_getBatchCount (const void*  buffer,
+                                  mama_size_t  bufferLength,
+                                  mama_u32_t*  count)
+{
+    bool swap = false;
+
+    if (NULL == buffer || NULL == count) return MAMA_STATUS_NULL_ARG;
+
+    mama_status status = readBatchHeader (buffer, bufferLength, count, &swap);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+
+    // Every payload has to lie within the frame and be at least a header
+    const uint8_t* table    = (const uint8_t*) buffer + sizeof(omnmBatchHeader);
+    size_t         data     = bufferLength - sizeof(omnmBatchHeader)
+                            - *count * sizeof(mama_u32_t);
+    size_t         previous = 0;
+    for (mama_u32_t i = 0; i < *count; i++)
+    {
+        size_t offset = readU32 (table + i * sizeof(mama_u32_t), swap);
+        if (offset < previous || offset > data
+            || (0 != i && offset - previous < sizeof(omnmHeaderV1)))
+        {
+            return MAMA_STATUS_INVALID_ARG;
+        }
+        previous = offset;
+    }
+    if (0 != *count && data - previous < sizeof(omnmHeaderV1))
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_getBatchPayload (const void*  buffer,
+                                    mama_size_t  bufferLength,
+                                    mama_u32_t   index,
+                                    msgPayload*  msg)
+{
+    mama_u32_t count = 0;
+    bool       swap  = false;
+
+    if (NULL == buffer || NULL == msg) return MAMA_STATUS_NULL_ARG;
+
+    mama_status status = readBatchHeader (buffer, bufferLength, &count, &swap);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    if (index >= count)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+
+    const uint8_t* table = (const uint8_t*) buffer + sizeof(omnmBatchHeader);
+    const uint8_t* data  = table + count * sizeof(mama_u32_t);
+    size_t         limit = (const uint8_t*) buffer + bufferLength - data;
+    size_t         begin = readU32 (table + index * sizeof(mama_u32_t), swap);
+    size_t         end   = index + 1 < count
+                         ? readU32 (table + (index + 1) * sizeof(mama_u32_t), swap)
+                         : limit;
+    if (begin >= end || end > limit)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+
+    if (NULL == *msg)
+    {
+        return omnmmsgPayloadImpl_createView (msg, data + begin, end - begin);
+    }
+    omnmmsgPayloadImpl_setViewMode (*msg, 1);
+    return omnmmsgPayload_unSerialize (*msg, data + begin, end - begin);
+}
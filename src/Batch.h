@@ -0,0 +1,83 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MAMA_BRIDGE_OMNM_BATCH_H__
+#define MAMA_BRIDGE_OMNM_BATCH_H__
+
+#include "Payload.h"
+
+// Where a payload starts with MAMA_PAYLOAD_ID_OMNM, a batch starts with this
+#define OMNM_BATCH_ID                   'B'
+#define OMNM_BATCH_VERSION              1
+
+// Offset table entries reserved up front when the caller gives no estimate
+#define OMNM_BATCH_DEFAULT_CAPACITY     16
+
+/*
+ * The header of a batch frame. It is followed by a u32 offset for each
+ * payload, counted from the end of the table, then the serialized payloads
+ * back to back. Each payload runs up to the next one's offset, and the last
+ * to the end of the frame.
+ */
+typedef struct omnmBatchHeader
+{
+    mama_u8_t   mType;      /* OMNM_BATCH_ID */
+    mama_u8_t   mVersion;
+    mama_u8_t   mFlags;     /* OMNM_HEADER_FLAG_* byte order of the table */
+    mama_u8_t   mReserved;
+    mama_u32_t  mCount;
+} omnmBatchHeader;
+
+/*
+ * Payloads are written from mDataStart on, leaving room ahead of them for the
+ * header and a table of mTableCapacity offsets. Finishing writes the header
+ * and table just in front of the payloads, so the frame starts however much
+ * of that room is left unused rather than having to move anything.
+ */
+struct omnmBatchImpl
+{
+    const omnmAllocator*  mAllocator;
+    uint8_t*              mBuffer;
+    size_t                mBufferSize;
+    size_t                mDataStart;
+    size_t                mTail;
+
+    // Offsets of the payloads so far, from mDataStart
+    mama_u32_t*           mOffsets;
+    mama_u32_t            mCount;
+    mama_u32_t            mTableCapacity;
+
+    // The payload built in place by beginBatchPayload, attached at mTail
+    // while mBuilding is set
+    msgPayload            mBuilder;
+    bool                  mBuilding;
+
+    // A buffer the batch has grown out of while a payload was being built in
+    // it. The payload is moved out of it after it is replaced, so it can only
+    // be freed once that is done.
+    uint8_t*              mRetired;
+    size_t                mRetiredSize;
+};
+
+#endif /* MAMA_BRIDGE_OMNM_BATCH_H__ */
@@ -4,6 +4,7 @@
 
 #include "Benchmarker.h"
 #include "mama/integration/bridge/omnmmsgpayloadfunctions.h"
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
 // C++ Header
 #include <mama/MamaMsg.h>
 // C Header
@@ -13,6 +14,20 @@
 // We always want the asserts to apply - this is not a release binary tool.
 #undef NDEBUG
 #include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include <atomic>
+#include <thread>
+#include <vector>
 
 #define SEND_TIME_FID 16
 #define PADDING_FID 10004
@@ -20,6 +35,7 @@
 
 #define ITERATION_COUNT 100000000
 #define ONE_MILLION 1000000
+#define COLD_START_MESSAGES 32
 
 using namespace Wombat;
 
@@ -110,6 +126,350 @@ void Benchmarker::runSerializationTests(uint64_t repeats) {
     }
 }
 
+// Reuses one payload for small messages after it has once grown to the given
+// high water mark. The cost per message should not depend on the mark.
+void Benchmarker::runReuseTests(uint64_t repeats, size_t highWaterMark) {
+    msgPayload payload;
+    msgPayload small;
+    omnmmsgPayload_create(&payload);
+    omnmmsgPayload_create(&small);
+    omnmmsgPayload_addU32(small, NULL, SEQ_NUM_FID, 1);
+
+    if (highWaterMark > 0) {
+        std::vector<char> snapshot(highWaterMark, 'A');
+        snapshot.back() = '\0';
+        omnmmsgPayload_addString(payload, NULL, PADDING_FID, &snapshot[0]);
+    }
+
+    const void* buf;
+    mama_size_t bufLen;
+    omnmmsgPayload_serialize(small, &buf, &bufLen);
+    for (uint64_t i = 1; i <= repeats; i++) {
+        omnmmsgPayload_clear(payload);
+        omnmmsgPayload_addU32(payload, NULL, SEQ_NUM_FID, (mama_u32_t) i);
+        omnmmsgPayload_unSerialize(payload, buf, bufLen);
+    }
+
+    omnmmsgPayload_destroy(small);
+    omnmmsgPayload_destroy(payload);
+}
+
+// Resident set size of this process in KB, where the platform exposes it
+static size_t currentRssKb() {
+    size_t rss = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm != nullptr) {
+        unsigned long size, resident;
+        if (fscanf(statm, "%lu %lu", &size, &resident) == 2) {
+            rss = resident * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+        fclose(statm);
+    }
+    return rss;
+}
+
+// Many long lived payloads each see one outlier followed by ordinary small
+// messages. Returns the RSS once the small messages have gone through.
+size_t Benchmarker::runTrimTests(size_t payloadCount, size_t outlierSize, bool trim) {
+    omnmPayloadTrimPolicy previous;
+    omnmPayloadTrimPolicy policy = { 1024, trim ? 4u : 0u };
+    omnmmsgPayloadImpl_getTrimPolicy(&previous);
+    omnmmsgPayloadImpl_setTrimPolicy(&policy);
+
+    std::vector<char> outlier(outlierSize, 'A');
+    outlier.back() = '\0';
+    std::vector<msgPayload> payloads(payloadCount);
+    for (msgPayload& payload : payloads) {
+        omnmmsgPayload_create(&payload);
+        omnmmsgPayload_addString(payload, NULL, PADDING_FID, &outlier[0]);
+    }
+    for (int use = 0; use < 8; use++) {
+        for (msgPayload& payload : payloads) {
+            omnmmsgPayload_clear(payload);
+            omnmmsgPayload_addU32(payload, NULL, SEQ_NUM_FID, use);
+        }
+    }
+#if defined(__GLIBC__)
+    // Hand whatever was freed back to the OS so RSS reflects what is in use
+    malloc_trim(0);
+#endif
+    size_t rss = currentRssKb();
+
+    for (msgPayload& payload : payloads) {
+        omnmmsgPayload_destroy(payload);
+    }
+    omnmmsgPayloadImpl_drainPool();
+    omnmmsgPayloadImpl_setTrimPolicy(&previous);
+    return rss;
+}
+
+// Builds a last value cache of small images, optionally freezing each one.
+// Returns how much the RSS grew in KB while the cache was being built.
+size_t Benchmarker::runFreezeTests(size_t imageCount, bool freeze) {
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+    size_t baseline = currentRssKb();
+
+    std::vector<msgPayload> images(imageCount);
+    for (size_t i = 0; i < imageCount; i++) {
+        omnmmsgPayload_create(&images[i]);
+        omnmmsgPayload_addU32(images[i], NULL, SEQ_NUM_FID, (mama_u32_t) i);
+        for (mama_fid_t fid = 100; fid < 120; fid++) {
+            omnmmsgPayload_addF64(images[i], NULL, fid, fid * 1.5);
+        }
+        if (freeze) {
+            omnmmsgPayloadImpl_freeze(&images[i]);
+        }
+    }
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+    size_t rss = currentRssKb();
+
+    for (msgPayload& image : images) {
+        omnmmsgPayload_destroy(image);
+    }
+    omnmmsgPayloadImpl_drainPool();
+    return rss > baseline ? rss - baseline : 0;
+}
+
+// Opens a counter of this thread's data TLB load misses, or returns -1 where
+// the platform or its permissions don't allow one
+static int openDtlbMissCounter() {
+#if defined(__linux__)
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+// Reads one field from each of a large number of payloads picked at random,
+// so most reads land on a page the TLB hasn't seen recently. Returns the
+// data TLB load misses during the reads, or UINT64_MAX if they couldn't be
+// counted.
+uint64_t Benchmarker::runHugePageTests(size_t payloadCount, uint64_t lookups, bool hugePages) {
+    const omnmAllocator* allocator = NULL;
+    if (hugePages) {
+        omnmmsgPayloadImpl_getHugePageAllocator(&allocator);
+    }
+
+    std::vector<msgPayload> payloads(payloadCount);
+    for (size_t i = 0; i < payloadCount; i++) {
+        if (hugePages) {
+            omnmmsgPayloadImpl_createWithAllocator(&payloads[i], allocator);
+        } else {
+            omnmmsgPayload_create(&payloads[i]);
+        }
+        omnmmsgPayload_addString(payloads[i], NULL, PADDING_FID, gPadding);
+        for (mama_fid_t fid = 100; fid < 120; fid++) {
+            omnmmsgPayload_addF64(payloads[i], NULL, fid, fid * 1.5);
+        }
+    }
+
+    int counter = openDtlbMissCounter();
+#if defined(__linux__)
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    uint64_t random = 88172645463325252ULL;
+    double total = 0;
+    for (uint64_t i = 0; i < lookups; i++) {
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        mama_f64_t value = 0;
+        omnmmsgPayload_getF64(payloads[random % payloadCount], NULL, 119, &value);
+        total += value;
+    }
+    uint64_t misses = UINT64_MAX;
+#if defined(__linux__)
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = UINT64_MAX;
+        }
+        close(counter);
+    }
+#endif
+    assert(total > 0);
+    (void) total;
+
+    for (msgPayload& payload : payloads) {
+        omnmmsgPayload_destroy(payload);
+    }
+    omnmmsgPayloadImpl_drainPool();
+    return misses;
+}
+
+// A burst of messages as a process sees them on startup: each is built,
+// serialized and decoded into a second payload which is then iterated. All
+// of them stay alive until the end, as they would sitting in a queue.
+void Benchmarker::runColdStartTests(size_t messages) {
+    std::vector<msgPayload> payloads(messages * 2);
+    for (size_t i = 0; i < messages; i++) {
+        msgPayload& published = payloads[2 * i];
+        msgPayload& received = payloads[2 * i + 1];
+        omnmmsgPayload_create(&published);
+        omnmmsgPayload_addU32(published, NULL, SEQ_NUM_FID, (mama_u32_t) i);
+        omnmmsgPayload_addString(published, NULL, PADDING_FID, gPadding);
+        for (mama_fid_t fid = 100; fid < 120; fid++) {
+            omnmmsgPayload_addF64(published, NULL, fid, fid * 1.5);
+        }
+
+        const void* buffer = NULL;
+        mama_size_t length = 0;
+        omnmmsgPayload_serialize(published, &buffer, &length);
+        omnmmsgPayload_create(&received);
+        omnmmsgPayload_unSerialize(received, buffer, length);
+
+        msgPayloadIter iter = NULL;
+        omnmmsgPayloadIter_create(&iter, received);
+        while (omnmmsgPayloadIter_next(iter, NULL, received) != NULL) {
+        }
+        omnmmsgPayloadIter_destroy(iter);
+    }
+
+    for (msgPayload& payload : payloads) {
+        omnmmsgPayload_destroy(payload);
+    }
+}
+
+// Single producer / single consumer ring for handing payloads between threads
+class PayloadRing {
+public:
+    PayloadRing() : mHead(0), mTail(0) {}
+
+    bool push(msgPayload payload) {
+        uint64_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mHead.load(std::memory_order_acquire) == RING_SIZE) {
+            return false;
+        }
+        mSlots[tail % RING_SIZE] = payload;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    msgPayload pop() {
+        uint64_t head = mHead.load(std::memory_order_relaxed);
+        if (head == mTail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        msgPayload payload = mSlots[head % RING_SIZE];
+        mHead.store(head + 1, std::memory_order_release);
+        return payload;
+    }
+
+private:
+    static const uint64_t RING_SIZE = 1024;
+    msgPayload mSlots[RING_SIZE];
+    std::atomic<uint64_t> mHead;
+    std::atomic<uint64_t> mTail;
+};
+
+// Payloads are created on this thread and destroyed on the consumer threads,
+// as they would be when handed from a network thread to workers
+void Benchmarker::runPoolStressTests(uint64_t repeats, unsigned int consumers) {
+    std::vector<PayloadRing> rings(consumers);
+    std::vector<std::thread> threads;
+    std::atomic<bool> done(false);
+
+    for (unsigned int c = 0; c < consumers; c++) {
+        PayloadRing* ring = &rings[c];
+        threads.emplace_back([ring, &done] {
+            while (true) {
+                bool finished = done.load(std::memory_order_acquire);
+                msgPayload payload = ring->pop();
+                if (payload == nullptr) {
+                    if (finished) {
+                        break;
+                    }
+                    continue;
+                }
+                mama_u32_t seqNum = 0;
+                omnmmsgPayload_getU32(payload, NULL, SEQ_NUM_FID, &seqNum);
+                assert (seqNum != 0);
+                omnmmsgPayload_destroy(payload);
+            }
+        });
+    }
+
+    for (uint64_t i = 1; i <= repeats; i++) {
+        msgPayload payload;
+        omnmmsgPayload_create(&payload);
+        omnmmsgPayload_addU32(payload, NULL, SEQ_NUM_FID, (mama_u32_t) i);
+        omnmmsgPayload_addString(payload, NULL, PADDING_FID, gPadding);
+        PayloadRing& ring = rings[i % consumers];
+        while (!ring.push(payload)) {
+            std::this_thread::yield();
+        }
+    }
+    done.store(true, std::memory_order_release);
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// Packs messages into batches of the given size, either appending payloads
+// or building them in the frame, then reads each back out of the frame as a
+// view, as a sender and receiver each would
+void Benchmarker::runBatchTests(uint64_t messages, size_t batchSize, bool inPlace) {
+    omnmBatch batch;
+    msgPayload payload;
+    msgPayload view;
+    omnmmsgPayloadImpl_createBatch(&batch, (mama_u32_t) batchSize);
+    omnmmsgPayload_create(&payload);
+    omnmmsgPayload_create(&view);
+
+    for (uint64_t sent = 0; sent < messages; sent += batchSize) {
+        for (size_t i = 0; i < batchSize; i++) {
+            mama_u32_t seqNum = (mama_u32_t) (sent + i + 1);
+            if (inPlace) {
+                msgPayload built;
+                omnmmsgPayloadImpl_beginBatchPayload(batch, &built);
+                omnmmsgPayload_addU32(built, NULL, SEQ_NUM_FID, seqNum);
+                omnmmsgPayload_addString(built, NULL, PADDING_FID, gPadding);
+                omnmmsgPayloadImpl_endBatchPayload(batch);
+            } else {
+                omnmmsgPayload_clear(payload);
+                omnmmsgPayload_addU32(payload, NULL, SEQ_NUM_FID, seqNum);
+                omnmmsgPayload_addString(payload, NULL, PADDING_FID, gPadding);
+                omnmmsgPayloadImpl_appendToBatch(batch, payload);
+            }
+        }
+
+        const void* frame;
+        mama_size_t frameLen;
+        mama_u32_t count = 0;
+        omnmmsgPayloadImpl_finishBatch(batch, &frame, &frameLen);
+        omnmmsgPayloadImpl_getBatchCount(frame, frameLen, &count);
+        for (mama_u32_t i = 0; i < count; i++) {
+            mama_u32_t seqNum = 0;
+            omnmmsgPayloadImpl_getBatchPayload(frame, frameLen, i, &view);
+            omnmmsgPayload_getU32(view, NULL, SEQ_NUM_FID, &seqNum);
+            assert (seqNum == sent + i + 1);
+        }
+        omnmmsgPayloadImpl_clearBatch(batch);
+    }
+
+    omnmmsgPayload_destroy(view);
+    omnmmsgPayload_destroy(payload);
+    omnmmsgPayloadImpl_destroyBatch(batch);
+}
+
 int main(int argc, char* argv[]) {
     const char* bridge = getenv("MAMA_MW");
     if (bridge == nullptr) {
@@ -128,6 +488,22 @@ int main(int argc, char* argv[]) {
     MamaDateTime start;
     MamaDateTime finish;
 
+    // Cold start mode times nothing but the first messages of a fresh
+    // process, optionally after warming the pool: "coldstart [warm]"
+    if (argc > 1 && strcmp(argv[1], "coldstart") == 0) {
+        bool warm = argc > 2 && strcmp(argv[2], "warm") == 0;
+        if (warm && omnmmsgPayloadImpl_warmPool(2 * COLD_START_MESSAGES, 1024, 1) != MAMA_STATUS_OK) {
+            printf("Pool warmed, but its pages could not all be locked\n");
+        }
+        start.setToNow();
+        benchmarker->runColdStartTests(COLD_START_MESSAGES);
+        finish.setToNow();
+        uint64_t timeTaken = finish.getEpochTimeMicroseconds() - start.getEpochTimeMicroseconds();
+        printf("Benchmark for the first %d messages %s warm-up: %lluus\n",
+               COLD_START_MESSAGES, warm ? "with" : "without", (unsigned long long) timeTaken);
+        return 0;
+    }
+
     overallStart.setToNow();
 
     start.setToNow();
@@ -154,6 +530,76 @@ int main(int argc, char* argv[]) {
     timeTaken = finish.getEpochTimeMicroseconds() - start.getEpochTimeMicroseconds();
     printf("Benchmark for Serialization / Deserialization tests: %fs\n", ((float)timeTaken) / ONE_MILLION);
 
+    size_t highWaterMarks[] = {0, 64 * 1024, 1024 * 1024};
+    for (size_t highWaterMark : highWaterMarks) {
+        start.setToNow();
+        benchmarker->runReuseTests(ITERATION_COUNT / 10, highWaterMark);
+        finish.setToNow();
+        timeTaken = finish.getEpochTimeMicroseconds() - start.getEpochTimeMicroseconds();
+        printf("Benchmark for clear / unSerialize reuse after a %zu byte message: %fs\n",
+               highWaterMark, ((float)timeTaken) / ONE_MILLION);
+    }
+
+    size_t untrimmedRss = benchmarker->runTrimTests(2000, 256 * 1024, false);
+    size_t trimmedRss = benchmarker->runTrimTests(2000, 256 * 1024, true);
+    printf("RSS after 2000 payloads each see a 256KB outlier then small messages: %zuKB untrimmed, %zuKB trimmed\n",
+           untrimmedRss, trimmedRss);
+
+    size_t mutableRss = benchmarker->runFreezeTests(200000, false);
+    size_t frozenRss = benchmarker->runFreezeTests(200000, true);
+    printf("RSS growth for a 200000 image cache: %zuKB mutable, %zuKB frozen\n",
+           mutableRss, frozenRss);
+
+    const char* hugePageModes[] = {"regular", "huge"};
+    for (int hugePages = 0; hugePages < 2; hugePages++) {
+        start.setToNow();
+        uint64_t misses = benchmarker->runHugePageTests(50000, ITERATION_COUNT / 10, hugePages != 0);
+        finish.setToNow();
+        timeTaken = finish.getEpochTimeMicroseconds() - start.getEpochTimeMicroseconds();
+        if (misses == UINT64_MAX) {
+            printf("Benchmark for random reads across 50000 payloads on %s pages: %fs (dTLB misses: n/a)\n",
+                   hugePageModes[hugePages], ((float)timeTaken) / ONE_MILLION);
+        } else {
+            printf("Benchmark for random reads across 50000 payloads on %s pages: %fs (dTLB misses: %llu)\n",
+                   hugePageModes[hugePages], ((float)timeTaken) / ONE_MILLION, (unsigned long long) misses);
+        }
+    }
+    omnmHugePageStats hugePageStats;
+    omnmmsgPayloadImpl_getHugePageStats(&hugePageStats);
+    printf("Huge page regions: %llu hugetlb, %llu transparent, %llu regular\n",
+           (unsigned long long) hugePageStats.mHugeTlbRegions,
+           (unsigned long long) hugePageStats.mTransparentRegions,
+           (unsigned long long) hugePageStats.mRegularRegions);
+
+    size_t batchSizes[] = {1, 4, 16, 64, 256, 1024};
+    const char* batchModes[] = {"appended", "built in place"};
+    for (int inPlace = 0; inPlace < 2; inPlace++) {
+        for (size_t batchSize : batchSizes) {
+            uint64_t messages = ITERATION_COUNT / 100;
+            start.setToNow();
+            benchmarker->runBatchTests(messages, batchSize, inPlace != 0);
+            finish.setToNow();
+            timeTaken = finish.getEpochTimeMicroseconds() - start.getEpochTimeMicroseconds();
+            printf("Benchmark for batch round trips of %zu messages %s: %fs (%.0f messages/s)\n",
+                   batchSize, batchModes[inPlace], ((float)timeTaken) / ONE_MILLION,
+                   messages * (double) ONE_MILLION / (timeTaken ? timeTaken : 1));
+        }
+    }
+
+    omnmPayloadPoolStats before;
+    omnmPayloadPoolStats after;
+    omnmmsgPayloadImpl_getPoolStats(&before);
+    start.setToNow();
+    benchmarker->runPoolStressTests(ITERATION_COUNT / 10, 3);
+    finish.setToNow();
+    timeTaken = finish.getEpochTimeMicroseconds() - start.getEpochTimeMicroseconds();
+    omnmmsgPayloadImpl_getPoolStats(&after);
+    printf("Benchmark for create / destroy across threads (1 producer, 3 consumers): %fs (pool hits: %llu, misses: %llu, discards: %llu)\n",
+           ((float)timeTaken) / ONE_MILLION,
+           (unsigned long long) (after.mHits - before.mHits),
+           (unsigned long long) (after.mMisses - before.mMisses),
+           (unsigned long long) (after.mDiscards - before.mDiscards));
+
     overallFinish.setToNow();
     uint64_t overallTimeTaken = overallFinish.getEpochTimeMicroseconds() - overallStart.getEpochTimeMicroseconds();
     printf("Total for all tests: %fs\n", ((float)overallTimeTaken) / ONE_MILLION);
@@ -6,11 +6,19 @@
 #define OPENMAMA_OMNM_BENCHMARK_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 class Benchmarker {
 public:
     void runIterationTests(uint64_t repeats, bool readOnly = false, bool directAccess = false);
     void runSerializationTests(uint64_t repeats);
+    void runPoolStressTests(uint64_t repeats, unsigned int consumers);
+    void runReuseTests(uint64_t repeats, size_t highWaterMark);
+    size_t runTrimTests(size_t payloadCount, size_t outlierSize, bool trim);
+    size_t runFreezeTests(size_t imageCount, bool freeze);
+    uint64_t runHugePageTests(size_t payloadCount, uint64_t lookups, bool hugePages);
+    void runColdStartTests(size_t messages);
+    void runBatchTests(uint64_t messages, size_t batchSize, bool inPlace);
 };
 
 
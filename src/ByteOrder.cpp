@@ -0,0 +1,462 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*=========================================================================
+  =                             Includes                                  =
+  =========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mama/mama.h>
+
+#include "Payload.h"
+#include "ByteOrder.h"
+
+/*
+ * The SSSE3 byte shuffle is compiled in on any x86 GCC / Clang build and
+ * selected at runtime, so the library doesn't need to be built with -mssse3
+ * to benefit from it.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OMNM_BYTE_ORDER_SSSE3
+#include <immintrin.h>
+#endif
+
+/*=========================================================================
+  =                              Macros                                   =
+  =========================================================================*/
+
+// Guards against stack exhaustion on hostile input
+#define OMNM_MAX_NESTING_DEPTH  64
+
+/*=========================================================================
+  =                  Private implementation functions                     =
+  =========================================================================*/
+
+static void
+swapElementsScalar (uint8_t* data, size_t count, size_t width)
+{
+    size_t i = 0;
+    switch (width)
+    {
+    case sizeof(uint16_t):
+        for (i = 0; i < count; i++)
+        {
+            uint16_t value;
+            memcpy (&value, data + i * width, width);
+            value = OMNM_BSWAP16 (value);
+            memcpy (data + i * width, &value, width);
+        }
+        break;
+    case sizeof(uint32_t):
+        for (i = 0; i < count; i++)
+        {
+            uint32_t value;
+            memcpy (&value, data + i * width, width);
+            value = OMNM_BSWAP32 (value);
+            memcpy (data + i * width, &value, width);
+        }
+        break;
+    case sizeof(uint64_t):
+        for (i = 0; i < count; i++)
+        {
+            uint64_t value;
+            memcpy (&value, data + i * width, width);
+            value = OMNM_BSWAP64 (value);
+            memcpy (data + i * width, &value, width);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+#if defined(OMNM_BYTE_ORDER_SSSE3)
+static bool
+hostHasSsse3 ()
+{
+    __builtin_cpu_init ();
+    return 0 != __builtin_cpu_supports ("ssse3");
+}
+
+static const bool gHostHasSsse3 = hostHasSsse3 ();
+
+// Swaps whole 16 byte blocks and returns the number of elements covered
+__attribute__((target("ssse3")))
+static size_t
+swapElementsSsse3 (uint8_t* data, size_t count, size_t width)
+{
+    __m128i mask;
+    switch (width)
+    {
+    case sizeof(uint16_t):
+        mask = _mm_setr_epi8 (1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+        break;
+    case sizeof(uint32_t):
+        mask = _mm_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        break;
+    case sizeof(uint64_t):
+        mask = _mm_setr_epi8 (7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+        break;
+    default:
+        return 0;
+    }
+
+    size_t blockBytes = (count * width) & ~(size_t)(sizeof(__m128i) - 1);
+    for (size_t i = 0; i < blockBytes; i += sizeof(__m128i))
+    {
+        __m128i block = _mm_loadu_si128 ((const __m128i*)(data + i));
+        _mm_storeu_si128 ((__m128i*)(data + i), _mm_shuffle_epi8 (block, mask));
+    }
+    return blockBytes / width;
+}
+#endif
+
+static void
+swapElements (uint8_t* data, size_t count, size_t width)
+{
+    size_t done = 0;
+#if defined(OMNM_BYTE_ORDER_SSSE3)
+    if (gHostHasSsse3 && count * width >= sizeof(__m128i))
+    {
+        done = swapElementsSsse3 (data, count, width);
+    }
+#endif
+    swapElementsScalar (data + done * width, count - done, width);
+}
+
+static void
+swapDateTimes (uint8_t* data, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t* dateTime = data + i * sizeof(omnmDateTime);
+        swapElementsScalar (dateTime + offsetof(omnmDateTime, mSeconds), 1, sizeof(mama_i64_t));
+        swapElementsScalar (dateTime + offsetof(omnmDateTime, mNanoseconds), 1, sizeof(mama_u32_t));
+    }
+}
+
+static void
+swapPrices (uint8_t* data, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t* price = data + i * sizeof(omnmPrice);
+        swapElementsScalar (price + offsetof(omnmPrice, mValue), 1, sizeof(mama_f64_t));
+    }
+}
+
+// Swaps a 32 bit length in place, unless only checking, and returns its
+// value in host order
+static mama_u32_t
+swapLength (uint8_t* position, bool fromHost, bool apply)
+{
+    mama_u32_t raw;
+    memcpy (&raw, position, sizeof(raw));
+    mama_u32_t swapped = OMNM_BSWAP32 (raw);
+    if (apply)
+    {
+        memcpy (position, &swapped, sizeof(swapped));
+    }
+    return fromHost ? raw : swapped;
+}
+
+// With apply false, walks the payload exactly as a swap would, failing in
+// the same places, but changes nothing
+static mama_status
+swapPayload (uint8_t*   buffer,
+             size_t     bufferLength,
+             mama_u8_t  byteOrder,
+             mama_u8_t  assumedByteOrder,
+             int        depth,
+             bool       apply);
+
+static mama_status
+swapFieldData (mamaFieldType  type,
+               uint8_t*       data,
+               size_t         size,
+               mama_u8_t      byteOrder,
+               mama_u8_t      currentByteOrder,
+               int            depth,
+               bool           apply)
+{
+    // Only nested messages have anything in them which can fail
+    if (!apply && MAMA_FIELD_TYPE_MSG != type && MAMA_FIELD_TYPE_VECTOR_MSG != type)
+    {
+        return MAMA_STATUS_OK;
+    }
+
+    switch (type)
+    {
+    case MAMA_FIELD_TYPE_I16:
+    case MAMA_FIELD_TYPE_U16:
+    case MAMA_FIELD_TYPE_I32:
+    case MAMA_FIELD_TYPE_U32:
+    case MAMA_FIELD_TYPE_F32:
+    case MAMA_FIELD_TYPE_QUANTITY:
+    case MAMA_FIELD_TYPE_I64:
+    case MAMA_FIELD_TYPE_U64:
+    case MAMA_FIELD_TYPE_F64:
+        swapElementsScalar (data, 1, size);
+        break;
+    case MAMA_FIELD_TYPE_VECTOR_I16:
+    case MAMA_FIELD_TYPE_VECTOR_U16:
+        swapElements (data, size / sizeof(mama_u16_t), sizeof(mama_u16_t));
+        break;
+    case MAMA_FIELD_TYPE_VECTOR_I32:
+    case MAMA_FIELD_TYPE_VECTOR_U32:
+    case MAMA_FIELD_TYPE_VECTOR_F32:
+        swapElements (data, size / sizeof(mama_u32_t), sizeof(mama_u32_t));
+        break;
+    case MAMA_FIELD_TYPE_VECTOR_I64:
+    case MAMA_FIELD_TYPE_VECTOR_U64:
+    case MAMA_FIELD_TYPE_VECTOR_F64:
+        swapElements (data, size / sizeof(mama_u64_t), sizeof(mama_u64_t));
+        break;
+    case MAMA_FIELD_TYPE_TIME:
+    case MAMA_FIELD_TYPE_VECTOR_TIME:
+        swapDateTimes (data, size / sizeof(omnmDateTime));
+        break;
+    case MAMA_FIELD_TYPE_PRICE:
+    case MAMA_FIELD_TYPE_VECTOR_PRICE:
+        swapPrices (data, size / sizeof(omnmPrice));
+        break;
+    case MAMA_FIELD_TYPE_MSG:
+        return swapPayload (data, size, byteOrder, currentByteOrder, depth + 1, apply);
+    case MAMA_FIELD_TYPE_VECTOR_MSG:
+    {
+        bool   fromHost = OMNM_HOST_BYTE_ORDER_FLAG == currentByteOrder;
+        size_t position = 0;
+        while (position < size)
+        {
+            if (size - position < sizeof(mama_u32_t))
+            {
+                return MAMA_STATUS_INVALID_ARG;
+            }
+            mama_u32_t payloadLen = swapLength (data + position, fromHost, apply);
+            position += sizeof(mama_u32_t);
+            if (payloadLen > size - position)
+            {
+                return MAMA_STATUS_INVALID_ARG;
+            }
+            mama_status status = swapPayload (data + position,
+                                              payloadLen,
+                                              byteOrder,
+                                              currentByteOrder,
+                                              depth + 1,
+                                              apply);
+            VALIDATE_MAMA_STATUS_OK(status);
+            position += payloadLen;
+        }
+        break;
+    }
+    default:
+        /* Single byte and string based types have nothing to swap */
+        break;
+    }
+    return MAMA_STATUS_OK;
+}
+
+static mama_status
+swapPayload (uint8_t*   buffer,
+             size_t     bufferLength,
+             mama_u8_t  byteOrder,
+             mama_u8_t  assumedByteOrder,
+             int        depth,
+             bool       apply)
+{
+    if (depth > OMNM_MAX_NESTING_DEPTH || bufferLength < sizeof(omnmHeaderV1))
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+
+    omnmHeaderV1* header     = (omnmHeaderV1*) buffer;
+    size_t        headerSize = sizeof(omnmHeaderV1) + header->mRemainingHeaderSize;
+    mama_u8_t*    flags      = NULL;
+    mama_u8_t     current    = assumedByteOrder;
+
+    if (headerSize > bufferLength)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+
+    /*
+     * Nested payloads from older writers have no flags byte, in which case
+     * they share the byte order of the payload they were found in.
+     */
+    if (header->mRemainingHeaderSize > 0)
+    {
+        flags = buffer + sizeof(omnmHeaderV1);
+        if (0 != (*flags & OMNM_HEADER_FLAG_BYTE_ORDER_MASK))
+        {
+            current = *flags & OMNM_HEADER_FLAG_BYTE_ORDER_MASK;
+        }
+    }
+
+    if (0 == current)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    if (byteOrder == current)
+    {
+        return MAMA_STATUS_OK;
+    }
+
+    bool   fromHost = OMNM_HOST_BYTE_ORDER_FLAG == current;
+    size_t position = headerSize;
+    while (position < bufferLength)
+    {
+        mamaFieldType type = (mamaFieldType) buffer[position];
+        size_t        size = 0;
+        position += sizeof(mama_u8_t);
+
+        // Fid
+        if (bufferLength - position < sizeof(mama_fid_t))
+        {
+            return MAMA_STATUS_INVALID_ARG;
+        }
+        if (apply)
+        {
+            swapElementsScalar (buffer + position, 1, sizeof(mama_fid_t));
+        }
+        position += sizeof(mama_fid_t);
+
+        // Name, including its terminator
+        const void* nameEnd = memchr (buffer + position, '\0', bufferLength - position);
+        if (NULL == nameEnd)
+        {
+            return MAMA_STATUS_INVALID_ARG;
+        }
+        position = ((const uint8_t*) nameEnd - buffer) + 1;
+
+        switch (type)
+        {
+        case MAMA_FIELD_TYPE_BOOL:
+        case MAMA_FIELD_TYPE_CHAR:
+        case MAMA_FIELD_TYPE_I8:
+        case MAMA_FIELD_TYPE_U8:
+            size = sizeof(mama_u8_t);
+            break;
+        case MAMA_FIELD_TYPE_I16:
+        case MAMA_FIELD_TYPE_U16:
+            size = sizeof(mama_u16_t);
+            break;
+        case MAMA_FIELD_TYPE_I32:
+        case MAMA_FIELD_TYPE_U32:
+        case MAMA_FIELD_TYPE_F32:
+        case MAMA_FIELD_TYPE_QUANTITY:
+            size = sizeof(mama_u32_t);
+            break;
+        case MAMA_FIELD_TYPE_I64:
+        case MAMA_FIELD_TYPE_U64:
+        case MAMA_FIELD_TYPE_F64:
+            size = sizeof(mama_u64_t);
+            break;
+        case MAMA_FIELD_TYPE_PRICE:
+            size = sizeof(omnmPrice);
+            break;
+        case MAMA_FIELD_TYPE_TIME:
+            size = sizeof(omnmDateTime);
+            break;
+        case MAMA_FIELD_TYPE_STRING:
+        {
+            const void* end = memchr (buffer + position, '\0', bufferLength - position);
+            if (NULL == end)
+            {
+                return MAMA_STATUS_INVALID_ARG;
+            }
+            size = ((const uint8_t*) end - (buffer + position)) + 1;
+            break;
+        }
+        case MAMA_FIELD_TYPE_UNKNOWN:
+            return MAMA_STATUS_INVALID_ARG;
+        default:
+            if (!OmnmPayloadImpl::isFieldTypeSized (type) ||
+                bufferLength - position < sizeof(mama_u32_t))
+            {
+                return MAMA_STATUS_INVALID_ARG;
+            }
+            size = swapLength (buffer + position, fromHost, apply);
+            position += sizeof(mama_u32_t);
+            break;
+        }
+
+        if (size > bufferLength - position)
+        {
+            return MAMA_STATUS_INVALID_ARG;
+        }
+
+        mama_status status = swapFieldData (type,
+                                            buffer + position,
+                                            size,
+                                            byteOrder,
+                                            current,
+                                            depth,
+                                            apply);
+        VALIDATE_MAMA_STATUS_OK(status);
+        position += size;
+    }
+
+    if (NULL != flags && apply)
+    {
+        *flags = (mama_u8_t)((*flags & ~OMNM_HEADER_FLAG_BYTE_ORDER_MASK) | byteOrder);
+    }
+
+    return MAMA_STATUS_OK;
+}
+
+/*=========================================================================
+  =                   Public implementation functions                     =
+  =========================================================================*/
+
+mama_status
+omnmmsgByteOrderImpl_swapPayload (uint8_t*   buffer,
+                                  size_t     bufferLength,
+                                  mama_u8_t  byteOrder)
+{
+    if (NULL == buffer) return MAMA_STATUS_NULL_ARG;
+    if (OMNM_HEADER_FLAG_LITTLE_ENDIAN != byteOrder &&
+        OMNM_HEADER_FLAG_BIG_ENDIAN != byteOrder)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    return swapPayload (buffer, bufferLength, byteOrder, 0, 0, true);
+}
+
+mama_status
+omnmmsgByteOrderImpl_checkPayload (const uint8_t*  buffer,
+                                   size_t          bufferLength,
+                                   mama_u8_t       byteOrder)
+{
+    if (NULL == buffer) return MAMA_STATUS_NULL_ARG;
+    if (OMNM_HEADER_FLAG_LITTLE_ENDIAN != byteOrder &&
+        OMNM_HEADER_FLAG_BIG_ENDIAN != byteOrder)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    return swapPayload ((uint8_t*) buffer, bufferLength, byteOrder, 0, 0, false);
+}
@@ -0,0 +1,93 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MAMA_BRIDGE_OMNM_BYTE_ORDER_H__
+#define MAMA_BRIDGE_OMNM_BYTE_ORDER_H__
+
+#include <mama/status.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Payload.h"
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define OMNM_HOST_BYTE_ORDER_FLAG   OMNM_HEADER_FLAG_BIG_ENDIAN
+#else
+#define OMNM_HOST_BYTE_ORDER_FLAG   OMNM_HEADER_FLAG_LITTLE_ENDIAN
+#endif
+
+#if defined(_MSC_VER)
+#define OMNM_BSWAP16(X) _byteswap_ushort(X)
+#define OMNM_BSWAP32(X) _byteswap_ulong(X)
+#define OMNM_BSWAP64(X) _byteswap_uint64(X)
+#else
+#define OMNM_BSWAP16(X) __builtin_bswap16(X)
+#define OMNM_BSWAP32(X) __builtin_bswap32(X)
+#define OMNM_BSWAP64(X) __builtin_bswap64(X)
+#endif
+
+/**
+ * Returns non-zero if a payload carrying the given header flags was written
+ * by a host of the other byte order. Payloads which don't declare a byte
+ * order (older publishers) are always taken to be in host order.
+ */
+static inline int
+omnmmsgByteOrderImpl_needsSwap (mama_u8_t flags)
+{
+    mama_u8_t order = flags & OMNM_HEADER_FLAG_BYTE_ORDER_MASK;
+    return 0 != order && OMNM_HOST_BYTE_ORDER_FLAG != order;
+}
+
+/**
+ * Converts a serialized payload in place into the given byte order. This
+ * covers the fids, size prefixes, every multi-byte scalar, the price / time
+ * structures and vector elements, and recurses into nested messages. The
+ * header flags are rewritten to reflect the new byte order.
+ *
+ * @param buffer The serialized payload, including its header.
+ * @param bufferLength The number of bytes in the serialized payload.
+ * @param byteOrder OMNM_HEADER_FLAG_LITTLE_ENDIAN or OMNM_HEADER_FLAG_BIG_ENDIAN
+ *
+ * @return MAMA_STATUS_OK if the buffer is now in the requested byte order,
+ *         MAMA_STATUS_INVALID_ARG if it is malformed or doesn't declare the
+ *         byte order it is currently in.
+ */
+mama_status
+omnmmsgByteOrderImpl_swapPayload (uint8_t*   buffer,
+                                  size_t     bufferLength,
+                                  mama_u8_t  byteOrder);
+
+/**
+ * Checks that omnmmsgByteOrderImpl_swapPayload would succeed, without
+ * changing the buffer. A swap which fails partway leaves the buffer partly
+ * converted, so this comes first where the buffer has to be left as it was.
+ *
+ * @return As omnmmsgByteOrderImpl_swapPayload would.
+ */
+mama_status
+omnmmsgByteOrderImpl_checkPayload (const uint8_t*  buffer,
+                                   size_t          bufferLength,
+                                   mama_u8_t       byteOrder);
+
+#endif /* MAMA_BRIDGE_OMNM_BYTE_ORDER_H__ */
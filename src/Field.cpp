@@ -35,6 +35,9 @@
 #include <wombat/memnode.h>
 
 #include "Payload.h"
+#include "Accounting.h"
+#include "Allocator.h"
+#include "Arena.h"
 #include "mama/integration/bridge/omnmmsgpayloadfunctions.h"
 #include <wombat/strutils.h>
 
@@ -120,6 +123,102 @@ do                                                                             \
     return status;                                                             \
 } while (0)
 
+/*=========================================================================
+  =                  Private implementation functions                     =
+  =========================================================================*/
+
+// Sub-payloads are carved from the arena of the payload the field belongs to
+// and live until it is next cleared. They are views which read the parent's
+// buffer in place, so each level of nesting costs no copying, but they only
+// stay current until the parent is next modified.
+static mama_status
+omnmmsgFieldPayloadImpl_createSubPayload (omnmFieldImpl*  impl,
+                                          msgPayload*     payload,
+                                          const void*     buffer,
+                                          mama_size_t     bufferLength)
+{
+    if (0 == bufferLength) return MAMA_STATUS_INVALID_ARG;
+
+    OmnmPayloadImpl* parent = impl->mParent;
+    omnmFieldCache*  cache  = impl->mCache;
+    if (NULL == cache->mArenaRef)
+    {
+        cache->mArenaRef = omnmmsgArenaImpl_acquireRef (&parent->mArena, parent->mAllocator);
+        if (NULL == cache->mArenaRef)
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+    }
+
+    // One another cache was done with is as good as new
+    OmnmPayloadImpl* sub = omnmmsgArenaImpl_reuse (&parent->mArena);
+    if (NULL == sub)
+    {
+        // No room of their own is needed until someone modifies one
+        void* memory = omnmmsgArenaImpl_allocate (&parent->mArena,
+                                                  parent->mAllocator,
+                                                  OmnmPayloadImpl::getAllocationSize (sizeof(omnmHeader)));
+        if (NULL == memory)
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+
+        sub = OmnmPayloadImpl::construct (memory, parent->mAllocator, sizeof(omnmHeader));
+        sub->mViewMode = true;
+        omnmmsgArenaImpl_track (&parent->mArena, sub);
+    }
+
+    *payload = (msgPayload) sub;
+    return omnmmsgPayload_unSerialize (*payload, buffer, bufferLength);
+}
+
+// Hands the cache's sub-payloads back to the arena they came from, if it is
+// still around and hasn't been reset since (when they no longer exist)
+static void
+omnmmsgFieldPayloadImpl_returnSubPayloads (omnmFieldCache* cache)
+{
+    omnmArenaRef* ref   = cache->mArenaRef;
+    size_t        count = cache->mVectorPayloadLen / sizeof(msgPayload);
+    if (NULL == ref)
+    {
+        return;
+    }
+
+    omnmArena* arena = ref->mArena;
+    if (NULL != arena && arena->mEpoch == cache->mArenaEpoch)
+    {
+        if (NULL != cache->mSubPayload)
+        {
+            omnmmsgArenaImpl_recycle (ref, (OmnmPayloadImpl*) cache->mSubPayload);
+        }
+        for (size_t i = 0; i < count && NULL != cache->mVectorPayload[i]; i++)
+        {
+            omnmmsgArenaImpl_recycle (ref, (OmnmPayloadImpl*) cache->mVectorPayload[i]);
+        }
+    }
+    cache->mSubPayload = NULL;
+    if (NULL != cache->mVectorPayload)
+    {
+        memset (cache->mVectorPayload, 0, cache->mVectorPayloadLen);
+    }
+    omnmmsgArenaImpl_releaseRef (ref);
+    cache->mArenaRef = NULL;
+}
+
+// Let go of any sub-payloads the cache took from an arena other than the
+// parent's current one, as they are no use to it now
+static void
+omnmmsgFieldPayloadImpl_syncArena (omnmFieldImpl* impl, omnmFieldCache* cache)
+{
+    mama_u64_t epoch = impl->mParent->mArena.mEpoch;
+    if (cache->mArenaEpoch == epoch)
+    {
+        return;
+    }
+    omnmmsgFieldPayloadImpl_returnSubPayloads (cache);
+    cache->mArenaEpoch = epoch;
+}
+
 /*=========================================================================
   =                   Public interface functions                          =
   =========================================================================*/
@@ -127,7 +226,11 @@ do                                                                             \
 mama_status
 omnmmsgFieldPayload_create (msgFieldPayload* field)
 {
-    omnmFieldImpl* impl = (omnmFieldImpl*) calloc (1, sizeof(omnmFieldImpl));
+    const omnmAllocator* allocator = omnmmsgAllocatorImpl_getDefault ();
+    omnmFieldImpl* impl = (omnmFieldImpl*) omnmmsgAllocatorImpl_calloc (allocator,
+                                                                        sizeof(omnmFieldImpl));
+    if (NULL == impl) return MAMA_STATUS_NOMEM;
+    impl->mAllocator = allocator;
 
     *field = (msgPayload) impl;
 
@@ -138,7 +241,7 @@ mama_status
 omnmmsgFieldPayload_destroy (msgFieldPayload field)
 {
     omnmmsgFieldPayloadImpl_cleanup ((omnmFieldImpl*)field);
-    free (field);
+    omnmmsgAllocatorImpl_free (((omnmFieldImpl*)field)->mAllocator, field);
     return MAMA_STATUS_OK;
 }
 
@@ -397,7 +500,8 @@ omnmmsgFieldPayload_updateSubMsg(msgFieldPayload         field,
                                  msgPayload              msg,
                                  const msgPayload        subMsg)
 {
-    return MAMA_STATUS_NOT_IMPLEMENTED;
+    if (NULL == field || NULL == msg || NULL == subMsg) return MAMA_STATUS_NULL_ARG;
+    return ((OmnmPayloadImpl*) msg)->updateSubMsg (*((omnmFieldImpl*) field), subMsg);
 }
 
 mama_status
@@ -607,22 +711,28 @@ omnmmsgFieldPayload_getMsg (const msgFieldPayload   field,
     if (NULL == field || NULL == result) return MAMA_STATUS_NULL_ARG;
     if (NULL == impl->mData) return MAMA_STATUS_INVALID_ARG;
     if (MAMA_FIELD_TYPE_MSG != impl->mFieldType) return MAMA_STATUS_WRONG_FIELD_TYPE;
+    if (NULL == impl->mParent) return MAMA_STATUS_INVALID_ARG;
 
-    if (NULL == impl->mSubPayload)
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (impl);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
+    omnmmsgFieldPayloadImpl_syncArena (impl, cache);
+    if (NULL == cache->mSubPayload)
     {
-        status = omnmmsgPayload_createFromByteBuffer (&impl->mSubPayload,
-                                                      NULL,
-                                                      impl->mData,
-                                                      impl->mSize);
+        status = omnmmsgFieldPayloadImpl_createSubPayload (impl,
+                                                           &cache->mSubPayload,
+                                                           impl->mData,
+                                                           impl->mSize);
     }
     else
     {
-        status = omnmmsgPayload_setByteBuffer (impl->mSubPayload,
+        status = omnmmsgPayload_setByteBuffer (cache->mSubPayload,
                                                NULL,
                                                impl->mData,
                                                impl->mSize);
     }
-    *result = impl->mSubPayload;
+    cache->mArenaEpoch = impl->mParent->mArena.mEpoch;
+    *result = cache->mSubPayload;
     return status;
 }
 
@@ -735,6 +845,9 @@ omnmmsgFieldPayload_getVectorString (const msgFieldPayload   field,
     VALIDATE_NON_NULL(result);
     VALIDATE_NON_NULL(size);
 
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (impl);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
     for(i = 0; i < impl->mSize; i++)
     {
         if (((char*)impl->mData)[i] == '\0')
@@ -744,19 +857,20 @@ omnmmsgFieldPayload_getVectorString (const msgFieldPayload   field,
     *size = stringCount;
 
     // Ensure the buffer is big enough for this
-    allocateBufferMemory ((void**)&impl->mVectorString,
-                          (size_t*)&impl->mVectorStringLen,
-                          sizeof(char*) * stringCount);
+    omnmmsgFieldPayloadImpl_growCache (impl,
+                                       (void**)&cache->mVectorString,
+                                       (size_t*)&cache->mVectorStringLen,
+                                       sizeof(char*) * stringCount);
 
     /* NB - i++ will add null character on each iteration */
     for(i = 0; i < impl->mSize; i++)
     {
-        impl->mVectorString[j] = ((char*)impl->mData) + i;
-        i += strlen(impl->mVectorString[j]);
+        cache->mVectorString[j] = ((char*)impl->mData) + i;
+        i += strlen(cache->mVectorString[j]);
         j++;
     }
 
-    *result = impl->mVectorString;
+    *result = cache->mVectorString;
 
     return MAMA_STATUS_OK;
 }
@@ -778,31 +892,35 @@ omnmmsgFieldPayload_getVectorDateTime (const msgFieldPayload   field,
     VALIDATE_NON_NULL(result);
     VALIDATE_NON_NULL(size);
 
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (impl);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
     count = impl->mSize / sizeof(omnmDateTime);
 
     // Ensure the buffer is big enough for this
-    allocateBufferMemory((void**)&impl->mVectorDateTime,
-        (size_t*)&impl->mVectorDateTimeLen,
-        sizeof(char*) * count);
+    omnmmsgFieldPayloadImpl_growCache (impl,
+                                       (void**)&cache->mVectorDateTime,
+                                       (size_t*)&cache->mVectorDateTimeLen,
+                                       sizeof(char*) * count);
 
     rawDateTimes = (omnmDateTime*)impl->mData;
     /* NB - i++ will add null character on each iteration */
     for (i = 0; i < count; i++)
     {
-        if (NULL == impl->mVectorDateTime[i])
+        if (NULL == cache->mVectorDateTime[i])
         {
-            mamaDateTime_create(&impl->mVectorDateTime[i]);
+            mamaDateTime_create(&cache->mVectorDateTime[i]);
 
         }
         else
         {
-            mamaDateTime_clear(impl->mVectorDateTime[i]);
+            mamaDateTime_clear(cache->mVectorDateTime[i]);
         }
 
-        OmnmPayloadImpl::convertOmnmDateTimeToMamaDateTime(&rawDateTimes[i], impl->mVectorDateTime[i]);
+        OmnmPayloadImpl::convertOmnmDateTimeToMamaDateTime(&rawDateTimes[i], cache->mVectorDateTime[i]);
     }
 
-    *result = impl->mVectorDateTime;
+    *result = cache->mVectorDateTime;
     *size = count;
 
     return MAMA_STATUS_OK;
@@ -821,31 +939,35 @@ omnmmsgFieldPayload_getVectorPrice    (const msgFieldPayload   field,
     VALIDATE_NON_NULL(result);
     VALIDATE_NON_NULL(size);
 
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (impl);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
     count = impl->mSize / sizeof(omnmPrice);
 
     // Ensure the buffer is big enough for this
-    allocateBufferMemory((void**)&impl->mVectorPrice,
-        (size_t*)&impl->mVectorPriceLen,
-        sizeof(char*) * count);
+    omnmmsgFieldPayloadImpl_growCache (impl,
+                                       (void**)&cache->mVectorPrice,
+                                       (size_t*)&cache->mVectorPriceLen,
+                                       sizeof(char*) * count);
 
     rawPrices = (omnmPrice*)impl->mData;
     /* NB - i++ will add null character on each iteration */
     for (i = 0; i < count; i++)
     {
-        if (NULL == impl->mVectorPrice[i])
+        if (NULL == cache->mVectorPrice[i])
         {
-            mamaPrice_create(&impl->mVectorPrice[i]);
+            mamaPrice_create(&cache->mVectorPrice[i]);
 
         }
         else
         {
-            mamaPrice_clear(impl->mVectorPrice[i]);
+            mamaPrice_clear(cache->mVectorPrice[i]);
         }
 
-        OmnmPayloadImpl::convertOmnmPriceToMamaPrice(&rawPrices[i], impl->mVectorPrice[i]);
+        OmnmPayloadImpl::convertOmnmPriceToMamaPrice(&rawPrices[i], cache->mVectorPrice[i]);
     }
 
-    *result = impl->mVectorPrice;
+    *result = cache->mVectorPrice;
     *size = count;
 
     return MAMA_STATUS_OK;
@@ -864,10 +986,15 @@ omnmmsgFieldPayload_getVectorMsg      (const msgFieldPayload   field,
     VALIDATE_NON_NULL(field);
     VALIDATE_NON_NULL(result);
     VALIDATE_NON_NULL(size);
+    if (NULL == impl->mParent) return MAMA_STATUS_INVALID_ARG;
 
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (impl);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
+    omnmmsgFieldPayloadImpl_syncArena (impl, cache);
     for(i = 0; i < impl->mSize;)
     {
-        mama_size_t payloadLen = (mama_size_t) *(mama_u32_t*)impl->mData;
+        mama_size_t payloadLen = (mama_size_t) *(mama_u32_t*)((uint8_t*) impl->mData + i);
         i += payloadLen + sizeof(mama_u32_t);
         msgCount++;
     }
@@ -875,26 +1002,27 @@ omnmmsgFieldPayload_getVectorMsg      (const msgFieldPayload   field,
     *size = msgCount;
 
     // Ensure the buffer is big enough for this
-    allocateBufferMemory ((void**)&impl->mVectorPayload,
-                          (size_t*)&impl->mVectorPayloadLen,
-                          sizeof(char*) * msgCount);
+    omnmmsgFieldPayloadImpl_growCache (impl,
+                                       (void**)&cache->mVectorPayload,
+                                       (size_t*)&cache->mVectorPayloadLen,
+                                       sizeof(char*) * msgCount);
 
     /* NB - i++ will add null character on each iteration */
     for(i = 0; i < impl->mSize;)
     {
-        mama_size_t payloadLen = (mama_size_t) *(mama_u32_t*)impl->mData;
+        mama_size_t payloadLen = (mama_size_t) *(mama_u32_t*)((uint8_t*) impl->mData + i);
         uint8_t* payload = ((uint8_t*) impl->mData) + i + sizeof(mama_u32_t);
 
-        if (NULL == impl->mVectorPayload[j])
+        if (NULL == cache->mVectorPayload[j])
         {
-            status = omnmmsgPayload_createFromByteBuffer (&impl->mVectorPayload[j],
-                                                          NULL,
-                                                          payload,
-                                                          payloadLen);
+            status = omnmmsgFieldPayloadImpl_createSubPayload (impl,
+                                                               &cache->mVectorPayload[j],
+                                                               payload,
+                                                               payloadLen);
         }
         else
         {
-            status = omnmmsgPayload_setByteBuffer (impl->mVectorPayload[j],
+            status = omnmmsgPayload_setByteBuffer (cache->mVectorPayload[j],
                                                    NULL,
                                                    payload,
                                                    payloadLen);
@@ -903,8 +1031,9 @@ omnmmsgFieldPayload_getVectorMsg      (const msgFieldPayload   field,
         i += payloadLen + sizeof(mama_u32_t);
         j++;
     }
+    cache->mArenaEpoch = impl->mParent->mArena.mEpoch;
 
-    *result = impl->mVectorPayload;
+    *result = cache->mVectorPayload;
 
     return status;
 }
@@ -1147,56 +1276,113 @@ omnmmsgFieldPayload_setParent         (const msgFieldPayload   field,
     return MAMA_STATUS_NOT_IMPLEMENTED;
 }
 
+omnmFieldCache*
+omnmmsgFieldPayloadImpl_getCache (omnmFieldImpl* impl)
+{
+    if (NULL == impl->mCache)
+    {
+        impl->mCache = (omnmFieldCache*) omnmmsgAllocatorImpl_calloc (impl->mAllocator,
+                                                                      sizeof(omnmFieldCache));
+        if (NULL != impl->mCache)
+        {
+            omnmmsgAccountingImpl_add (OMNM_GAUGE_CACHE_BYTES, sizeof(omnmFieldCache));
+        }
+    }
+    return impl->mCache;
+}
+
+int
+omnmmsgFieldPayloadImpl_growCache (omnmFieldImpl*  impl,
+                                   void**          buffer,
+                                   size_t*         size,
+                                   size_t          newSize)
+{
+    size_t previous = *size;
+    if (0 != omnmmsgAllocatorImpl_allocateBufferMemory (impl->mAllocator, buffer, size, newSize))
+    {
+        return 1;
+    }
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_CACHE_BYTES, (int64_t) (*size - previous));
+    return 0;
+}
+
 void
 omnmmsgFieldPayloadImpl_cleanup (omnmFieldImpl* impl)
+{
+    omnmFieldCache* cache = impl->mCache;
+
+    if (NULL == cache)
+    {
+        return;
+    }
+
+    /* Sub-payloads belong to the parent's arena, which destroys them */
+    omnmmsgFieldPayloadImpl_returnSubPayloads (cache);
+    omnmmsgFieldPayloadImpl_trimCache (impl, 0);
+
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_CACHE_BYTES, -(int64_t) sizeof(omnmFieldCache));
+    omnmmsgAllocatorImpl_free (impl->mAllocator, cache);
+    impl->mCache = NULL;
+}
+
+void
+omnmmsgFieldPayloadImpl_trimCache (omnmFieldImpl* impl, size_t target)
 {
     mama_size_t i = 0, count = 0;
+    omnmFieldCache* cache = impl->mCache;
 
-    /* Complex data type elements below */
-    if (NULL != impl->mBuffer)
+    if (NULL == cache)
     {
-        free (impl->mBuffer);
-        impl->mBuffer = NULL;
+        return;
     }
-    if (NULL != impl->mSubPayload)
+
+    /* Complex data type elements below */
+    if (cache->mBufferLen > target)
     {
-        omnmmsgPayload_destroy (impl->mSubPayload);
-        impl->mSubPayload = NULL;
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_CACHE_BYTES, -(int64_t) cache->mBufferLen);
+        omnmmsgAllocatorImpl_free (impl->mAllocator, cache->mBuffer);
+        cache->mBuffer    = NULL;
+        cache->mBufferLen = 0;
     }
-    if (NULL != impl->mVectorString)
+    if (cache->mVectorStringLen > target)
     {
-        free (impl->mVectorString);
-        impl->mVectorString = NULL;
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_CACHE_BYTES, -(int64_t) cache->mVectorStringLen);
+        omnmmsgAllocatorImpl_free (impl->mAllocator, cache->mVectorString);
+        cache->mVectorString    = NULL;
+        cache->mVectorStringLen = 0;
     }
-    if (NULL != impl->mVectorPayload)
+    if (cache->mVectorPayloadLen > target)
     {
-        count = impl->mVectorPayloadLen / sizeof(msgPayload);
-        for (i = 0; i < count; i++)
-        {
-            omnmmsgPayload_destroy (impl->mVectorPayload[i]);
-        }
-        free (impl->mVectorPayload);
-        impl->mVectorPayload = NULL;
+        /* The elements go back to the arena, only the array is freed */
+        omnmmsgFieldPayloadImpl_returnSubPayloads (cache);
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_CACHE_BYTES, -(int64_t) cache->mVectorPayloadLen);
+        omnmmsgAllocatorImpl_free (impl->mAllocator, cache->mVectorPayload);
+        cache->mVectorPayload    = NULL;
+        cache->mVectorPayloadLen = 0;
     }
-    if (NULL != impl->mVectorDateTime)
+    if (cache->mVectorDateTimeLen > target)
     {
-        count = impl->mVectorDateTimeLen / sizeof(mamaDateTime);
+        count = cache->mVectorDateTimeLen / sizeof(mamaDateTime);
         for (i = 0; i < count; i++)
         {
-            mamaDateTime_destroy (impl->mVectorDateTime[i]);
+            mamaDateTime_destroy (cache->mVectorDateTime[i]);
         }
-        free (impl->mVectorDateTime);
-        impl->mVectorDateTime = NULL;
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_CACHE_BYTES, -(int64_t) cache->mVectorDateTimeLen);
+        omnmmsgAllocatorImpl_free (impl->mAllocator, cache->mVectorDateTime);
+        cache->mVectorDateTime    = NULL;
+        cache->mVectorDateTimeLen = 0;
     }
-    if (NULL != impl->mVectorPrice)
+    if (cache->mVectorPriceLen > target)
     {
-        count = impl->mVectorPriceLen / sizeof(mamaPrice);
+        count = cache->mVectorPriceLen / sizeof(mamaPrice);
         for (i = 0; i < count; i++)
         {
-            mamaPrice_destroy (impl->mVectorPrice[i]);
+            mamaPrice_destroy (cache->mVectorPrice[i]);
         }
-        free (impl->mVectorPrice);
-        impl->mVectorPrice = NULL;
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_CACHE_BYTES, -(int64_t) cache->mVectorPriceLen);
+        omnmmsgAllocatorImpl_free (impl->mAllocator, cache->mVectorPrice);
+        cache->mVectorPrice    = NULL;
+        cache->mVectorPriceLen = 0;
     }
 }
 
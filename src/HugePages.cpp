@@ -0,0 +1,408 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*=========================================================================
+  =                             Includes                                  =
+  =========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include <mama/mama.h>
+
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+#include "HugePages.h"
+#include "Numa.h"
+
+/*=========================================================================
+  =                Typedefs, structs, enums and globals                   =
+  =========================================================================*/
+
+// Smallest and largest blocks carved from a region, as powers of two
+#define OMNM_HUGE_PAGE_MIN_SHIFT        6
+#define OMNM_HUGE_PAGE_MAX_SHIFT        20
+
+// Each block starts with a header recording where it came from, which also
+// keeps the memory handed out 16 byte aligned
+#define OMNM_HUGE_PAGE_HEADER_SIZE      16
+
+// Header value for blocks which came from the heap instead of a region
+#define OMNM_HUGE_PAGE_OVERSIZE         0xFFFFFFFF
+
+typedef struct omnmHugePageHeader
+{
+    mama_u32_t  mShift;     /* Block is 1 << mShift bytes, header included */
+    mama_u32_t  mNode;      /* Heap the block goes back to */
+} omnmHugePageHeader;
+
+// Blocks of one size which have been freed
+typedef struct omnmHugePageClass
+{
+    std::mutex  mLock;
+    void*       mFree;      /* Each free block points to the next */
+} omnmHugePageClass;
+
+// Regions and free blocks belonging to one NUMA node
+typedef struct omnmHugePageHeap
+{
+    omnmHugePageClass   mClasses[OMNM_HUGE_PAGE_MAX_SHIFT + 1];
+
+    // What is left of the region blocks are currently carved from
+    std::mutex          mRegionLock;
+    uint8_t*            mRegionCursor;
+    size_t              mRegionRemaining;
+} omnmHugePageHeap;
+
+static omnmHugePageHeap     gHeaps[OMNM_NUMA_MAX_NODES];
+
+// Closures of the allocators which place memory on a given node
+static int                  gNodes[OMNM_NUMA_MAX_NODES];
+static omnmAllocator        gNodeAllocators[OMNM_NUMA_MAX_NODES];
+static std::once_flag       gNodeAllocatorsOnce;
+
+static std::atomic<mama_u64_t> gHugeTlbRegions (0);
+static std::atomic<mama_u64_t> gTransparentRegions (0);
+static std::atomic<mama_u64_t> gRegularRegions (0);
+static std::atomic<mama_u64_t> gOversizeAllocations (0);
+static std::atomic<mama_u64_t> gRemoteFrees (0);
+
+/*=========================================================================
+  =                  Private implementation functions                     =
+  =========================================================================*/
+
+static inline void
+increment (std::atomic<mama_u64_t>& counter)
+{
+    counter.fetch_add (1, std::memory_order_relaxed);
+}
+
+static inline omnmHugePageHeader*
+headerOf (void* memory)
+{
+    return (omnmHugePageHeader*) ((uint8_t*) memory - OMNM_HUGE_PAGE_HEADER_SIZE);
+}
+
+// Smallest block which holds this many bytes plus its header, or
+// OMNM_HUGE_PAGE_OVERSIZE if none does
+static mama_u32_t
+shiftFor (size_t size)
+{
+    size_t     required = size + OMNM_HUGE_PAGE_HEADER_SIZE;
+    mama_u32_t shift    = OMNM_HUGE_PAGE_MIN_SHIFT;
+    while (((size_t) 1 << shift) < required)
+    {
+        if (++shift > OMNM_HUGE_PAGE_MAX_SHIFT)
+        {
+            return OMNM_HUGE_PAGE_OVERSIZE;
+        }
+    }
+    return shift;
+}
+
+static uint8_t*
+mapRegion (int node)
+{
+#if defined(__linux__)
+#if defined(MAP_HUGETLB)
+    void* region = mmap (NULL, OMNM_HUGE_PAGE_REGION_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (MAP_FAILED != region)
+    {
+        omnmmsgNumaImpl_bind (region, OMNM_HUGE_PAGE_REGION_SIZE, node);
+        increment (gHugeTlbRegions);
+        return (uint8_t*) region;
+    }
+#endif
+
+    // No huge pages reserved, so map twice the size and keep just the
+    // aligned middle, which transparent huge pages can then back
+    uint8_t* raw = (uint8_t*) mmap (NULL, 2 * OMNM_HUGE_PAGE_REGION_SIZE,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == (void*) raw)
+    {
+        return NULL;
+    }
+    uint8_t* aligned = (uint8_t*) (((uintptr_t) raw + OMNM_HUGE_PAGE_REGION_SIZE - 1)
+                                   & ~(uintptr_t) (OMNM_HUGE_PAGE_REGION_SIZE - 1));
+    if (aligned > raw)
+    {
+        munmap (raw, aligned - raw);
+    }
+    munmap (aligned + OMNM_HUGE_PAGE_REGION_SIZE,
+            raw + OMNM_HUGE_PAGE_REGION_SIZE - aligned);
+    omnmmsgNumaImpl_bind (aligned, OMNM_HUGE_PAGE_REGION_SIZE, node);
+
+#if defined(MADV_HUGEPAGE)
+    if (0 == madvise (aligned, OMNM_HUGE_PAGE_REGION_SIZE, MADV_HUGEPAGE))
+    {
+        increment (gTransparentRegions);
+        return aligned;
+    }
+#endif
+    increment (gRegularRegions);
+    return aligned;
+#else
+    uint8_t* region = (uint8_t*) malloc (OMNM_HUGE_PAGE_REGION_SIZE);
+    if (NULL != region)
+    {
+        increment (gRegularRegions);
+    }
+    return region;
+#endif
+}
+
+static void
+pushFree (omnmHugePageHeap* heap, mama_u32_t shift, void* block)
+{
+    std::lock_guard<std::mutex> lock (heap->mClasses[shift].mLock);
+    *(void**) block = heap->mClasses[shift].mFree;
+    heap->mClasses[shift].mFree = block;
+}
+
+static void*
+popFree (omnmHugePageHeap* heap, mama_u32_t shift)
+{
+    std::lock_guard<std::mutex> lock (heap->mClasses[shift].mLock);
+    void* block = heap->mClasses[shift].mFree;
+    if (NULL != block)
+    {
+        heap->mClasses[shift].mFree = *(void**) block;
+    }
+    return block;
+}
+
+static void*
+carve (int node, mama_u32_t shift)
+{
+    omnmHugePageHeap* heap      = &gHeaps[node];
+    size_t            blockSize = (size_t) 1 << shift;
+
+    std::lock_guard<std::mutex> lock (heap->mRegionLock);
+    if (heap->mRegionRemaining < blockSize)
+    {
+        uint8_t* region = mapRegion (node);
+        if (NULL == region)
+        {
+            return NULL;
+        }
+
+        // Whatever is left of the old region goes to the free lists rather
+        // than to waste
+        for (mama_u32_t s = OMNM_HUGE_PAGE_MAX_SHIFT; s >= OMNM_HUGE_PAGE_MIN_SHIFT; s--)
+        {
+            while (heap->mRegionRemaining >= ((size_t) 1 << s))
+            {
+                pushFree (heap, s, heap->mRegionCursor);
+                heap->mRegionCursor    += (size_t) 1 << s;
+                heap->mRegionRemaining -= (size_t) 1 << s;
+            }
+        }
+
+        heap->mRegionCursor    = region;
+        heap->mRegionRemaining = OMNM_HUGE_PAGE_REGION_SIZE;
+    }
+
+    void* block = heap->mRegionCursor;
+    heap->mRegionCursor    += blockSize;
+    heap->mRegionRemaining -= blockSize;
+    return block;
+}
+
+// A closure names the node to allocate on, otherwise it is the caller's
+static inline int
+nodeFor (void* closure)
+{
+    return NULL == closure ? omnmmsgNumaImpl_getCurrentNode () : *(int*) closure;
+}
+
+static void*
+hugePageMalloc (mama_size_t size, void* closure)
+{
+    int        node  = nodeFor (closure);
+    mama_u32_t shift = shiftFor (size);
+    void*      block = NULL;
+
+    if (OMNM_HUGE_PAGE_OVERSIZE != shift)
+    {
+        block = popFree (&gHeaps[node], shift);
+        if (NULL == block)
+        {
+            block = carve (node, shift);
+        }
+    }
+    if (NULL == block)
+    {
+        block = malloc (size + OMNM_HUGE_PAGE_HEADER_SIZE);
+        if (NULL == block)
+        {
+            return NULL;
+        }
+        shift = OMNM_HUGE_PAGE_OVERSIZE;
+        increment (gOversizeAllocations);
+    }
+
+    ((omnmHugePageHeader*) block)->mShift = shift;
+    ((omnmHugePageHeader*) block)->mNode  = (mama_u32_t) node;
+    return (uint8_t*) block + OMNM_HUGE_PAGE_HEADER_SIZE;
+}
+
+static void
+hugePageFree (void* memory, void* closure)
+{
+    if (NULL == memory)
+    {
+        return;
+    }
+    omnmHugePageHeader* header = headerOf (memory);
+    if (OMNM_HUGE_PAGE_OVERSIZE == header->mShift)
+    {
+        free (header);
+    }
+    else
+    {
+        // Blocks always go back to their own node's heap, but a payload
+        // consumed away from where it was built is worth knowing about
+        if ((int) header->mNode != omnmmsgNumaImpl_getCurrentNode ())
+        {
+            increment (gRemoteFrees);
+        }
+        pushFree (&gHeaps[header->mNode], header->mShift, header);
+    }
+}
+
+static void*
+hugePageRealloc (void* memory, mama_size_t size, void* closure)
+{
+    if (NULL == memory)
+    {
+        return hugePageMalloc (size, closure);
+    }
+
+    omnmHugePageHeader* header = headerOf (memory);
+    mama_u32_t          shift  = shiftFor (size);
+    if (shift == header->mShift && OMNM_HUGE_PAGE_OVERSIZE != shift)
+    {
+        return memory;
+    }
+    if (OMNM_HUGE_PAGE_OVERSIZE == shift && OMNM_HUGE_PAGE_OVERSIZE == header->mShift)
+    {
+        void* grown = realloc (header, size + OMNM_HUGE_PAGE_HEADER_SIZE);
+        return NULL == grown ? NULL : (uint8_t*) grown + OMNM_HUGE_PAGE_HEADER_SIZE;
+    }
+
+    // Moving between sizes (or between a region and the heap) means a copy
+    void* moved = hugePageMalloc (size, closure);
+    if (NULL == moved)
+    {
+        return NULL;
+    }
+    size_t capacity = OMNM_HUGE_PAGE_OVERSIZE == header->mShift
+                    ? size
+                    : ((size_t) 1 << header->mShift) - OMNM_HUGE_PAGE_HEADER_SIZE;
+    memcpy (moved, memory, capacity < size ? capacity : size);
+    hugePageFree (memory, closure);
+    return moved;
+}
+
+static const omnmAllocator gHugePageAllocator = { hugePageMalloc,
+                                                  hugePageRealloc,
+                                                  hugePageFree,
+                                                  NULL };
+
+static void
+initNodeAllocators ()
+{
+    for (int node = 0; node < OMNM_NUMA_MAX_NODES; node++)
+    {
+        gNodes[node]          = node;
+        gNodeAllocators[node] = gHugePageAllocator;
+        gNodeAllocators[node].mClosure = &gNodes[node];
+    }
+}
+
+/*=========================================================================
+  =                   Public implementation functions                     =
+  =========================================================================*/
+
+const omnmAllocator*
+omnmmsgHugePageImpl_getAllocator ()
+{
+    return &gHugePageAllocator;
+}
+
+mama_status
+omnmmsgPayloadImpl_getHugePageAllocator (const omnmAllocator** allocator)
+{
+    if (NULL == allocator) return MAMA_STATUS_NULL_ARG;
+    *allocator = &gHugePageAllocator;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_getHugePageStats (omnmHugePageStats* stats)
+{
+    if (NULL == stats) return MAMA_STATUS_NULL_ARG;
+    stats->mHugeTlbRegions      = gHugeTlbRegions.load (std::memory_order_relaxed);
+    stats->mTransparentRegions  = gTransparentRegions.load (std::memory_order_relaxed);
+    stats->mRegularRegions      = gRegularRegions.load (std::memory_order_relaxed);
+    stats->mOversizeAllocations = gOversizeAllocations.load (std::memory_order_relaxed);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_getNodeAllocator (int node, const omnmAllocator** allocator)
+{
+    if (NULL == allocator) return MAMA_STATUS_NULL_ARG;
+    if (OMNM_NUMA_LOCAL_NODE == node)
+    {
+        *allocator = &gHugePageAllocator;
+        return MAMA_STATUS_OK;
+    }
+    if (node < 0 || node >= omnmmsgNumaImpl_getNodeCount ())
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    std::call_once (gNodeAllocatorsOnce, initNodeAllocators);
+    *allocator = &gNodeAllocators[node];
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_getNumaStats (omnmNumaStats* stats)
+{
+    if (NULL == stats) return MAMA_STATUS_NULL_ARG;
+    stats->mNodes       = (mama_u32_t) omnmmsgNumaImpl_getNodeCount ();
+    stats->mLocalNode   = (mama_u32_t) omnmmsgNumaImpl_getCurrentNode ();
+    stats->mRemoteFrees = gRemoteFrees.load (std::memory_order_relaxed);
+    return MAMA_STATUS_OK;
+}
@@ -0,0 +1,53 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MAMA_BRIDGE_OMNM_HUGE_PAGES_H__
+#define MAMA_BRIDGE_OMNM_HUGE_PAGES_H__
+
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+
+// Bridge property which makes the huge page allocator the default
+#define OMNM_HUGE_PAGES_PROPERTY        "mama.omnmmsg.hugepages"
+
+// Size of the regions blocks are carved from
+#define OMNM_HUGE_PAGE_REGION_SIZE      (2 * 1024 * 1024)
+
+/*
+ * Allocator which carves blocks of power of two sizes (64 bytes up to 1MB)
+ * out of 2MB regions, each backed by a huge page where the platform allows:
+ *
+ *   1. MAP_HUGETLB, if the administrator has reserved huge pages
+ *   2. Transparent huge pages, via madvise(MADV_HUGEPAGE)
+ *   3. Regular pages otherwise
+ *
+ * Each NUMA node has its own regions and free lists. Blocks are carved from
+ * the calling thread's node unless the allocator names one, and always go
+ * back to the node they came from. Freed blocks are kept on a free list per
+ * size and regions are never handed back, in the same way the payload pools
+ * keep their payloads. Anything too large for a region comes from the heap.
+ */
+const omnmAllocator*
+omnmmsgHugePageImpl_getAllocator ();
+
+#endif /* MAMA_BRIDGE_OMNM_HUGE_PAGES_H__ */
@@ -35,6 +35,7 @@
 #include "mama/integration/bridge/omnmmsgpayloadfunctions.h"
 #include "Payload.h"
 #include "Iterator.h"
+#include "Allocator.h"
 
 /*=========================================================================
   =                Typedefs, structs, enums and globals                   =
@@ -57,11 +58,13 @@ omnmmsgPayloadIter_create (msgPayloadIter* iter,
         return MAMA_STATUS_NULL_ARG;
     }
 
-    impl = (omnmIterImpl*) calloc (1, sizeof (omnmIterImpl));
+    impl = (omnmIterImpl*) omnmmsgAllocatorImpl_calloc (msgImpl->mAllocator,
+                                                        sizeof (omnmIterImpl));
     if (NULL == impl) return MAMA_STATUS_NOMEM;
 
-    impl->mField.mParent  = msgImpl;
-    impl->mMsg            = msgImpl;
+    impl->mField.mParent    = msgImpl;
+    impl->mField.mAllocator = msgImpl->mAllocator;
+    impl->mMsg              = msgImpl;
 
     /* Start iterating just after the message type byte */
     omnmmsgPayloadIter_begin (impl, NULL, msgImpl);
@@ -76,7 +79,8 @@ omnmmsgPayloadIter_next (msgPayloadIter          iter,
                          msgFieldPayload         field,
                          msgPayload              msg)
 {
-    omnmIterImpl*   impl    = (omnmIterImpl*) iter;
+    omnmIterImpl*   impl        = (omnmIterImpl*) iter;
+    bool            byReference = false;
 
     if (NULL == iter || NULL == msg)
         return NULL;
@@ -176,6 +180,16 @@ omnmmsgPayloadIter_next (msgPayloadIter          iter,
         impl->mBufferPosition += sizeof(mama_u32_t);
         /* Note the data starts *after* the size field */
         impl->mField.mData = (void*)impl->mBufferPosition;
+        /* Unless the body was added by reference and isn't in the buffer */
+        if (impl->mMsg->hasRefs()
+            && impl->mRef < impl->mMsg->mModes->mRefCount
+            && impl->mMsg->mModes->mRefs[impl->mRef].mOffset
+               == (size_t) (impl->mBufferPosition - impl->mMsg->mPayloadBuffer))
+        {
+            impl->mField.mData = (void*) impl->mMsg->mModes->mRefs[impl->mRef].mData;
+            impl->mRef++;
+            byReference = true;
+        }
         break;
     case MAMA_FIELD_TYPE_UNKNOWN:
         break;
@@ -185,8 +199,9 @@ omnmmsgPayloadIter_next (msgPayloadIter          iter,
     {
         /* Start iterating just after the message type byte */
         impl->mBufferPosition = impl->mMsg->mPayloadBuffer + impl->mMsg->getHeaderSize();
+        impl->mRef            = 0;
     }
-    else
+    else if (!byReference)
     {
         impl->mBufferPosition += impl->mField.mSize;
     }
@@ -225,6 +240,7 @@ omnmmsgPayloadIter_begin (msgPayloadIter          iter,
 
     impl->mMsg         = (OmnmPayloadImpl*)msg;
     impl->mIndex       = 0;
+    impl->mRef         = 0;
 
     /* Start iterating just after the message type byte */
     impl->mBufferPosition = impl->mMsg->mPayloadBuffer + impl->mMsg->getHeaderSize();
@@ -259,7 +275,8 @@ mama_status
 omnmmsgPayloadIter_destroy (msgPayloadIter iter)
 {
     if (NULL == iter) return MAMA_STATUS_NULL_ARG;
-    free (iter);
+    omnmmsgFieldPayloadImpl_cleanup (&((omnmIterImpl*) iter)->mField);
+    omnmmsgAllocatorImpl_free (((omnmIterImpl*) iter)->mField.mAllocator, iter);
     return MAMA_STATUS_OK;
 }
 
@@ -272,12 +289,17 @@ omnmmsgPayloadIterImpl_init (omnmIterImpl*      iter,
         return MAMA_STATUS_NULL_ARG;
     }
 
-    // Ensure buffer provided is NULL initialized
-    memset ((void*)iter, 0, sizeof(omnmIterImpl));
-
-    // Initialize members
-    iter->mField.mParent  = msg;
-    iter->mMsg            = msg;
+    // Initialize the hot members only - the field cache is left unallocated
+    // until a complex getter asks for it, so there is nothing else to clear
+    iter->mField.mFieldType = MAMA_FIELD_TYPE_UNKNOWN;
+    iter->mField.mFid       = 0;
+    iter->mField.mName      = NULL;
+    iter->mField.mSize      = 0;
+    iter->mField.mData      = NULL;
+    iter->mField.mParent    = msg;
+    iter->mField.mCache     = NULL;
+    iter->mField.mAllocator = msg->mAllocator;
+    iter->mMsg              = msg;
 
     // Reset iterator position
     omnmmsgPayloadIter_begin (iter, NULL, msg);
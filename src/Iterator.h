@@ -40,6 +40,7 @@ typedef struct omnmIterImpl
     omnmFieldImpl       mField; /* Reusable inline field impl*/
     uint8_t*            mBufferPosition;
     int                 mIndex;
+    mama_u32_t          mRef;   /* Next field body held by reference */
 } omnmIterImpl;
 
 /**
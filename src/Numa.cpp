@@ -0,0 +1,104 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*=========================================================================
+  =                             Includes                                  =
+  =========================================================================*/
+
+#include <stdlib.h>
+
+#if defined(OMNM_WITH_NUMA)
+#include <sched.h>
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+#include "Numa.h"
+
+/*=========================================================================
+  =                Typedefs, structs, enums and globals                   =
+  =========================================================================*/
+
+static thread_local int tCurrentNode = -1;
+
+/*=========================================================================
+  =                   Public implementation functions                     =
+  =========================================================================*/
+
+int
+omnmmsgNumaImpl_getNodeCount ()
+{
+#if defined(OMNM_WITH_NUMA)
+    static const int nodes = numa_available () < 0 ? 1 : numa_max_node () + 1;
+    return nodes > OMNM_NUMA_MAX_NODES ? OMNM_NUMA_MAX_NODES : nodes;
+#else
+    return 1;
+#endif
+}
+
+int
+omnmmsgNumaImpl_getCurrentNode ()
+{
+    if (tCurrentNode < 0)
+    {
+        int node = 0;
+#if defined(OMNM_WITH_NUMA)
+        int cpu = sched_getcpu ();
+        if (cpu >= 0 && omnmmsgNumaImpl_getNodeCount () > 1)
+        {
+            node = numa_node_of_cpu (cpu);
+        }
+#endif
+        tCurrentNode = (node < 0 || node >= omnmmsgNumaImpl_getNodeCount ()) ? 0 : node;
+    }
+    return tCurrentNode;
+}
+
+void
+omnmmsgNumaImpl_bind (void* memory, size_t length, int node)
+{
+#if defined(OMNM_WITH_NUMA)
+    if (omnmmsgNumaImpl_getNodeCount () > 1)
+    {
+        unsigned long mask[OMNM_NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        mbind (memory, length, MPOL_PREFERRED, mask, OMNM_NUMA_MAX_NODES + 1, 0);
+    }
+#endif
+}
+
+int
+omnmmsgNumaImpl_getNodeOfAddress (const void* memory)
+{
+#if defined(OMNM_WITH_NUMA)
+    int node = -1;
+    if (0 != get_mempolicy (&node, NULL, 0, (void*) memory, MPOL_F_NODE | MPOL_F_ADDR))
+    {
+        return -1;
+    }
+    return node;
+#else
+    return 0;
+#endif
+}
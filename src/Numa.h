@@ -0,0 +1,72 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MAMA_BRIDGE_OMNM_NUMA_H__
+#define MAMA_BRIDGE_OMNM_NUMA_H__
+
+#include <stddef.h>
+
+// Most NUMA nodes the region allocator keeps separate heaps for
+#define OMNM_NUMA_MAX_NODES             64
+
+// Bridge property which turns node local placement on or off. It defaults to
+// on where the bridge was built WITH_NUMA and the host has several nodes.
+#define OMNM_NUMA_PROPERTY              "mama.omnmmsg.numa"
+
+/*
+ * Thin wrappers over libnuma. Unless the bridge is built with OMNM_WITH_NUMA
+ * (the WITH_NUMA CMake option), the host is treated as a single node 0 and
+ * binding does nothing.
+ */
+
+/**
+ * @return The number of nodes memory may be placed on, at least 1 and at
+ *         most OMNM_NUMA_MAX_NODES.
+ */
+int
+omnmmsgNumaImpl_getNodeCount ();
+
+/**
+ * @return The node the calling thread was running on when it first asked.
+ *         It is cached per thread, so threads are expected to be pinned.
+ */
+int
+omnmmsgNumaImpl_getCurrentNode ();
+
+/**
+ * Asks for pages of a newly mapped region to be placed on the given node,
+ * falling back to other nodes if it runs out. Must be called before the
+ * pages are first touched.
+ */
+void
+omnmmsgNumaImpl_bind (void* memory, size_t length, int node);
+
+/**
+ * @return The node the page holding this address is on, or -1 if it can't be
+ *         told.
+ */
+int
+omnmmsgNumaImpl_getNodeOfAddress (const void* memory);
+
+#endif /* MAMA_BRIDGE_OMNM_NUMA_H__ */
@@ -31,6 +31,13 @@
 #include <string.h>
 #include <stdint.h>
 
+#include <new>
+#include <atomic>
+
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#endif
+
 #include <mama/mama.h>
 #include <mama/price.h>
 
@@ -38,6 +45,7 @@
 #include "mama/integration/bridge/omnmmsgpayloadimpl.h"
 #include <wombat/strutils.h>
 #include <wombat/memnode.h>
+#include <wombat/property.h>
 #include <stddef.h>
 #include <mama/integration/types.h>
 #include <mama/integration/mama.h>
@@ -45,6 +53,14 @@
 #include <mama/integration/msgfield.h>
 #include "Payload.h"
 #include "Iterator.h"
+#include "ByteOrder.h"
+#include "Allocator.h"
+#include "Shape.h"
+#include "Arena.h"
+#include "Pool.h"
+#include "Accounting.h"
+#include "HugePages.h"
+#include "Numa.h"
 
 /*=========================================================================
   =                              Macros                                   =
@@ -52,10 +68,11 @@
 #define        FIELD_TYPE_WIDTH        1
 #define        FID_WIDTH               2
 #define        LENGTH_WIDTH            4
-#define        DEFAULT_PAYLOAD_SIZE    200
-#define        MAMA_PAYLOAD_ID_OMNM    'O'
 #define        OMNM_PROTOCOL_VERSION   1
 
+// Factor by which the buffer grows when it runs out of space
+#define        OMNM_BUFFER_GROWTH_FACTOR    2
+
 
 #define ADD_SCALAR_FIELD(MSG,NAME,FID,VALUE,TYPE)                              \
 do                                                                             \
@@ -155,20 +172,61 @@ do                                                                             \
     omnmmsgPayload_updateVector##SUFFIX   (dest, name, fid, result, size);     \
 } while (0)
 
+/*=========================================================================
+  =                Typedefs, structs, enums and globals                   =
+  =========================================================================*/
+
+// Global trim policy - see omnmPayloadTrimPolicy
+static std::atomic<size_t>      gTrimTargetCapacity (0);
+static std::atomic<mama_u32_t>  gTrimSmallUses (0);
+
 /*=========================================================================
   =                  Private implementation prototypes                    =
   =========================================================================*/
 
-OmnmPayloadImpl::OmnmPayloadImpl() : mPayloadBuffer(nullptr),
+OmnmPayloadImpl::OmnmPayloadImpl(const omnmAllocator* allocator,
+                                 uint8_t*             inlineBuffer,
+                                 size_t               inlineCapacity) :
+                                     mPayloadBuffer(nullptr),
                                      mPayloadBufferSize(0),
                                      mPayloadBufferTail(0),
-                                     mField(), /* Inline struct member */
                                      mHeader(),
+                                     mFrozen(false),
+                                     mViewMode(false),
+                                     mExternal(false),
+                                     mAllocator(omnmmsgAllocatorImpl_resolve(allocator)),
                                      mParent(nullptr),
-                                     mExtenderClosure(nullptr)
-{
-    mPayloadBufferSize           = DEFAULT_PAYLOAD_SIZE;
-    mPayloadBuffer               = (uint8_t*) calloc (mPayloadBufferSize, 1);
+                                     mExtenderClosure(nullptr),
+                                     mModes(NULL),
+                                     mField(), /* Inline struct member */
+                                     mPoolNext(nullptr),
+                                     mPoolOwner(nullptr),
+                                     mShapeKey(0),
+                                     mOwnedBuffer(NULL),
+                                     mOwnedBufferSize(0),
+                                     mShared(NULL),
+                                     mInlineBuffer(inlineBuffer),
+                                     mInlineCapacity(inlineCapacity),
+                                     mSmallUses(0),
+                                     mLockedPages(false),
+                                     mLockedBuffer(false)
+{
+    static_assert (OMNM_INLINE_BUFFER_SIZE >= sizeof(omnmHeader),
+                   "OMNM_INLINE_BUFFER_SIZE must at least hold the header");
+    static_assert (offsetof(OmnmPayloadImpl, mField) <= 64,
+                   "Hot payload members must fit in the first cache line");
+
+    // Field caches come from the same place as the payload
+    mField.mAllocator            = mAllocator;
+
+    mArena.mBlocks               = NULL;
+    mArena.mPayloads             = NULL;
+    mArena.mEpoch                = 0;
+    mArena.mRef                  = NULL;
+
+    // Start out in the inline buffer - no allocation required
+    mPayloadBufferSize           = mInlineCapacity;
+    mPayloadBuffer               = mInlineBuffer;
 
     // Initialize with defaults
     clear();
@@ -176,11 +234,130 @@ OmnmPayloadImpl::OmnmPayloadImpl() : mPayloadBuffer(nullptr),
 
 OmnmPayloadImpl::~OmnmPayloadImpl()
 {
-    if (NULL != mPayloadBuffer)
+    returnBorrowed();
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_USED, -(int64_t) mPayloadBufferTail);
+    if (NULL != mPayloadBuffer && !isBufferInline())
+    {
+        unlockBuffer();
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, -(int64_t) mPayloadBufferSize);
+        omnmmsgAllocatorImpl_free (mAllocator, mPayloadBuffer);
+    }
+    if (NULL != mModes)
+    {
+        if (NULL != mModes->mRefs)
+        {
+            omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED,
+                                       -(int64_t) (mModes->mRefCapacity * sizeof(omnmFieldRef)));
+            omnmmsgAllocatorImpl_free (mAllocator, mModes->mRefs);
+        }
+        if (NULL != mModes->mBuilder)
+        {
+            deallocate (mModes->mBuilder);
+        }
+        if (NULL != mModes->mParked)
+        {
+            omnmmsgAllocatorImpl_free (mAllocator, mModes->mParked);
+        }
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, -(int64_t) sizeof(omnmPayloadModes));
+        omnmmsgAllocatorImpl_free (mAllocator, mModes);
+    }
+    if (mLockedPages && NULL != mField.mCache)
     {
-        free (mPayloadBuffer);
+        omnmmsgPayloadPoolImpl_unlock (mField.mCache, sizeof(omnmFieldCache));
     }
     omnmmsgFieldPayloadImpl_cleanup(&mField);
+    omnmmsgArenaImpl_release (&mArena, mAllocator);
+}
+
+OmnmPayloadImpl*
+OmnmPayloadImpl::allocate (const omnmAllocator* allocator)
+{
+    size_t size   = getAllocationSize (OMNM_INLINE_BUFFER_SIZE);
+    void*  memory = omnmmsgAllocatorImpl_malloc (allocator, size);
+    if (NULL == memory)
+    {
+        return NULL;
+    }
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_PAYLOADS, 1);
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, size);
+    return construct (memory, allocator, OMNM_INLINE_BUFFER_SIZE);
+}
+
+void
+OmnmPayloadImpl::deallocate (OmnmPayloadImpl* impl)
+{
+    const omnmAllocator* allocator = impl->mAllocator;
+    size_t               size      = getAllocationSize (impl->mInlineCapacity);
+    bool                 locked    = impl->mLockedPages;
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_PAYLOADS, -1);
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, -(int64_t) size);
+    impl->~OmnmPayloadImpl();
+    if (locked)
+    {
+        omnmmsgPayloadPoolImpl_unlock (impl, size);
+    }
+    omnmmsgAllocatorImpl_free (allocator, impl);
+}
+
+size_t
+OmnmPayloadImpl::getAllocationSize (size_t inlineCapacity)
+{
+    // The constructor writes a default header into the inline buffer
+    if (inlineCapacity < sizeof(omnmHeader))
+    {
+        inlineCapacity = sizeof(omnmHeader);
+    }
+    return sizeof(OmnmPayloadImpl) + inlineCapacity;
+}
+
+OmnmPayloadImpl*
+OmnmPayloadImpl::construct (void* memory, const omnmAllocator* allocator,
+                            size_t inlineCapacity)
+{
+    if (inlineCapacity < sizeof(omnmHeader))
+    {
+        inlineCapacity = sizeof(omnmHeader);
+    }
+    return new (memory) OmnmPayloadImpl (allocator,
+                                         (uint8_t*) memory + sizeof(OmnmPayloadImpl),
+                                         inlineCapacity);
+}
+
+omnmPayloadModes*
+OmnmPayloadImpl::getModes ()
+{
+    if (NULL == mModes)
+    {
+        mModes = (omnmPayloadModes*) omnmmsgAllocatorImpl_calloc (mAllocator,
+                                                                  sizeof(omnmPayloadModes));
+        if (NULL != mModes)
+        {
+            omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, sizeof(omnmPayloadModes));
+        }
+    }
+    return mModes;
+}
+
+OmnmPayloadImpl*
+OmnmPayloadImpl::allocateFrozen (const omnmAllocator* allocator,
+                                 const uint8_t*       buffer,
+                                 size_t               bufferLength)
+{
+    void* memory = omnmmsgAllocatorImpl_malloc (allocator, getAllocationSize (bufferLength));
+    if (NULL == memory)
+    {
+        return NULL;
+    }
+
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_PAYLOADS, 1);
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, getAllocationSize (bufferLength));
+
+    OmnmPayloadImpl* impl = construct (memory, allocator, bufferLength);
+    memcpy (impl->mInlineBuffer, buffer, bufferLength);
+    impl->mPayloadBufferSize = bufferLength;
+    impl->setTail (bufferLength);
+    impl->mFrozen            = true;
+    return impl;
 }
 
 bool
@@ -286,90 +463,903 @@ OmnmPayloadImpl::areFieldTypesCastable (mamaFieldType from, mamaFieldType to)
 {
     if (OmnmPayloadImpl::isFieldTypeFixedWidth (from) && OmnmPayloadImpl::isFieldTypeFixedWidth (to))
     {
-        return true;
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+void
+OmnmPayloadImpl::convertOmnmDateTimeToMamaDateTime (omnmDateTime* from, mamaDateTime to)
+{
+    mamaDateTime_setWithHints(to,
+                              (mama_u32_t)from->mSeconds,
+                              from->mNanoseconds / 1000,
+                              (mamaDateTimePrecision)from->mPrecision,
+                              (mamaDateTimeHints)from->mHints);
+}
+
+void
+OmnmPayloadImpl::convertMamaDateTimeToOmnmDateTime (mamaDateTime from, omnmDateTime* to)
+{
+    mamaDateTimeHints hints;
+    mamaDateTimePrecision precision;
+    mama_u32_t seconds = 0, microseconds = 0;
+
+    memset(to, 0, sizeof(omnmDateTime));
+
+    mamaDateTime_getWithHints (from, &seconds, &microseconds, &precision, &hints);
+
+    to->mPrecision = (mama_u8_t)precision;
+    to->mNanoseconds = ((mama_u32_t)microseconds) * (mama_u32_t)1000;
+    to->mSeconds = (mama_u32_t)seconds;
+    to->mHints = (mama_u8_t)hints;
+}
+
+void
+OmnmPayloadImpl::convertOmnmPriceToMamaPrice (omnmPrice* from, mamaPrice to)
+{
+    mamaPrice_setWithHints (to, (double)from->mValue, (mamaPriceHints)from->mHints);
+}
+
+void
+OmnmPayloadImpl::convertMamaPriceToOmnmPrice (mamaPrice from, omnmPrice* to)
+{
+    double value;
+    mamaPricePrecision precision;
+    mamaPriceHints hints;
+
+    mamaPrice_getPrecision(from, &precision);
+    mamaPrice_getHints(from, &hints);
+    mamaPrice_getValue(from, &value);
+
+    memset(to, 0, sizeof(omnmPrice));
+
+    to->mValue = (mama_f64_t)value;
+    to->mHints = (mama_u8_t)hints;
+}
+
+void
+OmnmPayloadImpl::initHeader (omnmHeader& header)
+{
+    header.mType                = MAMA_PAYLOAD_ID_OMNM;
+    header.mWireFormatVersion   = OMNM_PROTOCOL_VERSION;
+    header.mRemainingHeaderSize = sizeof(omnmHeader) - sizeof(omnmHeaderV1);
+    header.mFlags               = OMNM_HOST_BYTE_ORDER_FLAG;
+}
+
+void
+OmnmPayloadImpl::writeHeader()
+{
+    // Initialize header with defaults
+    initHeader (mHeader);
+
+    // Populate header types and move past
+    memcpy(mPayloadBuffer, &mHeader, sizeof(omnmHeader));
+
+    // Make sure tail is set to after the 'type' byte
+    setTail ((size_t) getHeaderSize());
+    dropRefs();
+    cancelBuilding();
+}
+
+mama_status
+OmnmPayloadImpl::clear()
+{
+    if (mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+
+    // Before the buffer a child is built in can be trimmed away
+    cancelBuilding();
+
+    // Nothing viewed needs to be kept, so there's nothing to copy. An
+    // external region stays attached to build the next message in.
+    if (isView())
+    {
+        returnBorrowed();
+    }
+    recycleArena (trimOnReuse());
+
+    // Nothing past the tail is ever read, so however large the buffer has
+    // grown there is no need to wipe it
+    writeHeader();
+
+    return MAMA_STATUS_OK;
+}
+
+void
+OmnmPayloadImpl::recycleArena (bool trimmed)
+{
+    if (trimmed)
+    {
+        omnmmsgArenaImpl_release (&mArena, mAllocator);
+    }
+    else
+    {
+        omnmmsgArenaImpl_reset (&mArena, mAllocator);
+    }
+}
+
+void
+OmnmPayloadImpl::reset()
+{
+    returnBorrowed();
+    omnmmsgArenaImpl_reset (&mArena, mAllocator);
+    writeHeader();
+    mParent          = nullptr;
+    mExtenderClosure = nullptr;
+    mPoolNext        = nullptr;
+    mShapeKey        = 0;
+    mSmallUses       = 0;
+    mViewMode        = false;
+    if (NULL != mModes)
+    {
+        mModes->mOwnTrimPolicy = false;
+    }
+}
+
+void
+OmnmPayloadImpl::borrow (const uint8_t* buffer, size_t length)
+{
+    returnBorrowed();
+    mOwnedBuffer       = mPayloadBuffer;
+    mOwnedBufferSize   = mPayloadBufferSize;
+    mPayloadBuffer     = (uint8_t*) buffer;
+    mPayloadBufferSize = length;
+}
+
+mama_status
+OmnmPayloadImpl::ownBuffer ()
+{
+    if (!isView())
+    {
+        return MAMA_STATUS_OK;
+    }
+
+    const uint8_t*    borrowed = mPayloadBuffer;
+    size_t            length   = mPayloadBufferTail;
+    omnmSharedBuffer* shared   = mShared;
+
+    // A shared buffer has to be held on to until it has been copied out of
+    mShared = NULL;
+    returnBorrowed();
+    if (MAMA_STATUS_OK != ensureCapacity (length))
+    {
+        writeHeader();
+        releaseShared (shared);
+        return MAMA_STATUS_NOMEM;
+    }
+    memcpy (mPayloadBuffer, borrowed, length);
+    setTail (length);
+    releaseShared (shared);
+    return MAMA_STATUS_OK;
+}
+
+bool
+OmnmPayloadImpl::isShareable () const
+{
+    // Anything small enough for the copy to hold inline is cheaper to copy
+    // than to share, and a caller's buffer has to be copied for the copy to
+    // outlive it
+    if (mFrozen || isBuilding() || isBuildingVector()
+        || mPayloadBufferTail <= mInlineCapacity)
+    {
+        return false;
+    }
+    return NULL != mShared || (!isBufferInline() && !isBorrowed());
+}
+
+mama_status
+OmnmPayloadImpl::share (OmnmPayloadImpl* copy)
+{
+    if (copy->mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+
+    // The first copy turns this payload's heap buffer into the shared one,
+    // leaving it a view of what it used to own
+    if (NULL == mShared)
+    {
+        void* memory = omnmmsgAllocatorImpl_malloc (mAllocator, sizeof(omnmSharedBuffer));
+        if (NULL == memory)
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, sizeof(omnmSharedBuffer));
+
+        omnmSharedBuffer* shared = new (memory) omnmSharedBuffer();
+        shared->mRefs.store (1, std::memory_order_relaxed);
+        shared->mAllocator = mAllocator;
+        unlockBuffer();
+        shared->mBuffer    = mPayloadBuffer;
+        shared->mSize      = mPayloadBufferSize;
+
+        mPayloadBuffer     = mInlineBuffer;
+        mPayloadBufferSize = mInlineCapacity;
+        borrow (shared->mBuffer, mPayloadBufferTail);
+        mShared = shared;
+    }
+
+    // As unSerialize would, minus the copy
+    copy->returnBorrowed();
+    copy->dropRefs();
+    copy->cancelBuilding();
+    copy->recycleArena (copy->trimOnReuse());
+    copy->borrow (mPayloadBuffer, mPayloadBufferTail);
+    copy->mHeader = mHeader;
+    copy->setTail (mPayloadBufferTail);
+
+    mShared->mRefs.fetch_add (1, std::memory_order_relaxed);
+    copy->mShared = mShared;
+    return MAMA_STATUS_OK;
+}
+
+void
+OmnmPayloadImpl::releaseShared (omnmSharedBuffer* shared)
+{
+    if (NULL == shared
+        || 1 != shared->mRefs.fetch_sub (1, std::memory_order_acq_rel))
+    {
+        return;
+    }
+    const omnmAllocator* allocator = shared->mAllocator;
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED,
+                               -(int64_t) (shared->mSize + sizeof(omnmSharedBuffer)));
+    omnmmsgAllocatorImpl_free (allocator, shared->mBuffer);
+    shared->~omnmSharedBuffer();
+    omnmmsgAllocatorImpl_free (allocator, shared);
+}
+
+void
+OmnmPayloadImpl::returnBorrowed ()
+{
+    if (!isBorrowed())
+    {
+        return;
+    }
+    releaseShared (mShared);
+    mShared            = NULL;
+    mPayloadBuffer     = mOwnedBuffer;
+    mPayloadBufferSize = mOwnedBufferSize;
+    mOwnedBuffer       = NULL;
+    mOwnedBufferSize   = 0;
+    mExternal          = false;
+    if (NULL != mModes)
+    {
+        mModes->mOverflow        = NULL;
+        mModes->mOverflowClosure = NULL;
+        mModes->mBuilderParent   = NULL;
+    }
+    setTail (0);
+    dropRefs();
+}
+
+mama_status
+OmnmPayloadImpl::attach (uint8_t*               region,
+                         size_t                 capacity,
+                         omnmBufferOverflowFunc overflow,
+                         void*                  closure)
+{
+    // Only a region which can grow needs anywhere to remember how
+    if (NULL != overflow && NULL == getModes())
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    borrow (region, capacity);
+    mExternal = true;
+    if (NULL != mModes)
+    {
+        mModes->mOverflow        = overflow;
+        mModes->mOverflowClosure = closure;
+    }
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+OmnmPayloadImpl::growExternal (size_t capacity)
+{
+    // A sub-message being built in place grows along with its parent,
+    // which moves it as part of its own buffer
+    if (NULL != getBuilderParent())
+    {
+        OmnmPayloadImpl* parent     = mModes->mBuilderParent;
+        size_t           start      = mPayloadBuffer - parent->mPayloadBuffer;
+        size_t           parentTail = parent->mPayloadBufferTail;
+
+        // Growing only keeps what is up to the tail, so stretch it over
+        // everything written here for the duration
+        parent->mPayloadBufferTail = start + mPayloadBufferTail;
+        mama_status status = parent->ensureCapacity (start + capacity);
+        parent->mPayloadBufferTail = parentTail;
+        if (MAMA_STATUS_OK != status)
+        {
+            return status;
+        }
+        mPayloadBuffer     = parent->mPayloadBuffer + start;
+        mPayloadBufferSize = parent->mPayloadBufferSize - start;
+        return MAMA_STATUS_OK;
+    }
+
+    size_t   granted = 0;
+    uint8_t* region  = NULL;
+    if (NULL != mModes && NULL != mModes->mOverflow)
+    {
+        region = (uint8_t*) mModes->mOverflow ((msgPayload) this,
+                                               capacity,
+                                               &granted,
+                                               mModes->mOverflowClosure);
+    }
+    if (NULL == region || granted < capacity)
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+
+    // The new region may well overlap the old one, or extend it in place
+    if (region != mPayloadBuffer)
+    {
+        memmove (region, mPayloadBuffer, mPayloadBufferTail);
+    }
+    mPayloadBuffer     = region;
+    mPayloadBufferSize = granted;
+    return MAMA_STATUS_OK;
+}
+
+void
+OmnmPayloadImpl::cancelBuilding ()
+{
+    if (NULL == mModes)
+    {
+        return;
+    }
+    if (isBuilding())
+    {
+        mModes->mBuilder->returnBorrowed();
+    }
+    mModes->mVectorLengthOffset = 0;
+    mModes->mParkedSize         = 0;
+    mModes->mUpdating           = false;
+}
+
+mama_status
+OmnmPayloadImpl::getBuilder ()
+{
+    if (NULL == getModes())
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    if (NULL == mModes->mBuilder && NULL == (mModes->mBuilder = allocate (mAllocator)))
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    return NULL == mModes->mBuilder->getModes() ? MAMA_STATUS_NOMEM : MAMA_STATUS_OK;
+}
+
+mama_status
+OmnmPayloadImpl::openBuilder (size_t lengthOffset, size_t length, OmnmPayloadImpl** child)
+{
+    OmnmPayloadImpl*  builder = mModes->mBuilder;
+    omnmPayloadModes* modes   = builder->mModes;
+    size_t            start   = lengthOffset + sizeof(mama_u32_t);
+
+    // Can't fail, as nothing is needed to build without an overflow
+    builder->attach (mPayloadBuffer + start, mPayloadBufferSize - start, NULL, NULL);
+    modes->mBuilderParent       = this;
+    modes->mBuilderLengthOffset = lengthOffset;
+    modes->mBuilderParentTail   = mPayloadBufferTail;
+
+    if (0 == length)
+    {
+        // Writes the same header the parent already holds there
+        builder->clear();
+    }
+    else
+    {
+        // Picks up the sub-message just as unSerialize would, minus the copy
+        builder->recycleArena (false);
+        readHeader (mPayloadBuffer + start, length, builder->mHeader);
+        builder->setTail (length);
+    }
+    *child = builder;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+OmnmPayloadImpl::beginSubMsg (const char* name, mama_fid_t fid, OmnmPayloadImpl** child)
+{
+    omnmHeader header;
+
+    if (mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+    if (isBuilding() || isBuildingVector()) return MAMA_STATUS_INVALID_ARG;
+
+    if (MAMA_STATUS_OK != getBuilder())
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+
+    // Until it is finished the parent holds an empty sub-message, so is
+    // always valid to read or send
+    initHeader (header);
+    mama_status status = addField (MAMA_FIELD_TYPE_MSG, name, fid,
+                                   (uint8_t*) &header, sizeof(header));
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    return openBuilder (mPayloadBufferTail - sizeof(header) - sizeof(mama_u32_t), 0, child);
+}
+
+mama_status
+OmnmPayloadImpl::beginSubMsgUpdate (const char* name, mama_fid_t fid, OmnmPayloadImpl** child)
+{
+    omnmFieldImpl field;
+
+    if (mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+    if (isBuilding() || isBuildingVector()) return MAMA_STATUS_INVALID_ARG;
+
+    // The sub-message is modified where it lies, so it has to be in a buffer
+    // of this payload's own
+    if (MAMA_STATUS_OK != ownBuffer() || MAMA_STATUS_OK != flatten())
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    mama_status status = findFieldInBuffer (name, fid, field);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    if (MAMA_FIELD_TYPE_MSG != field.mFieldType)
+    {
+        return MAMA_STATUS_WRONG_FIELD_TYPE;
+    }
+    if (MAMA_STATUS_OK != getBuilder())
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+
+    // Setting aside whatever follows leaves the sub-message at the tail, free
+    // to grow and shrink as if it were being built
+    size_t end = ((uint8_t*) field.mData - mPayloadBuffer) + field.mSize;
+    size_t parked = mPayloadBufferTail - end;
+    if (parked > mModes->mParkedCapacity)
+    {
+        uint8_t* grown = (uint8_t*) omnmmsgAllocatorImpl_malloc (mAllocator, parked);
+        if (NULL == grown)
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+        if (NULL != mModes->mParked)
+        {
+            omnmmsgAllocatorImpl_free (mAllocator, mModes->mParked);
+        }
+        mModes->mParked         = grown;
+        mModes->mParkedCapacity = parked;
+    }
+    if (0 != parked)
+    {
+        memcpy (mModes->mParked, mPayloadBuffer + end, parked);
+    }
+    mModes->mParkedSize = parked;
+    mModes->mUpdating   = true;
+    setTail (end);
+
+    return openBuilder (end - field.mSize - sizeof(mama_u32_t), field.mSize, child);
+}
+
+mama_status
+OmnmPayloadImpl::beginVectorMsg (const char* name, mama_fid_t fid)
+{
+    mama_u32_t length = 0;
+
+    if (mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+    if (isBuilding() || isBuildingVector()) return MAMA_STATUS_INVALID_ARG;
+
+    if (MAMA_STATUS_OK != getBuilder())
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+
+    // Fields can't be added empty, so add one with a body and take it off
+    mama_status status = addField (MAMA_FIELD_TYPE_VECTOR_MSG, name, fid,
+                                   (uint8_t*) &length, sizeof(length));
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    setTail (mPayloadBufferTail - sizeof(length));
+    mModes->mVectorLengthOffset = mPayloadBufferTail - sizeof(mama_u32_t);
+    memcpy (mPayloadBuffer + mModes->mVectorLengthOffset, &length, sizeof(length));
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+OmnmPayloadImpl::beginVectorMsgElement (OmnmPayloadImpl** child)
+{
+    omnmHeader header;
+
+    if (!isBuildingVector() || isBuilding()) return MAMA_STATUS_INVALID_ARG;
+
+    size_t     lengthOffset = mPayloadBufferTail;
+    mama_u32_t length       = sizeof(header);
+    if (MAMA_STATUS_OK != ensureCapacity (lengthOffset + sizeof(length) + sizeof(header)))
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+
+    // As with a single sub-message, the element starts out empty
+    initHeader (header);
+    memcpy (mPayloadBuffer + lengthOffset, &length, sizeof(length));
+    memcpy (mPayloadBuffer + lengthOffset + sizeof(length), &header, sizeof(header));
+    setTail (lengthOffset + sizeof(length) + sizeof(header));
+
+    length = (mama_u32_t) (mPayloadBufferTail - mModes->mVectorLengthOffset - sizeof(mama_u32_t));
+    memcpy (mPayloadBuffer + mModes->mVectorLengthOffset, &length, sizeof(length));
+    return openBuilder (lengthOffset, 0, child);
+}
+
+mama_status
+OmnmPayloadImpl::endSubMsg ()
+{
+    if (!isBuilding()) return MAMA_STATUS_INVALID_ARG;
+
+    OmnmPayloadImpl*  child = mModes->mBuilder;
+    omnmPayloadModes* modes = child->mModes;
+    size_t            start = modes->mBuilderLengthOffset + sizeof(mama_u32_t);
+
+    // Anything added to the parent meanwhile has been written over
+    if (child->isBuilding() || mPayloadBufferTail != modes->mBuilderParentTail)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+
+    mama_status status = child->flatten();
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    if (child->mPayloadBufferTail > UINT32_MAX)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+
+    mama_u32_t length = (mama_u32_t) child->mPayloadBufferTail;
+    memcpy (mPayloadBuffer + modes->mBuilderLengthOffset, &length, sizeof(length));
+    setTail (start + length);
+    child->returnBorrowed();
+    mModes->mUpdating = false;
+
+    // Put back whatever followed a sub-message opened for update
+    if (0 != mModes->mParkedSize)
+    {
+        if (MAMA_STATUS_OK != ensureCapacity (mPayloadBufferTail + mModes->mParkedSize))
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+        memcpy (mPayloadBuffer + mPayloadBufferTail, mModes->mParked, mModes->mParkedSize);
+        setTail (mPayloadBufferTail + mModes->mParkedSize);
+        mModes->mParkedSize = 0;
+    }
+
+    if (isBuildingVector())
+    {
+        length = (mama_u32_t) (mPayloadBufferTail - mModes->mVectorLengthOffset
+                               - sizeof(mama_u32_t));
+        memcpy (mPayloadBuffer + mModes->mVectorLengthOffset, &length, sizeof(length));
+    }
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+OmnmPayloadImpl::endVectorMsg ()
+{
+    if (!isBuildingVector() || isBuilding()) return MAMA_STATUS_INVALID_ARG;
+    mModes->mVectorLengthOffset = 0;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+OmnmPayloadImpl::detachBuffer (uint8_t** buffer, size_t* bufferLength)
+{
+    if (mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+    if (MAMA_STATUS_OK != flatten()) return MAMA_STATUS_NOMEM;
+
+    size_t capacity = mPayloadBufferSize;
+    if (isBufferInline() || isBorrowed())
+    {
+        // Neither is the payload's to give away, so this is the one copy
+        uint8_t* copy = (uint8_t*) omnmmsgAllocatorImpl_malloc (mAllocator,
+                                                                mPayloadBufferTail);
+        if (NULL == copy)
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+        memcpy (copy, mPayloadBuffer, mPayloadBufferTail);
+        *buffer  = copy;
+        capacity = 0;
+    }
+    else
+    {
+        unlockBuffer();
+        *buffer = mPayloadBuffer;
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, -(int64_t) mPayloadBufferSize);
+        mPayloadBuffer     = mInlineBuffer;
+        mPayloadBufferSize = mInlineCapacity;
+    }
+    *bufferLength = mPayloadBufferTail;
+
+    // The next message is likely to be about as large, so take a fresh
+    // buffer now rather than growing into one field by field. Failing that
+    // the inline buffer will do.
+    clear();
+    reserve (capacity);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+OmnmPayloadImpl::adoptBuffer (uint8_t* buffer, size_t bufferLength, size_t bufferCapacity)
+{
+    omnmHeader header;
+
+    if (mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+    if (bufferCapacity < bufferLength) return MAMA_STATUS_INVALID_ARG;
+
+    mama_status status = readHeader (buffer, bufferLength, header);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+
+    // Converted while the buffer is still the caller's, so that failing
+    // leaves the payload as it was. Checked all the way through first, so
+    // that failing leaves the buffer as it was too.
+    if (omnmmsgByteOrderImpl_needsSwap (header.mFlags))
+    {
+        status = omnmmsgByteOrderImpl_checkPayload (buffer,
+                                                    bufferLength,
+                                                    OMNM_HOST_BYTE_ORDER_FLAG);
+        if (MAMA_STATUS_OK != status)
+        {
+            return status;
+        }
+        status = omnmmsgByteOrderImpl_swapPayload (buffer,
+                                                   bufferLength,
+                                                   OMNM_HOST_BYTE_ORDER_FLAG);
+        if (MAMA_STATUS_OK != status)
+        {
+            return status;
+        }
+        header.mFlags = (mama_u8_t)((header.mFlags & ~OMNM_HEADER_FLAG_BYTE_ORDER_MASK)
+                                    | OMNM_HOST_BYTE_ORDER_FLAG);
+    }
+
+    bool trimmed = trimOnReuse();
+    releaseHeapBuffer();
+    recycleArena (trimmed);
+    dropRefs();
+    cancelBuilding();
+
+    mPayloadBuffer     = buffer;
+    mPayloadBufferSize = bufferCapacity;
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, bufferCapacity);
+    omnmmsgAccountingImpl_noteBuffer (bufferCapacity);
+
+    mHeader.mWireFormatVersion   = header.mWireFormatVersion;
+    mHeader.mRemainingHeaderSize = header.mRemainingHeaderSize;
+    mHeader.mFlags               = header.mFlags;
+    setTail (bufferLength);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+OmnmPayloadImpl::readHeader (const void* buffer, size_t bufferLength, omnmHeader& header)
+{
+    if (bufferLength < sizeof(omnmHeaderV1))
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, buffer, sizeof(omnmHeaderV1));
+    if (header.mWireFormatVersion > OMNM_PROTOCOL_VERSION)
+    {
+        return MAMA_STATUS_WRONG_FIELD_TYPE;
+    }
+    if (sizeof(omnmHeaderV1) + header.mRemainingHeaderSize > bufferLength)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+    if (header.mRemainingHeaderSize > 0)
+    {
+        header.mFlags = ((const omnmHeader*) buffer)->mFlags;
+    }
+    return MAMA_STATUS_OK;
+}
+
+void
+OmnmPayloadImpl::shrinkCapacity (size_t capacity)
+{
+    if (capacity < mPayloadBufferTail)
+    {
+        capacity = mPayloadBufferTail;
+    }
+    if (isBufferInline() || isBorrowed() || capacity >= mPayloadBufferSize)
+    {
+        return;
+    }
+
+    // Whether or not it moves, what is left of it is no longer locked
+    unlockBuffer();
+    if (capacity <= mInlineCapacity)
+    {
+        memcpy (mInlineBuffer, mPayloadBuffer, mPayloadBufferTail);
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, -(int64_t) mPayloadBufferSize);
+        omnmmsgAllocatorImpl_free (mAllocator, mPayloadBuffer);
+        mPayloadBuffer     = mInlineBuffer;
+        mPayloadBufferSize = mInlineCapacity;
+        return;
+    }
+
+    // If the allocator can't shrink it, keeping the larger buffer is fine
+    uint8_t* shrunk = (uint8_t*) mAllocator->mRealloc (mPayloadBuffer,
+                                                       capacity,
+                                                       mAllocator->mClosure);
+    if (NULL != shrunk)
+    {
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED,
+                                   (int64_t) capacity - (int64_t) mPayloadBufferSize);
+        mPayloadBuffer     = shrunk;
+        mPayloadBufferSize = capacity;
+    }
+}
+
+bool
+OmnmPayloadImpl::trimOnReuse()
+{
+    size_t     target;
+    mama_u32_t smallUses;
+    if (NULL != mModes && mModes->mOwnTrimPolicy)
+    {
+        target    = mModes->mTrimPolicy.mTargetCapacity;
+        smallUses = mModes->mTrimPolicy.mSmallUses;
+    }
+    else
+    {
+        target    = gTrimTargetCapacity.load (std::memory_order_relaxed);
+        smallUses = gTrimSmallUses.load (std::memory_order_relaxed);
+    }
+
+    if (0 == smallUses)
+    {
+        return false;
     }
-    else
+    if (mPayloadBufferTail > target)
+    {
+        mSmallUses = 0;
+        return false;
+    }
+    if (++mSmallUses < smallUses)
     {
         return false;
     }
+    mSmallUses = 0;
+
+    shrinkCapacity (target);
+
+    // The caches hold nothing between calls, so can simply be dropped
+    omnmmsgFieldPayloadImpl_trimCache (&mField, target);
+    return true;
 }
 
 void
-OmnmPayloadImpl::convertOmnmDateTimeToMamaDateTime (omnmDateTime* from, mamaDateTime to)
+OmnmPayloadImpl::releaseHeapBuffer()
 {
-    mamaDateTime_setWithHints(to,
-                              (mama_u32_t)from->mSeconds,
-                              from->mNanoseconds / 1000,
-                              (mamaDateTimePrecision)from->mPrecision,
-                              (mamaDateTimeHints)from->mHints);
+    returnBorrowed();
+    if (isBufferInline())
+    {
+        return;
+    }
+    unlockBuffer();
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, -(int64_t) mPayloadBufferSize);
+    omnmmsgAllocatorImpl_free (mAllocator, mPayloadBuffer);
+    mPayloadBuffer     = mInlineBuffer;
+    mPayloadBufferSize = mInlineCapacity;
+    setTail (0);
+    dropRefs();
 }
 
 void
-OmnmPayloadImpl::convertMamaDateTimeToOmnmDateTime (mamaDateTime from, omnmDateTime* to)
+OmnmPayloadImpl::unlockBuffer()
 {
-    mamaDateTimeHints hints;
-    mamaDateTimePrecision precision;
-    mama_u32_t seconds = 0, microseconds = 0;
-
-    memset(to, 0, sizeof(omnmDateTime));
-
-    mamaDateTime_getWithHints (from, &seconds, &microseconds, &precision, &hints);
-
-    to->mPrecision = (mama_u8_t)precision;
-    to->mNanoseconds = ((mama_u32_t)microseconds) * (mama_u32_t)1000;
-    to->mSeconds = (mama_u32_t)seconds;
-    to->mHints = (mama_u8_t)hints;
+    // A borrowed buffer isn't the one which was locked
+    if (mLockedBuffer && !isBorrowed())
+    {
+        omnmmsgPayloadPoolImpl_unlock (mPayloadBuffer, mPayloadBufferSize);
+        mLockedBuffer = false;
+    }
 }
 
-void
-OmnmPayloadImpl::convertOmnmPriceToMamaPrice (omnmPrice* from, mamaPrice to)
+uint16_t
+OmnmPayloadImpl::getHeaderSize()
 {
-    mamaPrice_setWithHints (to, (double)from->mValue, (mamaPriceHints)from->mHints);
+    return (uint16_t)(sizeof(omnmHeaderV1) + mHeader.mRemainingHeaderSize);
 }
 
-void
-OmnmPayloadImpl::convertMamaPriceToOmnmPrice (mamaPrice from, omnmPrice* to)
+mama_status
+OmnmPayloadImpl::ensureCapacity (size_t capacity)
 {
-    double value;
-    mamaPricePrecision precision;
-    mamaPriceHints hints;
-
-    mamaPrice_getPrecision(from, &precision);
-    mamaPrice_getHints(from, &hints);
-    mamaPrice_getValue(from, &value);
+    if (mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+    if (isView()) return ownBuffer() == MAMA_STATUS_OK
+                           ? ensureCapacity (capacity)
+                           : MAMA_STATUS_NOMEM;
 
-    memset(to, 0, sizeof(omnmPrice));
+    if (capacity <= mPayloadBufferSize)
+    {
+        return MAMA_STATUS_OK;
+    }
+    if (mExternal)
+    {
+        return growExternal (capacity);
+    }
 
-    to->mValue = (mama_f64_t)value;
-    to->mHints = (mama_u8_t)hints;
+    // Grow geometrically so a payload built up a field at a time only
+    // reallocates a handful of times
+    size_t grown = mPayloadBufferSize * OMNM_BUFFER_GROWTH_FACTOR;
+    return reallocate (capacity > grown ? capacity : grown);
 }
 
 mama_status
-OmnmPayloadImpl::clear()
+OmnmPayloadImpl::reserve (size_t capacity)
 {
-    // Initialize header with defaults
-    mHeader.mType                = MAMA_PAYLOAD_ID_OMNM;
-    mHeader.mWireFormatVersion   = OMNM_PROTOCOL_VERSION;
-    mHeader.mRemainingHeaderSize = sizeof(omnmHeader) - sizeof(omnmHeaderV1);
+    if (mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+    if (isBuilding()) return MAMA_STATUS_INVALID_ARG;
+    if (isView()) return ownBuffer() == MAMA_STATUS_OK
+                           ? reserve (capacity)
+                           : MAMA_STATUS_NOMEM;
 
-    // Populate header types and move past
-    memcpy(mPayloadBuffer, &mHeader, sizeof(omnmHeader));
+    if (capacity <= mPayloadBufferSize)
+    {
+        return MAMA_STATUS_OK;
+    }
+    if (mExternal)
+    {
+        return growExternal (capacity);
+    }
+    return reallocate (capacity);
+}
 
-    // Make sure tail is set to after the 'type' byte
-    mPayloadBufferTail = (size_t) getHeaderSize();
+mama_status
+OmnmPayloadImpl::reallocate (size_t capacity)
+{
+    if (isBufferInline())
+    {
+        // Spill over to the heap. Only the bytes up to the tail matter.
+        uint8_t* heapBuffer = (uint8_t*) omnmmsgAllocatorImpl_malloc (mAllocator, capacity);
+        if (NULL == heapBuffer)
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+        memcpy (heapBuffer, mInlineBuffer, mPayloadBufferTail);
 
-    // NULL initialize the buffer after the first byte
-    memset ((void*)(mPayloadBuffer + mPayloadBufferTail), 0, mPayloadBufferSize - mPayloadBufferTail);
+        mPayloadBuffer     = heapBuffer;
+        mPayloadBufferSize = capacity;
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, capacity);
+        omnmmsgAccountingImpl_noteBuffer (capacity);
+        return MAMA_STATUS_OK;
+    }
 
+    // Growing may move the buffer, freeing the one which was locked
+    unlockBuffer();
+    size_t previous = mPayloadBufferSize;
+    if (0 != omnmmsgAllocatorImpl_allocateBufferMemory (mAllocator,
+                                                        (void**)&mPayloadBuffer,
+                                                        &mPayloadBufferSize,
+                                                        capacity))
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED,
+                               (int64_t) mPayloadBufferSize - (int64_t) previous);
+    omnmmsgAccountingImpl_noteBuffer (mPayloadBufferSize);
     return MAMA_STATUS_OK;
 }
 
-uint16_t
-OmnmPayloadImpl::getHeaderSize()
-{
-    return (uint16_t)(sizeof(omnmHeaderV1) + mHeader.mRemainingHeaderSize);
-}
-
 mama_status
 OmnmPayloadImpl::findFieldInBuffer (const char* name, mama_fid_t fid, omnmFieldImpl& field)
 {
@@ -415,6 +1405,25 @@ OmnmPayloadImpl::findFieldInBuffer (const char* name, mama_fid_t fid, omnmFieldI
 mama_status
 OmnmPayloadImpl::addField (mamaFieldType type, const char* name, mama_fid_t fid,
         uint8_t* buffer, size_t bufferLen)
+{
+    return appendField (type, name, fid, buffer, bufferLen, false);
+}
+
+mama_status
+OmnmPayloadImpl::addFieldRef (mamaFieldType type, const char* name, mama_fid_t fid,
+        const uint8_t* buffer, size_t bufferLen)
+{
+    // Readers can only skip a body they don't hold if it has a size
+    if (!isFieldTypeSized (type))
+    {
+        return MAMA_STATUS_WRONG_FIELD_TYPE;
+    }
+    return appendField (type, name, fid, buffer, bufferLen, true);
+}
+
+mama_status
+OmnmPayloadImpl::appendField (mamaFieldType type, const char* name, mama_fid_t fid,
+        const uint8_t* buffer, size_t bufferLen, bool byReference)
 {
     if (bufferLen > UINT32_MAX) return MAMA_STATUS_INVALID_ARG;
 
@@ -422,12 +1431,22 @@ OmnmPayloadImpl::addField (mamaFieldType type, const char* name, mama_fid_t fid,
 
     // New tail will be comprised of type, fid, field
     size_t newTailOffset = mPayloadBufferTail + FIELD_TYPE_WIDTH + FID_WIDTH +
-            nameLen + bufferLen;
+            nameLen + (byReference ? 0 : bufferLen);
 
     if (NULL == buffer || 0 == bufferLen || (NULL == name && 0 == fid))
     {
         return MAMA_STATUS_NULL_ARG;
     }
+    if (mFrozen)
+    {
+        return MAMA_STATUS_NOT_MODIFIABLE;
+    }
+
+    // The tail belongs to whatever is being built there
+    if (isBuilding() || isBuildingVector())
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
 
     // If a variable width field, buffer will also contain a size
     if (isFieldTypeSized(type))
@@ -437,10 +1456,33 @@ OmnmPayloadImpl::addField (mamaFieldType type, const char* name, mama_fid_t fid,
 
     VALIDATE_NAME_FID(name, fid);
 
+    // Make room for the reference first, so that failing leaves no trace
+    if (byReference && NULL == getModes())
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    if (byReference && mModes->mRefCount == mModes->mRefCapacity)
+    {
+        size_t refBytes = mModes->mRefCapacity * sizeof(omnmFieldRef);
+        if (0 != omnmmsgAllocatorImpl_allocateBufferMemory (mAllocator,
+                                                            (void**)&mModes->mRefs,
+                                                            &refBytes,
+                                                            (mModes->mRefCapacity + 4) * 2
+                                                            * sizeof(omnmFieldRef)))
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED,
+                                   (int64_t) refBytes
+                                   - (int64_t) (mModes->mRefCapacity * sizeof(omnmFieldRef)));
+        mModes->mRefCapacity = (mama_u32_t) (refBytes / sizeof(omnmFieldRef));
+    }
+
     // Ensure the buffer is big enough for this
-    allocateBufferMemory ((void**)&mPayloadBuffer,
-                          &mPayloadBufferSize,
-                          newTailOffset);
+    if (MAMA_STATUS_OK != ensureCapacity (newTailOffset))
+    {
+        return MAMA_STATUS_NOMEM;
+    }
 
     // Will insert at wherever the current tail is
     uint8_t* insertPoint = mPayloadBuffer + mPayloadBufferTail;
@@ -474,16 +1516,101 @@ OmnmPayloadImpl::addField (mamaFieldType type, const char* name, mama_fid_t fid,
         insertPoint += sizeof(mama_u32_t);
     }
 
-    // Copy across the data itself
-    memcpy ((void*)insertPoint, (void*)buffer, bufferLen);
+    // Copy across the data itself, or note where it will go
+    if (byReference)
+    {
+        omnmFieldRef& ref = mModes->mRefs[mModes->mRefCount++];
+        ref.mOffset         = insertPoint - mPayloadBuffer;
+        ref.mData           = buffer;
+        ref.mSize           = bufferLen;
+        ref.mFid            = fid;
+        mModes->mRefBytes  += bufferLen;
+    }
+    else
+    {
+        memcpy ((void*)insertPoint, (void*)buffer, bufferLen);
+    }
 
     // Update the tail position
-    mPayloadBufferTail = newTailOffset;
+    setTail (newTailOffset);
 
     // If name and fid is null, add 'bare'
     return MAMA_STATUS_OK;
 }
 
+mama_status
+OmnmPayloadImpl::flatten ()
+{
+    if (!hasRefs())
+    {
+        return MAMA_STATUS_OK;
+    }
+
+    size_t refBytes = mModes->mRefBytes;
+    if (MAMA_STATUS_OK != ensureCapacity (mPayloadBufferTail + refBytes))
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+
+    // Working back from the end, move everything after each body along by
+    // the size of the bodies up to and including it, then drop it in place
+    size_t end   = mPayloadBufferTail;
+    size_t shift = refBytes;
+    for (mama_u32_t i = mModes->mRefCount; i-- > 0; )
+    {
+        const omnmFieldRef& ref = mModes->mRefs[i];
+        memmove (mPayloadBuffer + ref.mOffset + shift,
+                 mPayloadBuffer + ref.mOffset,
+                 end - ref.mOffset);
+        shift -= ref.mSize;
+        memcpy (mPayloadBuffer + ref.mOffset + shift, ref.mData, ref.mSize);
+        end = ref.mOffset;
+    }
+
+    dropRefs();
+    setTail (mPayloadBufferTail + refBytes);
+    return MAMA_STATUS_OK;
+}
+
+size_t
+OmnmPayloadImpl::getFlattenedOffset (const void* data, mama_fid_t fid, size_t size) const
+{
+    const uint8_t*      position = (const uint8_t*) data;
+    const omnmFieldRef* refs     = hasRefs() ? mModes->mRefs : NULL;
+    mama_u32_t          refCount = hasRefs() ? mModes->mRefCount : 0;
+    size_t              shift    = 0;
+
+    if (position >= mPayloadBuffer && position < mPayloadBuffer + mPayloadBufferTail)
+    {
+        size_t offset = position - mPayloadBuffer;
+        for (mama_u32_t i = 0; i < refCount && refs[i].mOffset <= offset; i++)
+        {
+            shift += refs[i].mSize;
+        }
+        return offset + shift;
+    }
+
+    for (mama_u32_t i = 0; i < refCount; i++)
+    {
+        const omnmFieldRef& ref = refs[i];
+        if (ref.mData == data && ref.mFid == fid && ref.mSize == size)
+        {
+            return ref.mOffset + shift;
+        }
+        shift += ref.mSize;
+    }
+    return 0;
+}
+
+void
+OmnmPayloadImpl::recordShape () const
+{
+    if (0 != mShapeKey)
+    {
+        omnmmsgShapeImpl_record (mShapeKey, mPayloadBufferTail + getRefBytes());
+    }
+}
+
 mama_status
 OmnmPayloadImpl::updateField (mamaFieldType type, const char* name,
         mama_fid_t fid, uint8_t* buffer, size_t bufferLen)
@@ -494,6 +1621,14 @@ OmnmPayloadImpl::updateField (mamaFieldType type, const char* name,
     {
         return MAMA_STATUS_NULL_ARG;
     }
+    if (mFrozen)
+    {
+        return MAMA_STATUS_NOT_MODIFIABLE;
+    }
+    if (isBuilding() || isBuildingVector())
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
 
     mama_status status = findFieldInBuffer (name, fid, field);
 
@@ -521,6 +1656,16 @@ OmnmPayloadImpl::updateField (mamaFieldType type, omnmFieldImpl& field,
     {
         return MAMA_STATUS_NULL_ARG;
     }
+    if (mFrozen)
+    {
+        return MAMA_STATUS_NOT_MODIFIABLE;
+    }
+
+    // Moving fields about would move a child being built out from under it
+    if (isBuilding() || isBuildingVector())
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
 
     if (field.mFieldType != type &&
         false == OmnmPayloadImpl::areFieldTypesCastable(field.mFieldType, type))
@@ -528,6 +1673,38 @@ OmnmPayloadImpl::updateField (mamaFieldType type, omnmFieldImpl& field,
         return MAMA_STATUS_WRONG_FIELD_TYPE;
     }
 
+    // A view has to take its own copy before anything is written to it
+    if (isView())
+    {
+        const uint8_t* borrowed = mPayloadBuffer;
+        if (MAMA_STATUS_OK != ownBuffer())
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+        field.mData = mPayloadBuffer + ((uint8_t*)field.mData - borrowed);
+        if (NULL != field.mName)
+        {
+            field.mName = (const char*)mPayloadBuffer + ((uint8_t*)field.mName - borrowed);
+        }
+    }
+
+    // Fields are moved about in place, so any bodies held by reference have
+    // to be copied in first
+    if (hasRefs())
+    {
+        size_t dataOffset = getFlattenedOffset (field.mData, field.mFid, field.mSize);
+        size_t nameOffset = getFlattenedOffset (field.mName, field.mFid, 0);
+        if (MAMA_STATUS_OK != flatten())
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+        field.mData = mPayloadBuffer + dataOffset;
+        if (NULL != field.mName)
+        {
+            field.mName = (const char*)mPayloadBuffer + nameOffset;
+        }
+    }
+
     // If buffer needs to expand or shrink
     if (bufferLen != field.mSize)
     {
@@ -543,11 +1720,12 @@ OmnmPayloadImpl::updateField (mamaFieldType type, omnmFieldImpl& field,
             const uint8_t* payloadBufferPrev = mPayloadBuffer;
 
             // Increase buffer memory
-            allocateBufferMemory ((void**)&mPayloadBuffer,
-                                  &mPayloadBufferSize,
-                                  mPayloadBufferSize + delta);
+            if (MAMA_STATUS_OK != ensureCapacity (mPayloadBufferTail + delta))
+            {
+                return MAMA_STATUS_NOMEM;
+            }
 
-            // If the allocateBufferMemory (realloc) has actually moved the underlying buffer
+            // If growing (realloc or spill) has actually moved the underlying buffer
             if(payloadBufferPrev != mPayloadBuffer)
             {
               // buffers have moved so re-apply offsets
@@ -567,7 +1745,7 @@ OmnmPayloadImpl::updateField (mamaFieldType type, omnmFieldImpl& field,
             memmove ((void*)(origin + delta), origin, size);
         }
 
-        mPayloadBufferTail = (signed) mPayloadBufferTail + delta;
+        setTail ((size_t) ((int64_t) mPayloadBufferTail + delta));
     }
 
     if (isFieldTypeSized(field.mFieldType))
@@ -580,12 +1758,39 @@ OmnmPayloadImpl::updateField (mamaFieldType type, omnmFieldImpl& field,
 }
 
 
+// A sub-message read from a payload is a view of that payload's buffer.
+// Writing it back into the same payload could move the buffer out from under
+// it, so in that case it takes a copy of its own first.
+static mama_status
+serializeSubMsg (OmnmPayloadImpl*  target,
+                 const msgPayload  value,
+                 const void**      buffer,
+                 mama_size_t*      bufferLength)
+{
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) value;
+    if (impl->isView()
+        && impl->mPayloadBuffer >= target->mPayloadBuffer
+        && impl->mPayloadBuffer < target->mPayloadBuffer + target->mPayloadBufferSize)
+    {
+        mama_status status = impl->ownBuffer();
+        if (MAMA_STATUS_OK != status)
+        {
+            return status;
+        }
+    }
+    return omnmmsgPayload_serialize (value, buffer, bufferLength);
+}
+
 mama_status
 OmnmPayloadImpl::updateSubMsg (msgPayload msg, const char* name, mama_fid_t fid, const msgPayload value)
 {
     const void* buffer = NULL;
     mama_size_t bufferLen = 0;
-    omnmmsgPayload_serialize (value, &buffer, &bufferLen);
+    mama_status status = serializeSubMsg ((OmnmPayloadImpl*) msg, value, &buffer, &bufferLen);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
 
     return ((OmnmPayloadImpl*) msg)->updateField (MAMA_FIELD_TYPE_MSG,
                                                   name,
@@ -594,6 +1799,22 @@ OmnmPayloadImpl::updateSubMsg (msgPayload msg, const char* name, mama_fid_t fid,
                                                   bufferLen);
 }
 
+mama_status
+OmnmPayloadImpl::updateSubMsg (omnmFieldImpl& field, const msgPayload value)
+{
+    const void* buffer = NULL;
+    mama_size_t bufferLen = 0;
+    mama_status status = serializeSubMsg (this, value, &buffer, &bufferLen);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+
+    // The field is already located, so a message of the same size is
+    // written straight over it and any other only shifts what follows
+    return updateField (MAMA_FIELD_TYPE_MSG, field, (uint8_t*)buffer, bufferLen);
+}
+
 
 
 /*=========================================================================
@@ -608,6 +1829,23 @@ omnmmsgPayload_init (mamaPayloadBridge bridge, char* identifier)
     /* Will set the bridge's compile time MAMA version */
     MAMA_SET_BRIDGE_COMPILE_TIME_VERSION("omnmmsg");
 
+    // The huge page allocator is also what places memory on the local node
+    const char* hugePages = mama_getProperty (OMNM_HUGE_PAGES_PROPERTY);
+    const char* numa      = mama_getProperty (OMNM_NUMA_PROPERTY);
+    bool        regions   = omnmmsgNumaImpl_getNodeCount () > 1;
+    if (NULL != numa)
+    {
+        regions = properties_GetPropertyValueAsBoolean (numa) != 0;
+    }
+    if (NULL != hugePages && properties_GetPropertyValueAsBoolean (hugePages))
+    {
+        regions = true;
+    }
+    if (regions)
+    {
+        omnmmsgPayloadImpl_setAllocator (omnmmsgHugePageImpl_getAllocator ());
+    }
+
     return MAMA_STATUS_OK;
 }
 
@@ -622,13 +1860,8 @@ MAMAIgnoreDeprecatedClose
 mama_status
 omnmmsgPayload_create (msgPayload* msg)
 {
-    if (NULL == msg) return MAMA_STATUS_NULL_ARG;
-
-    OmnmPayloadImpl* impl = new OmnmPayloadImpl();
-
-    *msg = (msgPayload) impl;
-
-    return MAMA_STATUS_OK;
+    return omnmmsgPayloadImpl_createWithAllocator (msg,
+                                                   omnmmsgAllocatorImpl_getDefault ());
 }
 
 mama_status
@@ -638,7 +1871,10 @@ omnmmsgPayload_destroy (msgPayload msg)
 
     OmnmPayloadImpl* impl = (OmnmPayloadImpl*) msg;
 
-    delete impl;
+    if (!omnmmsgPayloadPoolImpl_release (impl))
+    {
+        OmnmPayloadImpl::deallocate (impl);
+    }
 
     return MAMA_STATUS_OK;
 }
@@ -648,7 +1884,8 @@ omnmmsgPayload_createForTemplate (msgPayload*        msg,
                                   mamaPayloadBridge  bridge,
                                   mama_u32_t         templateId)
 {
-    return MAMA_STATUS_NOT_IMPLEMENTED;
+    return omnmmsgPayloadImpl_createForShape (
+            msg, omnmmsgShapeImpl_keyForTemplate (templateId));
 }
 
 mama_status
@@ -663,22 +1900,47 @@ omnmmsgPayload_copy (const msgPayload    msg,
         return MAMA_STATUS_NULL_ARG;
     }
 
+    // The copy is unserialized from a single buffer
+    status = impl->flatten();
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+
     /*
      * Create destination message object if the user hasn't already created
      * one
      */
     if (NULL == *copy)
     {
-        status = omnmmsgPayload_create (copy);
+        status = omnmmsgPayloadImpl_createWithAllocator (copy, impl->mAllocator);
         if (MAMA_STATUS_OK != status)
         {
             return status;
         }
     }
+    if (impl == *copy)
+    {
+        return MAMA_STATUS_OK;
+    }
+
+    // Copies which are mostly only read share the one buffer, and whichever
+    // side writes first takes a copy of its own then
+    if (impl->isShareable())
+    {
+        return impl->share ((OmnmPayloadImpl*) *copy);
+    }
+
+    status = omnmmsgPayload_unSerialize ((OmnmPayloadImpl*) *copy,
+                                         (const void*)impl->mPayloadBuffer,
+                                         impl->mPayloadBufferTail);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
 
-    return omnmmsgPayload_unSerialize ((OmnmPayloadImpl*) *copy,
-                                       (const void*)impl->mPayloadBuffer,
-                                       impl->mPayloadBufferTail);
+    // A copy must outlive its source, even if the destination is a view
+    return ((OmnmPayloadImpl*) *copy)->ownBuffer();
 }
 
 mama_status
@@ -702,7 +1964,9 @@ omnmmsgPayload_getByteSize (msgPayload    msg,
                             mama_size_t*  size)
 {
     if (NULL == msg) return MAMA_STATUS_NULL_ARG;
-    *size = ((OmnmPayloadImpl*) msg)->mPayloadBufferTail;
+    if (((OmnmPayloadImpl*) msg)->isUpdating()) return MAMA_STATUS_INVALID_ARG;
+    *size = ((OmnmPayloadImpl*) msg)->mPayloadBufferTail
+            + ((OmnmPayloadImpl*) msg)->getRefBytes();
     return MAMA_STATUS_OK;
 }
 
@@ -765,14 +2029,18 @@ omnmmsgPayload_toString (const msgPayload msg)
     // Initialize the iterator for this message
     omnmmsgPayloadIterImpl_init (&iter, impl);
 
-    if (0 != allocateBufferMemory ((void**) &impl->mField.mBuffer,
-                                   &impl->mField.mBufferLen,
-                                   sizeof(part)))
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (&impl->mField);
+    if (NULL == cache) return NULL;
+
+    if (0 != omnmmsgFieldPayloadImpl_growCache (&impl->mField,
+                                                (void**) &cache->mBuffer,
+                                                &cache->mBufferLen,
+                                                sizeof(part)))
     {
         return NULL;
     }
 
-    charIdx += sprintf ((char*)impl->mField.mBuffer + charIdx, "{");
+    charIdx += sprintf ((char*)cache->mBuffer + charIdx, "{");
 
     // Iterate over all fields
     while (NULL != (fieldPayload = omnmmsgPayloadIter_next(iterOpaque, NULL, msg)))
@@ -788,23 +2056,24 @@ omnmmsgPayload_toString (const msgPayload msg)
 
         bytesInString = strlenEx(fname) + strlen(part) + 10;
 
-        if (0 != allocateBufferMemory ((void**) &impl->mField.mBuffer,
-                                       &impl->mField.mBufferLen,
-                                       bytesInString + charIdx))
+        if (0 != omnmmsgFieldPayloadImpl_growCache (&impl->mField,
+                                                    (void**) &cache->mBuffer,
+                                                    &cache->mBufferLen,
+                                                    bytesInString + charIdx))
         {
             return NULL;
         }
 
         if (fid == 0)
         {
-           charIdx += sprintf ((char*)impl->mField.mBuffer + charIdx,
+           charIdx += sprintf ((char*)cache->mBuffer + charIdx,
                                "%s=%s",
                                fname ? fname : "",
                                part);
         }
         else
         {
-           charIdx += sprintf ((char*)impl->mField.mBuffer + charIdx,
+           charIdx += sprintf ((char*)cache->mBuffer + charIdx,
                                "%s[%u]=%s",
                                fname ? fname : "",
                                fid,
@@ -813,13 +2082,13 @@ omnmmsgPayload_toString (const msgPayload msg)
 
         if (omnmmsgPayloadIter_hasNext (iterOpaque, msg))
         {
-            charIdx += sprintf((char*)impl->mField.mBuffer + charIdx, ",");
+            charIdx += sprintf((char*)cache->mBuffer + charIdx, ",");
         }
     }
 
-    sprintf((char*)impl->mField.mBuffer + charIdx, "}");
+    sprintf((char*)cache->mBuffer + charIdx, "}");
 
-    return (const char*) impl->mField.mBuffer;
+    return (const char*) cache->mBuffer;
 }
 
 mama_status
@@ -851,6 +2120,9 @@ omnmmsgPayload_iterateFields (const msgPayload    msg,
         cb (parent, field, closure);
     }
 
+    // The callback may have populated the field caches of the stack iterator
+    omnmmsgFieldPayloadImpl_cleanup (&iter.mField);
+
     return MAMA_STATUS_OK;
 }
 
@@ -863,8 +2135,17 @@ omnmmsgPayload_serialize (const msgPayload  msg,
     if (NULL == msg || NULL == buffer || NULL == bufferLength)
         return MAMA_STATUS_NULL_ARG;
 
+    // Only part of the payload is in the buffer until the update is done
+    if (impl->isUpdating()) return MAMA_STATUS_INVALID_ARG;
+
+    // A single buffer has to hold everything
+    if (MAMA_STATUS_OK != impl->flatten())
+        return MAMA_STATUS_NOMEM;
+
     *buffer = impl->mPayloadBuffer;
     *bufferLength = impl->mPayloadBufferTail;
+
+    impl->recordShape();
     return MAMA_STATUS_OK;
 }
 
@@ -878,37 +2159,107 @@ omnmmsgPayload_unSerialize (const msgPayload    msg,
 
     if (NULL == msg || NULL == buffer || 0 == bufferLength)
         return MAMA_STATUS_NULL_ARG;
+    if (impl->mFrozen)
+        return MAMA_STATUS_NOT_MODIFIABLE;
 
     // New buffer incoming - check header for version compatibility
-    memcpy(&header, buffer, sizeof(header));
-    if (header.mWireFormatVersion > OMNM_PROTOCOL_VERSION)
+    mama_status status = OmnmPayloadImpl::readHeader (buffer, bufferLength, header);
+    if (MAMA_STATUS_OK != status)
     {
-        return MAMA_STATUS_WRONG_FIELD_TYPE;
+        return status;
     }
 
-    // Wipe current buffer
-    memset (impl->mPayloadBuffer, 0, impl->mPayloadBufferSize);
-
-    // Ensure buffer is big enough to hold
-    if (0 != allocateBufferMemory ((void**) &impl->mPayloadBuffer,
-                                   &impl->mPayloadBufferSize,
-                                   bufferLength))
+    // A borrowed buffer is either the caller's or shared with copies. The
+    // new contents may come from a shared one, so like ownBuffer this holds
+    // on to it until they have been read out of it.
+    omnmSharedBuffer* shared = impl->mShared;
+    impl->mShared = NULL;
+    impl->returnBorrowed();
+    impl->dropRefs();
+    impl->cancelBuilding();
+
+    // The new contents may come from the payload's own buffer, such as when
+    // it decodes what it serialized, so it mustn't be trimmed before they
+    // have been read out of it
+    const uint8_t* source  = (const uint8_t*) buffer;
+    bool           aliased = source >= impl->mPayloadBuffer
+                          && source < impl->mPayloadBuffer + impl->mPayloadBufferSize;
+    bool           trimmed = !aliased && impl->trimOnReuse();
+
+    // In view mode the payload reads straight from the caller's buffer, as
+    // long as it doesn't need converting to this host's byte order and isn't
+    // its own buffer (such as a sub message of it) that writes would clobber
+    if (impl->mViewMode && !aliased && !omnmmsgByteOrderImpl_needsSwap (header.mFlags))
     {
-        return MAMA_STATUS_NOMEM;
-    }
+        impl->recycleArena (trimmed);
+        impl->borrow ((const uint8_t*) buffer, bufferLength);
 
-    // Do not attempt self copy
-    if (impl->mPayloadBuffer != (void*)buffer)
+        // Still viewing the shared buffer, so still holding a reference
+        if (NULL != shared
+            && source >= shared->mBuffer && source < shared->mBuffer + shared->mSize)
+        {
+            impl->mShared = shared;
+            shared        = NULL;
+        }
+    }
+    else
     {
-        memcpy (impl->mPayloadBuffer, (void*)buffer, bufferLength);
+        // The current contents are about to be overwritten, so there is nothing
+        // worth carrying over if the buffer has to grow, unless they are what is
+        // being copied in. Only the bytes being copied in get touched - the
+        // rest of the buffer is left as it is.
+        if (!aliased)
+        {
+            impl->setTail (0);
+        }
+
+        // Ensure buffer is big enough to hold
+        if (MAMA_STATUS_OK != impl->ensureCapacity (bufferLength))
+        {
+            impl->clear();
+            OmnmPayloadImpl::releaseShared (shared);
+            return MAMA_STATUS_NOMEM;
+        }
+
+        // Do not attempt self copy, and move rather than copy anything from
+        // further along the same buffer, such as one of its sub messages
+        if (aliased && impl->mPayloadBuffer != (void*)buffer)
+        {
+            memmove (impl->mPayloadBuffer, (void*)buffer, bufferLength);
+        }
+        else if (!aliased)
+        {
+            memcpy (impl->mPayloadBuffer, (void*)buffer, bufferLength);
+        }
+
+        // Only now that the new contents are in (they may have come from one of
+        // the sub messages) can everything derived from the old ones go
+        impl->recycleArena (trimmed);
+        OmnmPayloadImpl::releaseShared (shared);
+
+        // Payloads from a host of the other byte order are converted once here
+        if (omnmmsgByteOrderImpl_needsSwap (header.mFlags))
+        {
+            status = omnmmsgByteOrderImpl_swapPayload (impl->mPayloadBuffer,
+                                                       bufferLength,
+                                                       OMNM_HOST_BYTE_ORDER_FLAG);
+            if (MAMA_STATUS_OK != status)
+            {
+                impl->clear();
+                return status;
+            }
+            header.mFlags = (mama_u8_t)((header.mFlags & ~OMNM_HEADER_FLAG_BYTE_ORDER_MASK)
+                                        | OMNM_HOST_BYTE_ORDER_FLAG);
+        }
     }
 
     // Parse the rest of the header for initialization
     impl->mHeader.mWireFormatVersion = header.mWireFormatVersion;
     impl->mHeader.mRemainingHeaderSize = header.mRemainingHeaderSize;
+    impl->mHeader.mFlags = header.mFlags;
 
     // Move tail to end of buffer
-    impl->mPayloadBufferTail = bufferLength;
+    impl->setTail (bufferLength);
 
     return MAMA_STATUS_OK;
 }
@@ -1169,6 +2520,9 @@ omnmmsgPayload_apply (msgPayload          dest,
             break;
         }
     }
+
+    // Sub messages fetched above hang off the iterator's field
+    omnmmsgFieldPayloadImpl_cleanup (&iter.mField);
     return MAMA_STATUS_OK;
 }
 
@@ -1396,7 +2750,7 @@ omnmmsgPayload_addMsg (msgPayload    msg,
         return status;
     }
 
-    status = omnmmsgPayload_serialize (payload, &buffer, &bufferLen);
+    status = serializeSubMsg (impl, payload, &buffer, &bufferLen);
     if (MAMA_STATUS_OK != status)
     {
         return status;
@@ -1547,12 +2901,16 @@ omnmmsgPayload_addVectorString (msgPayload          msg,
         bytesRequired += strlen(value[i]) + 1;
     }
 
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (&impl->mField);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
     // Ensure the buffer is big enough for this
-    allocateBufferMemory ((void**)&impl->mField.mBuffer,
-                          &impl->mField.mBufferLen,
-                          bytesRequired);
+    omnmmsgFieldPayloadImpl_growCache (&impl->mField,
+                                       (void**)&cache->mBuffer,
+                                       &cache->mBufferLen,
+                                       bytesRequired);
 
-    uint8_t* target = (uint8_t*)impl->mField.mBuffer;
+    uint8_t* target = (uint8_t*)cache->mBuffer;
     for (i = 0; i < size; i++)
     {
         size_t copyLen = strlen(value[i]) + 1;
@@ -1563,8 +2921,8 @@ omnmmsgPayload_addVectorString (msgPayload          msg,
     return ((OmnmPayloadImpl*) msg)->addField (MAMA_FIELD_TYPE_VECTOR_STRING,
                                                name,
                                                fid,
-                                               (uint8_t*)impl->mField.mBuffer,
-                                               impl->mField.mBufferLen);
+                                               (uint8_t*)cache->mBuffer,
+                                               cache->mBufferLen);
 }
 
 mama_status
@@ -1596,12 +2954,16 @@ omnmmsgPayloadImpl_updateVectorMsgPayload (msgPayload          msg,
         bytesRequired += msgSize + sizeof(mama_u32_t);
     }
 
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (&impl->mField);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
     // Ensure the buffer is big enough for this
-    allocateBufferMemory ((void**)&impl->mField.mBuffer,
-                          &impl->mField.mBufferLen,
-                          bytesRequired);
+    omnmmsgFieldPayloadImpl_growCache (&impl->mField,
+                                       (void**)&cache->mBuffer,
+                                       &cache->mBufferLen,
+                                       bytesRequired);
 
-    uint8_t* target = (uint8_t*)impl->mField.mBuffer;
+    uint8_t* target = (uint8_t*)cache->mBuffer;
     for (i = 0; i < size; i++)
     {
         const void* buffer = NULL;
@@ -1620,7 +2982,7 @@ omnmmsgPayloadImpl_updateVectorMsgPayload (msgPayload          msg,
     return ((OmnmPayloadImpl*) msg)->updateField (MAMA_FIELD_TYPE_VECTOR_MSG,
                                                   name,
                                                   fid,
-                                                  (uint8_t*)impl->mField.mBuffer,
+                                                  (uint8_t*)cache->mBuffer,
                                                   bytesRequired);
 }
 
@@ -1852,12 +3214,16 @@ omnmmsgPayload_updateVectorMsg (msgPayload          msg,
         bytesRequired += msgSize + sizeof(mama_u32_t);
     }
 
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (&impl->mField);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
     // Ensure the buffer is big enough for this
-    allocateBufferMemory ((void**)&impl->mField.mBuffer,
-                          &impl->mField.mBufferLen,
-                          bytesRequired);
+    omnmmsgFieldPayloadImpl_growCache (&impl->mField,
+                                       (void**)&cache->mBuffer,
+                                       &cache->mBufferLen,
+                                       bytesRequired);
 
-    uint8_t* target = (uint8_t*)impl->mField.mBuffer;
+    uint8_t* target = (uint8_t*)cache->mBuffer;
     for (i = 0; i < size; i++)
     {
         const void* buffer = NULL;
@@ -1876,7 +3242,7 @@ omnmmsgPayload_updateVectorMsg (msgPayload          msg,
     return ((OmnmPayloadImpl*) msg)->updateField (MAMA_FIELD_TYPE_VECTOR_MSG,
                                                   name,
                                                   fid,
-                                                  (uint8_t*)impl->mField.mBuffer,
+                                                  (uint8_t*)cache->mBuffer,
                                                   bytesRequired);
 }
 
@@ -1898,12 +3264,16 @@ omnmmsgPayload_updateVectorString (msgPayload   msg,
         bytesRequired += strlen(value[i]) + 1;
     }
 
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (&impl->mField);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
     // Ensure the buffer is big enough for this
-    allocateBufferMemory ((void**)&impl->mField.mBuffer,
-                          &impl->mField.mBufferLen,
-                          bytesRequired);
+    omnmmsgFieldPayloadImpl_growCache (&impl->mField,
+                                       (void**)&cache->mBuffer,
+                                       &cache->mBufferLen,
+                                       bytesRequired);
 
-    uint8_t* target = (uint8_t*)impl->mField.mBuffer;
+    uint8_t* target = (uint8_t*)cache->mBuffer;
     for (i = 0; i < size; i++)
     {
         size_t copyLen = strlen(value[i]) + 1;
@@ -1914,7 +3284,7 @@ omnmmsgPayload_updateVectorString (msgPayload   msg,
     return ((OmnmPayloadImpl*) msg)->updateField (MAMA_FIELD_TYPE_VECTOR_STRING,
                                                   name,
                                                   fid,
-                                                  (uint8_t*)impl->mField.mBuffer,
+                                                  (uint8_t*)cache->mBuffer,
                                                   bytesRequired);
 }
 
@@ -2051,12 +3421,16 @@ omnmmsgPayload_updateVectorPrice (msgPayload          msg,
     VALIDATE_NON_NULL(msg);
     VALIDATE_NON_NULL(value);
 
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (&impl->mField);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
     // Ensure the buffer is big enough for this
-    allocateBufferMemory((void**)&impl->mField.mBuffer,
-        &impl->mField.mBufferLen,
-        size * sizeof(omnmPrice));
+    omnmmsgFieldPayloadImpl_growCache (&impl->mField,
+                                       (void**)&cache->mBuffer,
+                                       &cache->mBufferLen,
+                                       size * sizeof(omnmPrice));
 
-    omnmPrice* prices = (omnmPrice*)impl->mField.mBuffer;
+    omnmPrice* prices = (omnmPrice*)cache->mBuffer;
     for (i = 0; i < size; i++)
     {
         OmnmPayloadImpl::convertMamaPriceToOmnmPrice(value[i], &prices[i]);
@@ -2065,7 +3439,7 @@ omnmmsgPayload_updateVectorPrice (msgPayload          msg,
     return ((OmnmPayloadImpl*)msg)->updateField(MAMA_FIELD_TYPE_VECTOR_PRICE,
         name,
         fid,
-        (uint8_t*)impl->mField.mBuffer,
+        (uint8_t*)cache->mBuffer,
         size * sizeof(omnmPrice));
 }
 
@@ -2082,12 +3456,16 @@ omnmmsgPayload_updateVectorTime (msgPayload          msg,
     VALIDATE_NON_NULL(msg);
     VALIDATE_NON_NULL(value);
 
+    omnmFieldCache* cache = omnmmsgFieldPayloadImpl_getCache (&impl->mField);
+    if (NULL == cache) return MAMA_STATUS_NOMEM;
+
     // Ensure the buffer is big enough for this
-    allocateBufferMemory((void**)&impl->mField.mBuffer,
-        &impl->mField.mBufferLen,
-        size * sizeof(omnmDateTime));
+    omnmmsgFieldPayloadImpl_growCache (&impl->mField,
+                                       (void**)&cache->mBuffer,
+                                       &cache->mBufferLen,
+                                       size * sizeof(omnmDateTime));
 
-    omnmDateTime* dateTimes = (omnmDateTime*)impl->mField.mBuffer;
+    omnmDateTime* dateTimes = (omnmDateTime*)cache->mBuffer;
     for (i = 0; i < size; i++)
     {
         OmnmPayloadImpl::convertMamaDateTimeToOmnmDateTime(value[i], &dateTimes[i]);
@@ -2096,7 +3474,7 @@ omnmmsgPayload_updateVectorTime (msgPayload          msg,
     return ((OmnmPayloadImpl*)msg)->updateField(MAMA_FIELD_TYPE_VECTOR_TIME,
         name,
         fid,
-        (uint8_t*)impl->mField.mBuffer,
+        (uint8_t*)cache->mBuffer,
         size * sizeof(omnmDateTime));
 }
 
@@ -2529,3 +3907,485 @@ omnmmsgPayloadImpl_getExtenderClosure (msgPayload msg, const void** closure)
     *closure = ((OmnmPayloadImpl*) msg)->mExtenderClosure;
     return MAMA_STATUS_OK;
 }
+
+mama_status
+omnmmsgPayloadImpl_createWithAllocator (msgPayload*           msg,
+                                        const omnmAllocator*  allocator)
+{
+    if (NULL == msg || NULL == allocator) return MAMA_STATUS_NULL_ARG;
+
+    // Reuse a payload (and whatever buffer it has grown) where possible. Only
+    // payloads on the bridge wide allocator are pooled.
+    OmnmPayloadImpl* impl = NULL;
+    if (allocator == omnmmsgAllocatorImpl_getDefault ())
+    {
+        impl = omnmmsgPayloadPoolImpl_acquire (allocator);
+    }
+    if (NULL == impl)
+    {
+        impl = OmnmPayloadImpl::allocate (allocator);
+        if (NULL == impl)
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+        omnmmsgPayloadPoolImpl_attach (impl);
+    }
+
+    *msg = (msgPayload) impl;
+
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_createForShape (msgPayload* msg, mama_u64_t shapeKey)
+{
+    mama_status status = omnmmsgPayload_create (msg);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) *msg;
+    impl->mShapeKey = shapeKey;
+
+    // Size the buffer for what this shape needed last time, if anything.
+    // Failing here just means growing later.
+    impl->reserve (omnmmsgShapeImpl_lookup (shapeKey));
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_createForSubject (msgPayload* msg, const char* subject)
+{
+    if (NULL == msg || NULL == subject) return MAMA_STATUS_NULL_ARG;
+    return omnmmsgPayloadImpl_createForShape (
+            msg, omnmmsgShapeImpl_keyForSubject (subject));
+}
+
+mama_status
+omnmmsgPayloadImpl_reserve (msgPayload msg, mama_size_t bytes)
+{
+    if (NULL == msg) return MAMA_STATUS_NULL_ARG;
+    return ((OmnmPayloadImpl*) msg)->reserve (bytes);
+}
+
+mama_status
+omnmmsgPayloadImpl_setTrimPolicy (const omnmPayloadTrimPolicy* policy)
+{
+    if (NULL == policy) return MAMA_STATUS_NULL_ARG;
+    gTrimTargetCapacity.store (policy->mTargetCapacity, std::memory_order_relaxed);
+    gTrimSmallUses.store (policy->mSmallUses, std::memory_order_relaxed);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_getTrimPolicy (omnmPayloadTrimPolicy* policy)
+{
+    if (NULL == policy) return MAMA_STATUS_NULL_ARG;
+    policy->mTargetCapacity = gTrimTargetCapacity.load (std::memory_order_relaxed);
+    policy->mSmallUses      = gTrimSmallUses.load (std::memory_order_relaxed);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_setPayloadTrimPolicy (msgPayload                    msg,
+                                         const omnmPayloadTrimPolicy*  policy)
+{
+    if (NULL == msg) return MAMA_STATUS_NULL_ARG;
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) msg;
+    if (NULL != policy)
+    {
+        if (NULL == impl->getModes()) return MAMA_STATUS_NOMEM;
+        impl->mModes->mTrimPolicy    = *policy;
+        impl->mModes->mOwnTrimPolicy = true;
+    }
+    else if (NULL != impl->mModes)
+    {
+        impl->mModes->mOwnTrimPolicy = false;
+    }
+    impl->mSmallUses = 0;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_shrinkToFit (msgPayload msg)
+{
+    if (NULL == msg) return MAMA_STATUS_NULL_ARG;
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) msg;
+    impl->shrinkCapacity (impl->mPayloadBufferTail);
+    omnmmsgFieldPayloadImpl_cleanup (&impl->mField);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_setViewMode (msgPayload msg, int enabled)
+{
+    if (NULL == msg) return MAMA_STATUS_NULL_ARG;
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) msg;
+    if (impl->mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+    impl->mViewMode = (0 != enabled);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_createView (msgPayload*  msg,
+                               const void*  buffer,
+                               mama_size_t  bufferLength)
+{
+    if (NULL == msg || NULL == buffer) return MAMA_STATUS_NULL_ARG;
+    if (0 == bufferLength) return MAMA_STATUS_INVALID_ARG;
+
+    mama_status status = omnmmsgPayload_create (msg);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    ((OmnmPayloadImpl*) *msg)->mViewMode = true;
+
+    status = omnmmsgPayload_unSerialize (*msg, buffer, bufferLength);
+    if (MAMA_STATUS_OK != status)
+    {
+        omnmmsgPayload_destroy (*msg);
+        *msg = NULL;
+    }
+    return status;
+}
+
+mama_status
+omnmmsgPayloadImpl_detachBuffer (msgPayload          msg,
+                                 void**              buffer,
+                                 mama_size_t*        bufferLength,
+                                 omnmBufferFreeFunc* freeFunc,
+                                 void**              closure)
+{
+    if (NULL == msg || NULL == buffer || NULL == bufferLength
+        || NULL == freeFunc || NULL == closure)
+    {
+        return MAMA_STATUS_NULL_ARG;
+    }
+    OmnmPayloadImpl* impl   = (OmnmPayloadImpl*) msg;
+    size_t           length = 0;
+
+    mama_status status = impl->detachBuffer ((uint8_t**) buffer, &length);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    *bufferLength = length;
+    *freeFunc     = impl->mAllocator->mFree;
+    *closure      = impl->mAllocator->mClosure;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_adoptBuffer (msgPayload   msg,
+                                void*        buffer,
+                                mama_size_t  bufferLength,
+                                mama_size_t  bufferCapacity)
+{
+    if (NULL == msg || NULL == buffer) return MAMA_STATUS_NULL_ARG;
+    if (0 == bufferLength) return MAMA_STATUS_INVALID_ARG;
+    return ((OmnmPayloadImpl*) msg)->adoptBuffer ((uint8_t*) buffer,
+                                                  bufferLength,
+                                                  bufferCapacity);
+}
+
+mama_status
+omnmmsgPayloadImpl_attachBuffer (msgPayload             msg,
+                                 void*                  region,
+                                 mama_size_t            capacity,
+                                 omnmBufferOverflowFunc overflow,
+                                 void*                  closure)
+{
+    if (NULL == msg || NULL == region) return MAMA_STATUS_NULL_ARG;
+    if (capacity < sizeof(omnmHeader)) return MAMA_STATUS_INVALID_ARG;
+
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) msg;
+    if (impl->mFrozen) return MAMA_STATUS_NOT_MODIFIABLE;
+
+    // Clearing once attached writes the header into the region
+    mama_status status = impl->attach ((uint8_t*) region, capacity, overflow, closure);
+    if (MAMA_STATUS_OK != status)
+    {
+        return status;
+    }
+    return impl->clear();
+}
+
+mama_status
+omnmmsgPayloadImpl_finishBuffer (msgPayload    msg,
+                                 void**        region,
+                                 mama_size_t*  bufferLength)
+{
+    if (NULL == msg || NULL == region || NULL == bufferLength)
+        return MAMA_STATUS_NULL_ARG;
+
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) msg;
+    if (!impl->mExternal) return MAMA_STATUS_INVALID_ARG;
+    if (MAMA_STATUS_OK != impl->flatten()) return MAMA_STATUS_NOMEM;
+
+    *region       = impl->mPayloadBuffer;
+    *bufferLength = impl->mPayloadBufferTail;
+
+    impl->recordShape();
+
+    impl->returnBorrowed();
+    return impl->clear();
+}
+
+mama_status
+omnmmsgPayloadImpl_addOpaqueRef (msgPayload   msg,
+                                 const char*  name,
+                                 mama_fid_t   fid,
+                                 const void*  value,
+                                 mama_size_t  size)
+{
+    if (NULL == msg || NULL == value) return MAMA_STATUS_NULL_ARG;
+    return ((OmnmPayloadImpl*) msg)->addFieldRef (MAMA_FIELD_TYPE_OPAQUE,
+                                                  name,
+                                                  fid,
+                                                  (const uint8_t*) value,
+                                                  size);
+}
+
+mama_status
+omnmmsgPayloadImpl_addVectorRef (msgPayload     msg,
+                                 const char*    name,
+                                 mama_fid_t     fid,
+                                 mamaFieldType  type,
+                                 const void*    elements,
+                                 mama_size_t    count)
+{
+    size_t width = 0;
+
+    if (NULL == msg || NULL == elements) return MAMA_STATUS_NULL_ARG;
+
+    switch (type)
+    {
+    case MAMA_FIELD_TYPE_VECTOR_BOOL: width = sizeof(mama_bool_t); break;
+    case MAMA_FIELD_TYPE_VECTOR_CHAR: width = sizeof(char);        break;
+    case MAMA_FIELD_TYPE_VECTOR_I8:   width = sizeof(mama_i8_t);   break;
+    case MAMA_FIELD_TYPE_VECTOR_U8:   width = sizeof(mama_u8_t);   break;
+    case MAMA_FIELD_TYPE_VECTOR_I16:  width = sizeof(mama_i16_t);  break;
+    case MAMA_FIELD_TYPE_VECTOR_U16:  width = sizeof(mama_u16_t);  break;
+    case MAMA_FIELD_TYPE_VECTOR_I32:  width = sizeof(mama_i32_t);  break;
+    case MAMA_FIELD_TYPE_VECTOR_U32:  width = sizeof(mama_u32_t);  break;
+    case MAMA_FIELD_TYPE_VECTOR_I64:  width = sizeof(mama_i64_t);  break;
+    case MAMA_FIELD_TYPE_VECTOR_U64:  width = sizeof(mama_u64_t);  break;
+    case MAMA_FIELD_TYPE_VECTOR_F32:  width = sizeof(mama_f32_t);  break;
+    case MAMA_FIELD_TYPE_VECTOR_F64:  width = sizeof(mama_f64_t);  break;
+    default:
+        return MAMA_STATUS_WRONG_FIELD_TYPE;
+    }
+
+    return ((OmnmPayloadImpl*) msg)->addFieldRef (type,
+                                                  name,
+                                                  fid,
+                                                  (const uint8_t*) elements,
+                                                  count * width);
+}
+
+#if !defined(_WIN32)
+static_assert (sizeof(omnmIoVec) == sizeof(struct iovec)
+               && offsetof(omnmIoVec, mBase) == offsetof(struct iovec, iov_base)
+               && offsetof(omnmIoVec, mLength) == offsetof(struct iovec, iov_len),
+               "omnmIoVec must match struct iovec");
+#endif
+
+mama_status
+omnmmsgPayloadImpl_serializeSegments (msgPayload    msg,
+                                      omnmIoVec*    segments,
+                                      mama_u32_t*   count,
+                                      mama_size_t*  bufferLength)
+{
+    if (NULL == msg || NULL == segments || NULL == count || NULL == bufferLength)
+        return MAMA_STATUS_NULL_ARG;
+
+    // Each body follows a piece of the buffer, and whatever comes after the
+    // last one (if anything) makes one more
+    OmnmPayloadImpl*    impl     = (OmnmPayloadImpl*) msg;
+    if (impl->isUpdating()) return MAMA_STATUS_INVALID_ARG;
+    const omnmFieldRef* refs     = impl->hasRefs() ? impl->mModes->mRefs : NULL;
+    mama_u32_t          refCount = impl->hasRefs() ? impl->mModes->mRefCount : 0;
+    mama_u32_t          needed   = 2 * refCount;
+    if (0 == refCount || refs[refCount - 1].mOffset < impl->mPayloadBufferTail)
+    {
+        needed++;
+    }
+    if (needed > *count)
+    {
+        *count = needed;
+        return MAMA_STATUS_INVALID_ARG;
+    }
+
+    size_t     start = 0;
+    mama_u32_t used  = 0;
+    for (mama_u32_t i = 0; i < refCount; i++)
+    {
+        const omnmFieldRef& ref = refs[i];
+        segments[used].mBase   = impl->mPayloadBuffer + start;
+        segments[used].mLength = ref.mOffset - start;
+        used++;
+        segments[used].mBase   = ref.mData;
+        segments[used].mLength = ref.mSize;
+        used++;
+        start = ref.mOffset;
+    }
+    if (0 == used || start < impl->mPayloadBufferTail)
+    {
+        segments[used].mBase   = impl->mPayloadBuffer + start;
+        segments[used].mLength = impl->mPayloadBufferTail - start;
+        used++;
+    }
+    *count        = used;
+    *bufferLength = impl->mPayloadBufferTail + impl->getRefBytes();
+
+    impl->recordShape();
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_flatten (msgPayload msg)
+{
+    if (NULL == msg) return MAMA_STATUS_NULL_ARG;
+    return ((OmnmPayloadImpl*) msg)->flatten();
+}
+
+mama_status
+omnmmsgPayloadImpl_beginSubMsg (msgPayload   msg,
+                                const char*  name,
+                                mama_fid_t   fid,
+                                msgPayload*  child)
+{
+    if (NULL == msg || NULL == child) return MAMA_STATUS_NULL_ARG;
+    return ((OmnmPayloadImpl*) msg)->beginSubMsg (name, fid, (OmnmPayloadImpl**) child);
+}
+
+mama_status
+omnmmsgPayloadImpl_beginSubMsgUpdate (msgPayload   msg,
+                                      const char*  name,
+                                      mama_fid_t   fid,
+                                      msgPayload*  child)
+{
+    if (NULL == msg || NULL == child) return MAMA_STATUS_NULL_ARG;
+    return ((OmnmPayloadImpl*) msg)->beginSubMsgUpdate (name, fid, (OmnmPayloadImpl**) child);
+}
+
+mama_status
+omnmmsgPayloadImpl_endSubMsg (msgPayload msg)
+{
+    if (NULL == msg) return MAMA_STATUS_NULL_ARG;
+    return ((OmnmPayloadImpl*) msg)->endSubMsg();
+}
+
+mama_status
+omnmmsgPayloadImpl_beginVectorMsg (msgPayload   msg,
+                                   const char*  name,
+                                   mama_fid_t   fid)
+{
+    if (NULL == msg) return MAMA_STATUS_NULL_ARG;
+    return ((OmnmPayloadImpl*) msg)->beginVectorMsg (name, fid);
+}
+
+mama_status
+omnmmsgPayloadImpl_beginVectorMsgElement (msgPayload   msg,
+                                          msgPayload*  child)
+{
+    if (NULL == msg || NULL == child) return MAMA_STATUS_NULL_ARG;
+    return ((OmnmPayloadImpl*) msg)->beginVectorMsgElement ((OmnmPayloadImpl**) child);
+}
+
+mama_status
+omnmmsgPayloadImpl_endVectorMsg (msgPayload msg)
+{
+    if (NULL == msg) return MAMA_STATUS_NULL_ARG;
+    return ((OmnmPayloadImpl*) msg)->endVectorMsg();
+}
+
+mama_status
+omnmmsgPayloadImpl_getNode (msgPayload msg, int* node)
+{
+    if (NULL == msg || NULL == node) return MAMA_STATUS_NULL_ARG;
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) msg;
+    *node = omnmmsgNumaImpl_getNodeOfAddress (impl->mPayloadBuffer);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_freeze (msgPayload* msg)
+{
+    if (NULL == msg || NULL == *msg) return MAMA_STATUS_NULL_ARG;
+
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) *msg;
+    if (impl->mFrozen)
+    {
+        return MAMA_STATUS_OK;
+    }
+    if (MAMA_STATUS_OK != impl->flatten())
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+
+    OmnmPayloadImpl* frozen = OmnmPayloadImpl::allocateFrozen (impl->mAllocator,
+                                                               impl->mPayloadBuffer,
+                                                               impl->mPayloadBufferTail);
+    if (NULL == frozen)
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    frozen->mHeader          = impl->mHeader;
+    frozen->mParent          = impl->mParent;
+    frozen->mExtenderClosure = impl->mExtenderClosure;
+
+    omnmmsgPayload_destroy (*msg);
+    *msg = (msgPayload) frozen;
+
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_thaw (msgPayload* msg)
+{
+    if (NULL == msg || NULL == *msg) return MAMA_STATUS_NULL_ARG;
+
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) *msg;
+    if (!impl->mFrozen)
+    {
+        return MAMA_STATUS_OK;
+    }
+
+    msgPayload  thawed = NULL;
+    mama_status status = omnmmsgPayload_copy (*msg, &thawed);
+    if (MAMA_STATUS_OK != status)
+    {
+        if (NULL != thawed)
+        {
+            omnmmsgPayload_destroy (thawed);
+        }
+        return status;
+    }
+    ((OmnmPayloadImpl*) thawed)->mParent          = impl->mParent;
+    ((OmnmPayloadImpl*) thawed)->mExtenderClosure = impl->mExtenderClosure;
+
+    omnmmsgPayload_destroy (*msg);
+    *msg = thawed;
+
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_swapByteOrder (void* buffer, mama_size_t bufferLength)
+{
+    if (nullptr == buffer) return MAMA_STATUS_NULL_ARG;
+    if (bufferLength <= sizeof(omnmHeaderV1)) return MAMA_STATUS_INVALID_ARG;
+
+    const omnmHeader* header = (const omnmHeader*) buffer;
+    if (0 == header->mRemainingHeaderSize) return MAMA_STATUS_INVALID_ARG;
+
+    mama_u8_t current = header->mFlags & OMNM_HEADER_FLAG_BYTE_ORDER_MASK;
+    if (0 == current) return MAMA_STATUS_INVALID_ARG;
+
+    return omnmmsgByteOrderImpl_swapPayload ((uint8_t*) buffer,
+                                             bufferLength,
+                                             current ^ OMNM_HEADER_FLAG_BYTE_ORDER_MASK);
+}
@@ -25,12 +25,24 @@
 #ifndef MAMA_BRIDGE_OMNM_MSG_PAYLOAD_H__
 #define MAMA_BRIDGE_OMNM_MSG_PAYLOAD_H__
 
+#include <atomic>
 #include <mama/mama.h>
 #include <mama/price.h>
 #include <wombat/strutils.h>
 #include <mama/integration/types.h>
 
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+#include "Arena.h"
+#include "Accounting.h"
+
 class OmnmPayloadImpl;
+class OmnmPayloadPool;
+
+// Number of payload buffer bytes allocated along with the payload object. The
+// buffer only spills over to the heap once a payload outgrows this.
+#ifndef OMNM_INLINE_BUFFER_SIZE
+#define OMNM_INLINE_BUFFER_SIZE 200
+#endif
 
 #define VALIDATE_MAMA_STATUS_OK(STATUS)                                        \
 do                                                                             \
@@ -55,15 +67,13 @@ do                                                                             \
         return MAMA_STATUS_NULL_ARG;                                           \
 } while (0)
 
-typedef struct omnmFieldImpl
+/*
+ * Scratch objects handed out by the vector, sub message and string getters.
+ * Most fields are only ever read as scalars, so this lives outside of
+ * omnmFieldImpl and is allocated the first time a getter needs it.
+ */
+typedef struct omnmFieldCache
 {
-    mamaFieldType       mFieldType;
-    mama_fid_t          mFid;
-    const char*         mName;
-    size_t              mSize;
-    void*               mData; /* never alloc'ed memory - always reference */
-    OmnmPayloadImpl*    mParent;
-    /* Complex data type elements below */
     void*               mBuffer; /* Reusable buffer for temporary data */
     mama_size_t         mBufferLen; /* Reusable buffer for temporary data */
     msgPayload          mSubPayload;
@@ -75,8 +85,93 @@ typedef struct omnmFieldImpl
     mama_size_t         mVectorDateTimeLen;
     mamaPrice*          mVectorPrice;
     mama_size_t         mVectorPriceLen;
+    mama_u64_t          mArenaEpoch; /* Of the arena the sub-payloads came from */
+    omnmArenaRef*       mArenaRef;   /* Which they are handed back to */
+} omnmFieldCache;
+
+typedef struct omnmFieldImpl
+{
+    mamaFieldType       mFieldType;
+    mama_fid_t          mFid;
+    const char*         mName;
+    size_t              mSize;
+    void*               mData; /* never alloc'ed memory - always reference */
+    OmnmPayloadImpl*    mParent;
+    omnmFieldCache*     mCache; /* NULL until a complex getter needs it */
+    const omnmAllocator* mAllocator; /* Used for the cache - NULL means heap */
 } omnmFieldImpl;
 
+/*
+ * The body of a field added by reference. It is left in the caller's memory
+ * rather than copied in, so the payload buffer holds the field's header and
+ * size with the next field following straight on from mOffset.
+ */
+typedef struct omnmFieldRef
+{
+    size_t      mOffset; /* where the body belongs in the serialized buffer */
+    const void* mData;
+    size_t      mSize;
+    mama_fid_t  mFid;
+} omnmFieldRef;
+
+/*
+ * A buffer shared between a payload and its copies, which all read it as a
+ * view until they first write. Freed by whichever lets go of it last, on
+ * whichever thread that happens to be.
+ */
+typedef struct omnmSharedBuffer
+{
+    std::atomic<mama_u32_t> mRefs;
+    const omnmAllocator*    mAllocator;
+    uint8_t*                mBuffer;
+    size_t                  mSize;
+} omnmSharedBuffer;
+
+/*
+ * State only needed by payloads used in one of the less common ways: built
+ * into an external region or in place, holding fields by reference, or with
+ * a trim policy of their own. Allocated on first use and kept until the
+ * payload is destroyed, which keeps it out of the payload object, so that
+ * frozen payloads and sub-message views cost little more than their buffer.
+ */
+typedef struct omnmPayloadModes
+{
+    // Where an external region grows to once it is full
+    omnmBufferOverflowFunc  mOverflow;
+    void*                   mOverflowClosure;
+
+    // Field bodies held by reference, in buffer order, and their total size
+    omnmFieldRef*           mRefs;
+    mama_u32_t              mRefCount;
+    mama_u32_t              mRefCapacity;
+    size_t                  mRefBytes;
+
+    // Child used to build sub-messages in place, allocated on first use
+    OmnmPayloadImpl*        mBuilder;
+
+    // Set on a child while it is open: the payload it is building in, where
+    // in that payload's buffer its length goes, and the parent's tail when
+    // it was opened, which it must still be when it is finished
+    OmnmPayloadImpl*        mBuilderParent;
+    size_t                  mBuilderLengthOffset;
+    size_t                  mBuilderParentTail;
+
+    // Set while the sub-message open is one opened for update, and the
+    // fields following it, set aside until it is finished. The buffer is
+    // kept to be reused for the next one.
+    bool                    mUpdating;
+    uint8_t*                mParked;
+    size_t                  mParkedSize;
+    size_t                  mParkedCapacity;
+
+    // Where the length of a vector of messages being built goes, or 0
+    size_t                  mVectorLengthOffset;
+
+    // Trim policy of this payload, if it doesn't follow the global one
+    omnmPayloadTrimPolicy   mTrimPolicy;
+    bool                    mOwnTrimPolicy;
+} omnmPayloadModes;
+
 typedef struct omnmDateTime
 {
     mama_u8_t  mHints;             /* Contains more information on how to parse */
@@ -99,21 +194,73 @@ typedef struct omnmPrice
  * byte[2]  = Remaining Header Bytes
  * byte[3+] = Header struct
  */
+#define MAMA_PAYLOAD_ID_OMNM    'O'
+
 typedef struct omnmHeaderV1
 {
     mama_u8_t  mType;
     mama_u8_t  mWireFormatVersion;
-    mama_u8_t  mRemainingHeaderSize; /* Always 0 in this version */
+    mama_u8_t  mRemainingHeaderSize; /* Header bytes following this struct */
 } omnmHeaderV1;
 
-// The header type is defined as a V1 header
-typedef omnmHeaderV1 omnmHeader;
+/*
+ * Bits of the flags byte which follows the V1 header. Readers which predate
+ * it skip it using mRemainingHeaderSize. A payload which declares no byte
+ * order is read in host order, as it always was.
+ */
+#define OMNM_HEADER_FLAG_LITTLE_ENDIAN      0x01
+#define OMNM_HEADER_FLAG_BIG_ENDIAN         0x02
+#define OMNM_HEADER_FLAG_BYTE_ORDER_MASK    0x03
+
+typedef struct omnmHeaderV1Flags
+{
+    mama_u8_t  mType;
+    mama_u8_t  mWireFormatVersion;
+    mama_u8_t  mRemainingHeaderSize; /* 1 when written by this version */
+    mama_u8_t  mFlags;               /* OMNM_HEADER_FLAG_* */
+} omnmHeaderV1Flags;
+
+// The header type is defined as a V1 header followed by a flags byte
+typedef omnmHeaderV1Flags omnmHeader;
 
 class OmnmPayloadImpl {
 public:
-    OmnmPayloadImpl();
+    // The inline buffer is memory of the caller's, normally allocated just
+    // after the payload object (see construct)
+    OmnmPayloadImpl(const omnmAllocator* allocator,
+                    uint8_t*             inlineBuffer,
+                    size_t               inlineCapacity);
     ~OmnmPayloadImpl();
 
+    // Construct / destroy a payload in memory taken from the given allocator
+    static OmnmPayloadImpl*
+    allocate (const omnmAllocator* allocator);
+
+    static void
+    deallocate (OmnmPayloadImpl* impl);
+
+    // Bytes needed for a payload whose inline buffer holds exactly this
+    // many bytes, following the payload object
+    static size_t
+    getAllocationSize (size_t inlineCapacity);
+
+    // Construct a payload in memory of getAllocationSize(inlineCapacity)
+    // bytes, with the rest of the memory as its inline buffer. It spills
+    // over to the heap like any other once it outgrows that.
+    static OmnmPayloadImpl*
+    construct (void* memory, const omnmAllocator* allocator, size_t inlineCapacity);
+
+    // Construct a frozen payload holding a copy of this buffer. Its inline
+    // buffer is allocated to exactly the buffer's length and may never grow.
+    static OmnmPayloadImpl*
+    allocateFrozen (const omnmAllocator* allocator,
+                    const uint8_t*       buffer,
+                    size_t               bufferLength);
+
+    // The buffer may point into the object itself, so it cannot be copied
+    OmnmPayloadImpl(const OmnmPayloadImpl&) = delete;
+    OmnmPayloadImpl& operator=(const OmnmPayloadImpl&) = delete;
+
     // Templatized function for casting buffers to data types by lookup
     // Receives type, fid and name as an argument and returns pointer to data
     // Contains typs as additional thing that may possibly be verified. Might
@@ -289,6 +436,55 @@ public:
                  uint8_t*       buffer,
                  size_t         bufferLen);
 
+    // Add payload field whose body stays in the caller's memory until the
+    // payload is flattened. Only sized types can be added this way.
+    mama_status
+    addFieldRef (mamaFieldType  type,
+                 const char*    name,
+                 mama_fid_t     fid,
+                 const uint8_t* buffer,
+                 size_t         bufferLen);
+
+    // True while any field bodies are held by reference
+    bool
+    hasRefs () const { return NULL != mModes && 0 != mModes->mRefCount; }
+
+    // Total size of the field bodies held by reference
+    size_t
+    getRefBytes () const { return NULL == mModes ? 0 : mModes->mRefBytes; }
+
+    // Copy every field body held by reference into the buffer, so that it
+    // holds the whole serialized payload
+    mama_status
+    flatten ();
+
+    // Where something in the payload will be once it has been flattened.
+    // Field bodies held by reference are told apart by their fid and size.
+    size_t
+    getFlattenedOffset (const void* data, mama_fid_t fid, size_t size) const;
+
+    // The payload is complete, so remember how big its shape turned out,
+    // counting any field bodies still held by reference
+    void
+    recordShape () const;
+
+    // Forget the field bodies held by reference, as when the fields
+    // themselves have gone
+    void
+    dropRefs ()
+    {
+        if (NULL != mModes)
+        {
+            mModes->mRefCount = 0;
+            mModes->mRefBytes = 0;
+        }
+    }
+
+    // The less commonly used state, allocated on first use. NULL if the
+    // allocator fails.
+    omnmPayloadModes*
+    getModes ();
+
     // Update payload field according to the type and values provided
     mama_status
     updateField (mamaFieldType   type,
@@ -330,13 +526,187 @@ public:
     mama_status
     clear ();
 
+    // Return the payload to its freshly constructed state without touching
+    // the rest of the buffer. Used when a pooled payload is handed out again.
+    void
+    reset ();
+
+    // Drop any heap buffer and go back to the inline one. The contents are
+    // lost, so this must be followed by clear() or reset().
+    void
+    releaseHeapBuffer ();
+
+    // Undo warmPool's locking of the heap buffer, which is about to be freed
+    // or to stop being this payload's
+    void
+    unlockBuffer ();
+
     // Get the number of bytes in the current header
     uint16_t
     getHeaderSize();
 
+    // Make sure the buffer can hold at least this many bytes, spilling the
+    // inline buffer over to the heap if required. Grows geometrically.
+    mama_status
+    ensureCapacity (size_t capacity);
+
+    // As ensureCapacity, but grows to exactly the requested capacity
+    mama_status
+    reserve (size_t capacity);
+
+    // Shrink the buffer towards this capacity, though never below what the
+    // current contents need. Moves back into the inline buffer if possible.
+    void
+    shrinkCapacity (size_t capacity);
+
+    // Called whenever the payload is about to be reused for a new message
+    // to apply the trim policy. Returns true if it trimmed the payload.
+    bool
+    trimOnReuse ();
+
+    // Destroy everything the getters handed out from the arena, handing its
+    // memory back too if the payload has just been trimmed
+    void
+    recycleArena (bool trimmed);
+
+    // True while the payload is still held in the inline buffer
+    bool
+    isBufferInline () const { return mPayloadBuffer == mInlineBuffer; }
+
+    // True while the payload is held in a buffer it doesn't own, either as
+    // a view or attached to an external region
+    bool
+    isBorrowed () const { return NULL != mOwnedBuffer; }
+
+    // True while the payload is a read only view of a buffer
+    bool
+    isView () const { return isBorrowed() && !mExternal; }
+
+    // Point at the caller's buffer for reads instead of copying it, parking
+    // the payload's own buffer until it is needed again
+    void
+    borrow (const uint8_t* buffer, size_t length);
+
+    // Copy the borrowed contents into the payload's own buffer, so that it
+    // can be modified. Does nothing unless the payload is a view.
+    mama_status
+    ownBuffer ();
+
+    // True if copies can share this payload's buffer rather than copy it
+    bool
+    isShareable () const;
+
+    // Make copy a view of this payload's buffer, which both then share
+    mama_status
+    share (OmnmPayloadImpl* copy);
+
+    // Let go of one reference to a shared buffer, freeing it if it was the last
+    static void
+    releaseShared (omnmSharedBuffer* shared);
+
+    // Build into an external region from now on, starting with an empty
+    // payload. Growing past its capacity goes through overflow.
+    mama_status
+    attach (uint8_t*               region,
+            size_t                 capacity,
+            omnmBufferOverflowFunc overflow,
+            void*                  closure);
+
+    // Ask the overflow callback for a region of at least capacity bytes, or
+    // grow the parent if this is a sub-message being built inside it
+    mama_status
+    growExternal (size_t capacity);
+
+    // Build a sub-message in place at the tail of the buffer. The child is
+    // owned by this payload and is reused for every sub-message built.
+    mama_status
+    beginSubMsg (const char* name, mama_fid_t fid, OmnmPayloadImpl** child);
+
+    // Open an existing sub-message for modification in place. Whatever
+    // follows it is set aside until it is finished.
+    mama_status
+    beginSubMsgUpdate (const char* name, mama_fid_t fid, OmnmPayloadImpl** child);
+
+    // Finish the sub-message or vector element most recently begun
+    mama_status
+    endSubMsg ();
+
+    // Build a vector of messages in place, an element at a time
+    mama_status
+    beginVectorMsg (const char* name, mama_fid_t fid);
+
+    mama_status
+    beginVectorMsgElement (OmnmPayloadImpl** child);
+
+    mama_status
+    endVectorMsg ();
+
+    // True while a sub-message is being built in place
+    bool
+    isBuilding () const
+    {
+        return NULL != mModes && NULL != mModes->mBuilder
+            && this == mModes->mBuilder->getBuilderParent();
+    }
+
+    // True while a sub-message is open for update, when the parent holds
+    // neither it nor the fields after it whole
+    bool
+    isUpdating () const { return isBuilding() && mModes->mUpdating; }
+
+    // True while a vector of messages is being built in place
+    bool
+    isBuildingVector () const { return NULL != mModes && 0 != mModes->mVectorLengthOffset; }
+
+    // The payload this is a child being built in, or NULL
+    OmnmPayloadImpl*
+    getBuilderParent () const { return NULL == mModes ? NULL : mModes->mBuilderParent; }
+
+    // Abandon anything being built in place, as when the payload is emptied
+    void
+    cancelBuilding ();
+
+    // Fill in the header this version writes
+    static void
+    initHeader (omnmHeader& header);
+
+    // Go back to the payload's own buffer without copying anything, leaving
+    // it empty. Does nothing if the payload isn't borrowing.
+    void
+    returnBorrowed ();
+
+    // Hand the serialized contents over in a buffer from mAllocator, which
+    // the caller then frees. The payload is left empty with a buffer of its
+    // own of the same capacity where that can be had.
+    mama_status
+    detachBuffer (uint8_t** buffer, size_t* bufferLength);
+
+    // Take over a serialized buffer from mAllocator holding bufferLength
+    // bytes out of bufferCapacity, without copying it. The buffer stays the
+    // caller's if this fails.
+    mama_status
+    adoptBuffer (uint8_t* buffer, size_t bufferLength, size_t bufferCapacity);
+
+    // Check a serialized buffer's header can be read by this version and
+    // copy it out
+    static mama_status
+    readHeader (const void* buffer, size_t bufferLength, omnmHeader& header);
+
+    // Move the tail, keeping the memory gauges in step
+    void
+    setTail (size_t tail)
+    {
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_USED,
+                                   (int64_t) tail - (int64_t) mPayloadBufferTail);
+        mPayloadBufferTail = tail;
+    }
+
    mama_status
    updateSubMsg (msgPayload msg, const char* name, mama_fid_t fid, const msgPayload value);
 
+   mama_status
+   updateSubMsg (omnmFieldImpl& field, const msgPayload value);
+
 
     // Underlying buffer to store the payload
     uint8_t*      mPayloadBuffer;
@@ -348,25 +718,121 @@ public:
     // the free space in the remaining buffer lives
     size_t        mPayloadBufferTail;
 
-    // Reusable field to use during payload interface crud operations
-    omnmFieldImpl mField;
+    // Meta data for the payload
+    omnmHeader    mHeader;
+
+    // Set once the payload has been frozen (see allocateFrozen)
+    bool          mFrozen;
+
+    // Set when unSerialize should borrow the caller's buffer, not copy it
+    bool          mViewMode;
+
+    // Set while the borrowed buffer is an external region to build into
+    bool          mExternal;
+
+    // Where this payload, its buffer and its field caches get their memory
+    const omnmAllocator* mAllocator;
 
     // If this is a member of a mamaMsg, this is a pointer to it
     mamaMsg       mParent;
 
-    // Meta data for the payload
-    omnmHeader    mHeader;
-
     // Closure which may be used by extending modules
     const void*   mExtenderClosure;
+
+    // The less commonly used state, NULL until first needed
+    omnmPayloadModes* mModes;
+
+    // Reusable field to use during payload interface crud operations. The
+    // members above are touched on every call so they are kept together at
+    // the front of the object, in its first cache line.
+    omnmFieldImpl mField;
+
+    // Where sub messages handed out by the getters live until the payload is
+    // next cleared
+    omnmArena     mArena;
+
+    // Next payload on the free list while this one sits in a payload pool
+    OmnmPayloadImpl* mPoolNext;
+
+    // Pool this payload returns to when destroyed, from whichever thread
+    OmnmPayloadPool* mPoolOwner;
+
+    // Shape learner key this payload was created for, or 0 if none
+    mama_u64_t       mShapeKey;
+
+    // The payload's own buffer, parked here while it is borrowing
+    uint8_t*              mOwnedBuffer;
+    size_t                mOwnedBufferSize;
+
+    // Set while the borrowed buffer is one shared with copies
+    omnmSharedBuffer*     mShared;
+
+    // Small buffer storage used until the payload outgrows it, normally
+    // just after the payload object in the same allocation
+    uint8_t*              mInlineBuffer;
+    size_t                mInlineCapacity;
+
+    // Consecutive uses which stayed within the trim target
+    mama_u32_t            mSmallUses;
+
+    // Set by warmPool once it has locked the payload's own allocation and
+    // field cache, or its heap buffer, in memory
+    bool                  mLockedPages;
+    bool                  mLockedBuffer;
 private:
+    // Move the buffer to one of exactly this capacity (which must be larger)
+    mama_status reallocate (size_t capacity);
+
+    // Attach the child to the buffer just after the length at lengthOffset,
+    // either empty or holding the length bytes already there
+    mama_status openBuilder (size_t lengthOffset, size_t length, OmnmPayloadImpl** child);
+
+    // Make sure there is a child to build sub-messages in, with somewhere to
+    // note what it is building in
+    mama_status getBuilder ();
+
+    // Append a field, either copying its body in or holding it by reference
+    mama_status appendField (mamaFieldType  type,
+                             const char*    name,
+                             mama_fid_t     fid,
+                             const uint8_t* buffer,
+                             size_t         bufferLen,
+                             bool           byReference);
+
+    // Write a default header to the start of the buffer and move the tail
+    // past it
+    void writeHeader ();
+
     // Find the field inside the buffer and populate provided field with its
     // location
     mama_status findFieldInBuffer (const char* name, mama_fid_t fid, struct omnmFieldImpl& field);
 };
 
+// Returns the field's cache block, allocating it on first use. NULL if the
+// allocator fails.
+omnmFieldCache*
+omnmmsgFieldPayloadImpl_getCache (omnmFieldImpl* impl);
+
+// Grows one of the field cache's buffers as allocateBufferMemory does,
+// keeping the memory gauges in step
+int
+omnmmsgFieldPayloadImpl_growCache (omnmFieldImpl*  impl,
+                                   void**          buffer,
+                                   size_t*         size,
+                                   size_t          newSize);
+
+// Releases everything held by the field's cache block, including the block
 void
 omnmmsgFieldPayloadImpl_cleanup (omnmFieldImpl* impl);
 
+// Releases those of the field cache's buffers holding more than target
+// bytes, along with the elements they hold. The block itself is kept.
+void
+omnmmsgFieldPayloadImpl_trimCache (omnmFieldImpl* impl, size_t target);
+
+// Creates a payload presized for the given shape learner key (see Shape.h)
+mama_status
+omnmmsgPayloadImpl_createForShape (msgPayload* msg, mama_u64_t shapeKey);
+
 
 #endif /* MAMA_BRIDGE_OMNM_MSG_PAYLOAD_H__ */
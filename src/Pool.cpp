@@ -0,0 +1,574 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*=========================================================================
+  =                             Includes                                  =
+  =========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <mama/mama.h>
+
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+#include "Payload.h"
+#include "Pool.h"
+#include "Allocator.h"
+
+/*=========================================================================
+  =                Typedefs, structs, enums and globals                   =
+  =========================================================================*/
+
+/*
+ * A pool is bound to one thread at a time, which is the only one to touch its
+ * free list and its counters. The counters are atomic purely so they can be
+ * read from other threads.
+ *
+ * Payloads remember the pool which created them. When one is destroyed on any
+ * other thread it is pushed onto its owner's remote stack instead, which the
+ * owner takes as a whole batch once its own list runs dry. Producers only
+ * ever push and the owner only ever swaps the whole stack out, so neither
+ * side needs a lock and the stack cannot suffer from ABA.
+ */
+class OmnmPayloadPool
+{
+public:
+    OmnmPayloadPool ();
+
+    // Owning thread only
+    OmnmPayloadImpl*                mHead;
+    std::atomic<uint64_t>           mCached;
+    std::atomic<uint64_t>           mHits;
+    std::atomic<uint64_t>           mMisses;
+    std::atomic<uint64_t>           mReleases;
+    std::atomic<uint64_t>           mRemoteReleases;
+    std::atomic<uint64_t>           mDiscards;
+
+    // Pushed to by any thread, taken by the owning thread
+    std::atomic<OmnmPayloadImpl*>   mRemoteHead;
+    std::atomic<uint64_t>           mRemoteCached;
+
+    // Next pool waiting for a thread to adopt it - guarded by registryLock
+    OmnmPayloadPool*                mNextSpare;
+};
+
+/*
+ * Binds a pool to the calling thread for the lifetime of the thread. Pools
+ * are never freed since other threads may still hold payloads which point to
+ * them - a thread which exits hands its pool on to the next thread to start.
+ */
+class OmnmPayloadPoolBinding
+{
+public:
+    OmnmPayloadPoolBinding ();
+    ~OmnmPayloadPoolBinding ();
+
+    OmnmPayloadPool* mPool;
+};
+
+static std::atomic<size_t> gMaxPayloads (OMNM_POOL_DEFAULT_MAX_PAYLOADS);
+static std::atomic<size_t> gMaxBufferSize (OMNM_POOL_DEFAULT_MAX_BUFFER_SIZE);
+
+/*
+ * Set once the calling thread's binding has been torn down, so payloads
+ * destroyed later during thread exit bypass the pool. Trivially destructible
+ * so it stays valid for the whole life of the thread.
+ */
+static thread_local bool tPoolDestroyed = false;
+static thread_local OmnmPayloadPoolBinding tBinding;
+
+/*=========================================================================
+  =                  Private implementation functions                     =
+  =========================================================================*/
+
+/*
+ * The registry outlives any thread which may still be exiting while the
+ * process shuts down, so it is deliberately never destroyed.
+ */
+static std::mutex&
+registryLock ()
+{
+    static std::mutex* lock = new std::mutex();
+    return *lock;
+}
+
+static std::vector<OmnmPayloadPool*>&
+registry ()
+{
+    static std::vector<OmnmPayloadPool*>* pools = new std::vector<OmnmPayloadPool*>();
+    return *pools;
+}
+
+/*
+ * Locks are not counted by the kernel, so warmPool counts how many of its
+ * blocks lie on each page it locked, and a page is only unlocked once the
+ * last of them has gone. Pages are counted even if mlock refused them, to
+ * stay in step with the payloads' flags. Also never destroyed, for the same
+ * reason as the registry.
+ */
+static std::mutex&
+lockedPagesLock ()
+{
+    static std::mutex* lock = new std::mutex();
+    return *lock;
+}
+
+static std::unordered_map<uintptr_t, size_t>&
+lockedPages ()
+{
+    static std::unordered_map<uintptr_t, size_t>* pages =
+        new std::unordered_map<uintptr_t, size_t>();
+    return *pages;
+}
+
+// The whole pages the block touches, rounded outwards
+static void
+pageRange (void* memory, size_t length, size_t pageSize, uintptr_t* start, uintptr_t* end)
+{
+    *start = (uintptr_t) memory & ~(uintptr_t) (pageSize - 1);
+    *end   = ((uintptr_t) memory + length + pageSize - 1) & ~(uintptr_t) (pageSize - 1);
+}
+
+// Pools left behind by exited threads - guarded by registryLock
+static OmnmPayloadPool* gSparePools = NULL;
+
+// Only the owning thread writes, so this needs no locked instruction
+static inline void
+increment (std::atomic<uint64_t>& counter, uint64_t by = 1)
+{
+    counter.store (counter.load (std::memory_order_relaxed) + by,
+                   std::memory_order_relaxed);
+}
+
+static inline void
+decrement (std::atomic<uint64_t>& counter)
+{
+    counter.store (counter.load (std::memory_order_relaxed) - 1,
+                   std::memory_order_relaxed);
+}
+
+static inline OmnmPayloadPool*
+currentPool ()
+{
+    if (tPoolDestroyed)
+    {
+        return NULL;
+    }
+    return tBinding.mPool;
+}
+
+static OmnmPayloadImpl*
+pop (OmnmPayloadPool& pool)
+{
+    OmnmPayloadImpl* impl = pool.mHead;
+    if (NULL != impl)
+    {
+        pool.mHead      = impl->mPoolNext;
+        impl->mPoolNext = NULL;
+        decrement (pool.mCached);
+    }
+    return impl;
+}
+
+static void
+push (OmnmPayloadPool& pool, OmnmPayloadImpl* impl)
+{
+    impl->mPoolNext = pool.mHead;
+    pool.mHead      = impl;
+    increment (pool.mCached);
+}
+
+// Moves everything other threads have returned onto the local free list
+static void
+takeRemote (OmnmPayloadPool& pool)
+{
+    OmnmPayloadImpl* impl = pool.mRemoteHead.exchange (NULL, std::memory_order_acquire);
+    uint64_t         taken = 0;
+    while (NULL != impl)
+    {
+        OmnmPayloadImpl* next = impl->mPoolNext;
+        push (pool, impl);
+        impl = next;
+        taken++;
+    }
+    pool.mRemoteCached.fetch_sub (taken, std::memory_order_relaxed);
+}
+
+static void
+pushRemote (OmnmPayloadPool& owner, OmnmPayloadImpl* impl)
+{
+    OmnmPayloadImpl* head = owner.mRemoteHead.load (std::memory_order_relaxed);
+    do
+    {
+        impl->mPoolNext = head;
+    } while (!owner.mRemoteHead.compare_exchange_weak (head,
+                                                       impl,
+                                                       std::memory_order_release,
+                                                       std::memory_order_relaxed));
+}
+
+// Frees everything the pool holds, including anything returned to it by
+// the destructors of the payloads being freed
+static void
+drain (OmnmPayloadPool& pool)
+{
+    OmnmPayloadImpl* impl = NULL;
+    takeRemote (pool);
+    while (NULL != (impl = pop (pool)))
+    {
+        OmnmPayloadImpl::deallocate (impl);
+    }
+}
+
+/*
+ * Writes to every page of the block so none of them faults later, and
+ * optionally locks them in memory. Returns false if locking failed.
+ */
+static bool
+prefault (void* memory, size_t length, bool lock)
+{
+    volatile uint8_t* bytes    = (volatile uint8_t*) memory;
+    size_t            pageSize = 4096;
+#if !defined(_WIN32)
+    pageSize = (size_t) sysconf (_SC_PAGESIZE);
+#endif
+    for (size_t offset = 0; offset < length; offset += pageSize)
+    {
+        bytes[offset] = bytes[offset];
+    }
+    bytes[length - 1] = bytes[length - 1];
+
+    if (!lock)
+    {
+        return true;
+    }
+#if !defined(_WIN32)
+    uintptr_t start;
+    uintptr_t end;
+    pageRange (memory, length, pageSize, &start, &end);
+
+    std::lock_guard<std::mutex> guard (lockedPagesLock ());
+    for (uintptr_t page = start; page < end; page += pageSize)
+    {
+        lockedPages()[page]++;
+    }
+    return 0 == mlock ((void*) start, end - start);
+#else
+    return false;
+#endif
+}
+
+OmnmPayloadPool::OmnmPayloadPool () : mHead (NULL),
+                                      mCached (0),
+                                      mHits (0),
+                                      mMisses (0),
+                                      mReleases (0),
+                                      mRemoteReleases (0),
+                                      mDiscards (0),
+                                      mRemoteHead (NULL),
+                                      mRemoteCached (0),
+                                      mNextSpare (NULL)
+{
+}
+
+OmnmPayloadPoolBinding::OmnmPayloadPoolBinding () : mPool (NULL)
+{
+    std::lock_guard<std::mutex> lock (registryLock());
+    if (NULL != gSparePools)
+    {
+        mPool                 = gSparePools;
+        gSparePools           = mPool->mNextSpare;
+        mPool->mNextSpare     = NULL;
+    }
+    else
+    {
+        mPool = new OmnmPayloadPool();
+        registry().push_back (mPool);
+    }
+}
+
+OmnmPayloadPoolBinding::~OmnmPayloadPoolBinding ()
+{
+    tPoolDestroyed = true;
+    drain (*mPool);
+
+    std::lock_guard<std::mutex> lock (registryLock());
+    mPool->mNextSpare = gSparePools;
+    gSparePools       = mPool;
+}
+
+/*=========================================================================
+  =                   Public implementation functions                     =
+  =========================================================================*/
+
+OmnmPayloadImpl*
+omnmmsgPayloadPoolImpl_acquire (const omnmAllocator* allocator)
+{
+    OmnmPayloadPool* pool = currentPool();
+    if (NULL == pool)
+    {
+        return NULL;
+    }
+
+    OmnmPayloadImpl* impl = pop (*pool);
+    if (NULL == impl &&
+        NULL != pool->mRemoteHead.load (std::memory_order_relaxed))
+    {
+        takeRemote (*pool);
+        impl = pop (*pool);
+    }
+
+    // Left over from before the bridge allocator was changed
+    if (NULL != impl && impl->mAllocator != allocator)
+    {
+        OmnmPayloadImpl::deallocate (impl);
+        impl = NULL;
+    }
+    increment (NULL == impl ? pool->mMisses : pool->mHits);
+    return impl;
+}
+
+void
+omnmmsgPayloadPoolImpl_attach (OmnmPayloadImpl* impl)
+{
+    impl->mPoolOwner = currentPool();
+}
+
+bool
+omnmmsgPayloadPoolImpl_release (OmnmPayloadImpl* impl)
+{
+    OmnmPayloadPool* pool = currentPool();
+    if (NULL == pool || impl->mAllocator != omnmmsgAllocatorImpl_getDefault ())
+    {
+        return false;
+    }
+
+    // Frozen payloads end where their contents do, so can't be reused
+    if (impl->mFrozen)
+    {
+        return false;
+    }
+
+    // Payloads which weren't created through a pool join this one
+    OmnmPayloadPool* owner = impl->mPoolOwner;
+    if (NULL == owner)
+    {
+        owner = impl->mPoolOwner = pool;
+    }
+
+    // The free list and the remote stack are limited separately, as payloads
+    // handed to other threads pile up on the remote stack while the owner is
+    // busy. The remote count is only approximate when read from another
+    // thread, which is good enough for a limit.
+    uint64_t limit  = gMaxPayloads.load (std::memory_order_relaxed);
+    uint64_t cached = owner->mCached.load (std::memory_order_relaxed);
+    if (owner != pool)
+    {
+        limit  *= OMNM_POOL_REMOTE_PAYLOADS_FACTOR;
+        cached  = owner->mRemoteCached.load (std::memory_order_relaxed);
+    }
+    if (cached >= limit)
+    {
+        increment (pool->mDiscards);
+        return false;
+    }
+
+    // A view's buffer belongs to its caller, so judge the payload's own
+    impl->returnBorrowed();
+
+    // Don't let one oversized message pin its buffer down indefinitely
+    if (impl->mPayloadBufferSize > gMaxBufferSize.load (std::memory_order_relaxed))
+    {
+        impl->releaseHeapBuffer();
+    }
+    impl->reset();
+
+    if (owner == pool)
+    {
+        push (*pool, impl);
+    }
+    else
+    {
+        // Count first so the owner can never take more than has been counted
+        owner->mRemoteCached.fetch_add (1, std::memory_order_relaxed);
+        pushRemote (*owner, impl);
+        increment (pool->mRemoteReleases);
+    }
+    increment (pool->mReleases);
+    return true;
+}
+
+void
+omnmmsgPayloadPoolImpl_unlock (void* memory, size_t length)
+{
+#if !defined(_WIN32)
+    size_t    pageSize = (size_t) sysconf (_SC_PAGESIZE);
+    uintptr_t start;
+    uintptr_t end;
+    pageRange (memory, length, pageSize, &start, &end);
+
+    std::lock_guard<std::mutex> guard (lockedPagesLock ());
+    for (uintptr_t page = start; page < end; page += pageSize)
+    {
+        std::unordered_map<uintptr_t, size_t>::iterator found = lockedPages().find (page);
+        if (found == lockedPages().end())
+        {
+            continue;
+        }
+        if (0 == --found->second)
+        {
+            lockedPages().erase (found);
+            munlock ((void*) page, pageSize);
+        }
+    }
+#endif
+}
+
+mama_status
+omnmmsgPayloadImpl_setPoolLimits (mama_size_t maxPayloadsPerThread,
+                                  mama_size_t maxBufferSize)
+{
+    gMaxPayloads.store (maxPayloadsPerThread, std::memory_order_relaxed);
+    gMaxBufferSize.store (maxBufferSize, std::memory_order_relaxed);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_getPoolLimits (mama_size_t* maxPayloadsPerThread,
+                                  mama_size_t* maxBufferSize)
+{
+    if (NULL == maxPayloadsPerThread || NULL == maxBufferSize)
+    {
+        return MAMA_STATUS_NULL_ARG;
+    }
+    *maxPayloadsPerThread = gMaxPayloads.load (std::memory_order_relaxed);
+    *maxBufferSize        = gMaxBufferSize.load (std::memory_order_relaxed);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_getPoolStats (omnmPayloadPoolStats* stats)
+{
+    if (NULL == stats) return MAMA_STATUS_NULL_ARG;
+
+    memset (stats, 0, sizeof(omnmPayloadPoolStats));
+
+    std::lock_guard<std::mutex> lock (registryLock());
+    for (OmnmPayloadPool* pool : registry())
+    {
+        stats->mHits           += pool->mHits.load (std::memory_order_relaxed);
+        stats->mMisses         += pool->mMisses.load (std::memory_order_relaxed);
+        stats->mReleases       += pool->mReleases.load (std::memory_order_relaxed);
+        stats->mRemoteReleases += pool->mRemoteReleases.load (std::memory_order_relaxed);
+        stats->mDiscards       += pool->mDiscards.load (std::memory_order_relaxed);
+        stats->mCached         += pool->mCached.load (std::memory_order_relaxed) +
+                                  pool->mRemoteCached.load (std::memory_order_relaxed);
+    }
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_drainPool (void)
+{
+    OmnmPayloadPool* pool = currentPool();
+    if (NULL != pool)
+    {
+        drain (*pool);
+    }
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_warmPool (mama_size_t payloads, mama_size_t capacity, int lockPages)
+{
+    OmnmPayloadPool* pool = currentPool();
+    if (NULL == pool)
+    {
+        return MAMA_STATUS_INVALID_ARG;
+    }
+
+    // Anything larger would be given up on the way back into the pool
+    size_t maxBufferSize = gMaxBufferSize.load (std::memory_order_relaxed);
+    if (capacity > maxBufferSize)
+    {
+        capacity = maxBufferSize;
+    }
+    size_t maxPayloads = gMaxPayloads.load (std::memory_order_relaxed);
+    if (payloads > maxPayloads)
+    {
+        payloads = maxPayloads;
+    }
+
+    const omnmAllocator* allocator = omnmmsgAllocatorImpl_getDefault ();
+    mama_status          status    = MAMA_STATUS_OK;
+    takeRemote (*pool);
+    while (pool->mCached.load (std::memory_order_relaxed) < payloads)
+    {
+        OmnmPayloadImpl* impl = OmnmPayloadImpl::allocate (allocator);
+        if (NULL == impl)
+        {
+            return MAMA_STATUS_NOMEM;
+        }
+        impl->mPoolOwner = pool;
+
+        // The field cache survives reuse too, so is worth setting up now
+        if (MAMA_STATUS_OK != impl->reserve (capacity) ||
+            NULL == omnmmsgFieldPayloadImpl_getCache (&impl->mField))
+        {
+            OmnmPayloadImpl::deallocate (impl);
+            return MAMA_STATUS_NOMEM;
+        }
+
+        // Whatever is locked is noted, so it can be unlocked when freed
+        bool locked = prefault (impl,
+                                OmnmPayloadImpl::getAllocationSize (impl->mInlineCapacity),
+                                0 != lockPages);
+        locked = prefault (impl->mField.mCache, sizeof(omnmFieldCache),
+                           0 != lockPages) && locked;
+        impl->mLockedPages = 0 != lockPages;
+        if (!impl->isBufferInline())
+        {
+            locked = prefault (impl->mPayloadBuffer, impl->mPayloadBufferSize,
+                               0 != lockPages) && locked;
+            impl->mLockedBuffer = 0 != lockPages;
+        }
+        if (!locked)
+        {
+            status = MAMA_STATUS_PLATFORM;
+        }
+        push (*pool, impl);
+    }
+    return status;
+}
@@ -0,0 +1,83 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MAMA_BRIDGE_OMNM_POOL_H__
+#define MAMA_BRIDGE_OMNM_POOL_H__
+
+#include "Payload.h"
+
+// Default number of payloads each thread keeps for reuse
+#define OMNM_POOL_DEFAULT_MAX_PAYLOADS      64
+
+// Multiple of the above which other threads may hand back to a pool before
+// its thread next takes them. Payloads handed from one thread to others come
+// back in bursts of however many were in flight.
+#define OMNM_POOL_REMOTE_PAYLOADS_FACTOR    16
+
+// Default largest buffer a pooled payload keeps hold of
+#define OMNM_POOL_DEFAULT_MAX_BUFFER_SIZE   65536
+
+/**
+ * Takes a payload from the calling thread's pool, already reset to its
+ * freshly constructed state.
+ *
+ * @param allocator The allocator the caller wants the payload to use.
+ *
+ * @return The payload, or NULL if the pool is empty or disabled.
+ */
+OmnmPayloadImpl*
+omnmmsgPayloadPoolImpl_acquire (const omnmAllocator* allocator);
+
+/**
+ * Makes the calling thread's pool the owner of a newly allocated payload, so
+ * it finds its way back there wherever it ends up being destroyed.
+ */
+void
+omnmmsgPayloadPoolImpl_attach (OmnmPayloadImpl* impl);
+
+/**
+ * Offers a payload which is being destroyed back to the pool which owns it.
+ * If that belongs to another thread, it is handed over without locking.
+ * Only payloads using the bridge wide allocator are taken.
+ *
+ * @param impl The payload being destroyed.
+ *
+ * @return true if the pool took the payload, false if the caller should
+ *         delete it.
+ */
+bool
+omnmmsgPayloadPoolImpl_release (OmnmPayloadImpl* impl);
+
+/**
+ * Undoes warmPool's locking of a block which is about to be freed or given
+ * away. Each page the block touches is unlocked once no other locked block
+ * still lies on it.
+ *
+ * @param memory The block, as it was locked.
+ * @param length Its length in bytes.
+ */
+void
+omnmmsgPayloadPoolImpl_unlock (void* memory, size_t length);
+
+#endif /* MAMA_BRIDGE_OMNM_POOL_H__ */
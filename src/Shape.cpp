@@ -0,0 +1,170 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*=========================================================================
+  =                             Includes                                  =
+  =========================================================================*/
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include <mama/mama.h>
+
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+#include "Shape.h"
+
+/*=========================================================================
+  =                Typedefs, structs, enums and globals                   =
+  =========================================================================*/
+
+/*
+ * Open addressed table which is never resized and never has keys removed,
+ * so a slot only ever goes from empty to claimed and readers need no locks.
+ * Lost updates under contention only cost a slightly stale size.
+ */
+typedef struct omnmShapeSlot
+{
+    std::atomic<mama_u64_t> mKey;   /* 0 while the slot is free */
+    std::atomic<mama_u32_t> mSize;
+} omnmShapeSlot;
+
+static omnmShapeSlot gShapes[OMNM_SHAPE_TABLE_SIZE];
+
+static std::atomic<bool> gShapeLearning (false);
+
+// Template keys have the top bit set so they can't collide with subjects
+#define OMNM_SHAPE_TEMPLATE_KEY     0x8000000000000000ULL
+
+// A smaller size only pulls the learned one down by this fraction at a time
+#define OMNM_SHAPE_DECAY_SHIFT      3
+
+/*=========================================================================
+  =                  Private implementation functions                     =
+  =========================================================================*/
+
+static inline size_t
+slotIndex (mama_u64_t key)
+{
+    // Keys may well be sequential template ids, so mix before masking
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (size_t) key & (OMNM_SHAPE_TABLE_SIZE - 1);
+}
+
+/*=========================================================================
+  =                   Public implementation functions                     =
+  =========================================================================*/
+
+mama_u64_t
+omnmmsgShapeImpl_keyForTemplate (mama_u32_t templateId)
+{
+    return OMNM_SHAPE_TEMPLATE_KEY | templateId;
+}
+
+mama_u64_t
+omnmmsgShapeImpl_keyForSubject (const char* subject)
+{
+    // FNV-1a
+    mama_u64_t hash = 0xcbf29ce484222325ULL;
+    for (const char* c = subject; '\0' != *c; c++)
+    {
+        hash ^= (uint8_t) *c;
+        hash *= 0x100000001b3ULL;
+    }
+    hash &= ~OMNM_SHAPE_TEMPLATE_KEY;
+    return 0 == hash ? 1 : hash;
+}
+
+size_t
+omnmmsgShapeImpl_lookup (mama_u64_t key)
+{
+    if (!gShapeLearning.load (std::memory_order_relaxed))
+    {
+        return 0;
+    }
+
+    size_t index = slotIndex (key);
+    for (int probe = 0; probe < OMNM_SHAPE_MAX_PROBE; probe++)
+    {
+        omnmShapeSlot& slot = gShapes[(index + probe) & (OMNM_SHAPE_TABLE_SIZE - 1)];
+        mama_u64_t     slotKey = slot.mKey.load (std::memory_order_acquire);
+        if (slotKey == key)
+        {
+            return slot.mSize.load (std::memory_order_relaxed);
+        }
+        if (0 == slotKey)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+void
+omnmmsgShapeImpl_record (mama_u64_t key, size_t size)
+{
+    if (!gShapeLearning.load (std::memory_order_relaxed) || size > UINT32_MAX)
+    {
+        return;
+    }
+
+    size_t index = slotIndex (key);
+    for (int probe = 0; probe < OMNM_SHAPE_MAX_PROBE; probe++)
+    {
+        omnmShapeSlot& slot = gShapes[(index + probe) & (OMNM_SHAPE_TABLE_SIZE - 1)];
+        mama_u64_t     slotKey = slot.mKey.load (std::memory_order_acquire);
+        if (0 == slotKey)
+        {
+            // Claim the slot. If someone else got there first, slotKey is
+            // left holding their key.
+            if (slot.mKey.compare_exchange_strong (slotKey, key, std::memory_order_acq_rel))
+            {
+                slotKey = key;
+            }
+        }
+
+        if (slotKey != key)
+        {
+            continue;
+        }
+
+        mama_u32_t learned = slot.mSize.load (std::memory_order_relaxed);
+        if (size < learned)
+        {
+            size = learned - ((learned - size) >> OMNM_SHAPE_DECAY_SHIFT);
+        }
+        slot.mSize.store ((mama_u32_t) size, std::memory_order_relaxed);
+        return;
+    }
+}
+
+mama_status
+omnmmsgPayloadImpl_setShapeLearning (mama_bool_t enabled)
+{
+    gShapeLearning.store (0 != enabled, std::memory_order_relaxed);
+    return MAMA_STATUS_OK;
+}
@@ -0,0 +1,67 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef MAMA_BRIDGE_OMNM_SHAPE_H__
+#define MAMA_BRIDGE_OMNM_SHAPE_H__
+
+#include <stddef.h>
+#include <mama/mama.h>
+
+/*
+ * The shape learner remembers how big payloads of a given shape (a subject
+ * or a template) ended up, so the next one can be sized up front and built
+ * without reallocating. Sizes are recorded when a payload is serialized.
+ */
+
+// Number of shapes which can be remembered (a power of two)
+#define OMNM_SHAPE_TABLE_SIZE       4096
+
+// Slots tried before a shape is forgotten about
+#define OMNM_SHAPE_MAX_PROBE        8
+
+// Key for payloads created for a template
+mama_u64_t
+omnmmsgShapeImpl_keyForTemplate (mama_u32_t templateId);
+
+// Key for payloads created for a subject
+mama_u64_t
+omnmmsgShapeImpl_keyForSubject (const char* subject);
+
+/**
+ * Returns the size payloads with this key have been seen to need, or 0 if
+ * nothing has been learned about them (or learning is disabled).
+ */
+size_t
+omnmmsgShapeImpl_lookup (mama_u64_t key);
+
+/**
+ * Records the final size of a payload with this key. Sizes grow straight
+ * away but only shrink gradually, so a single small message doesn't undo
+ * what has been learned.
+ */
+void
+omnmmsgShapeImpl_record (mama_u64_t key, size_t size);
+
+#endif /* MAMA_BRIDGE_OMNM_SHAPE_H__ */
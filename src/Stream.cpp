@@ -0,0 +1,318 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*=========================================================================
+  =                             Includes                                  =
+  =========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <mama/mama.h>
+
+#include "mama/integration/bridge/omnmmsgpayloadfunctions.h"
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
+#include "Payload.h"
+#include "Stream.h"
+#include "ByteOrder.h"
+#include "Allocator.h"
+#include "Accounting.h"
+
+static_assert (sizeof(omnmStreamFrameHeader) == OMNM_STREAM_FRAME_HEADER_SIZE,
+               "frame header size is part of the public interface");
+
+/*=========================================================================
+  =                  Private implementation functions                     =
+  =========================================================================*/
+
+static mama_status
+fail (omnmStreamDecoderImpl* decoder)
+{
+    decoder->mFailed = true;
+    return MAMA_STATUS_INVALID_ARG;
+}
+
+// Works out what to do with the frame once its header is complete
+static mama_status
+readFrameHeader (omnmStreamDecoderImpl* decoder, const uint8_t* data)
+{
+    omnmStreamFrameHeader header;
+    memcpy (&header, data, sizeof(header));
+    if (OMNM_STREAM_FRAME_ID != header.mType)
+    {
+        return fail (decoder);
+    }
+    size_t length = omnmmsgByteOrderImpl_needsSwap (header.mFlags)
+                  ? OMNM_BSWAP32(header.mLength)
+                  : header.mLength;
+
+    // A payload is never empty, so this can only be a corrupt stream
+    if (0 == length)
+    {
+        return fail (decoder);
+    }
+    if (length > decoder->mMaxFrameSize)
+    {
+        if (!decoder->mSkipOversized)
+        {
+            return fail (decoder);
+        }
+        decoder->mSkip = length;
+        decoder->mSkipped++;
+        decoder->mHeaderFill = 0;
+        return MAMA_STATUS_OK;
+    }
+    decoder->mFrameLength = length;
+    decoder->mHeaderFill  = sizeof(header);
+    return MAMA_STATUS_OK;
+}
+
+static mama_status
+reserveBuffer (omnmStreamDecoderImpl* decoder, size_t capacity)
+{
+    if (capacity <= decoder->mBufferSize)
+    {
+        return MAMA_STATUS_OK;
+    }
+
+    // Exactly what the frame needs, as frames up to the limit may be rare
+    uint8_t* buffer = (uint8_t*) omnmmsgAllocatorImpl_malloc (decoder->mAllocator, capacity);
+    if (NULL == buffer)
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    if (NULL != decoder->mBuffer)
+    {
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, -(int64_t) decoder->mBufferSize);
+        omnmmsgAllocatorImpl_free (decoder->mAllocator, decoder->mBuffer);
+    }
+    omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, capacity);
+    decoder->mBuffer     = buffer;
+    decoder->mBufferSize = capacity;
+    return MAMA_STATUS_OK;
+}
+
+// Hands out the completed frame and readies the decoder for the next one
+static mama_status
+completeFrame (omnmStreamDecoderImpl* decoder, const uint8_t* frame, msgPayload* msg)
+{
+    size_t length = decoder->mFrameLength;
+    decoder->mHeaderFill  = 0;
+    decoder->mFrameLength = 0;
+    decoder->mFill        = 0;
+
+    // Only payloads are decoded - anything else, such as a batch, would
+    // otherwise be read as one
+    if (MAMA_PAYLOAD_ID_OMNM != frame[0])
+    {
+        return fail (decoder);
+    }
+
+    mama_status status = omnmmsgPayload_unSerialize (decoder->mPayload, frame, length);
+    if (MAMA_STATUS_OK != status)
+    {
+        return fail (decoder);
+    }
+    *msg = decoder->mPayload;
+    return MAMA_STATUS_OK;
+}
+
+/*=========================================================================
+  =                   Public implementation functions                     =
+  =========================================================================*/
+
+mama_status
+omnmmsgPayloadImpl_writeFrameHeader (void* header, mama_size_t bufferLength)
+{
+    omnmStreamFrameHeader frame;
+
+    if (NULL == header) return MAMA_STATUS_NULL_ARG;
+    if (0 == bufferLength || bufferLength > UINT32_MAX) return MAMA_STATUS_INVALID_ARG;
+
+    frame.mType     = OMNM_STREAM_FRAME_ID;
+    frame.mFlags    = OMNM_HOST_BYTE_ORDER_FLAG;
+    frame.mReserved = 0;
+    frame.mLength   = (mama_u32_t) bufferLength;
+    memcpy (header, &frame, sizeof(frame));
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_createStreamDecoder (omnmStreamDecoder*  decoder,
+                                        mama_size_t         maxFrameSize,
+                                        int                 skipOversized)
+{
+    if (NULL == decoder) return MAMA_STATUS_NULL_ARG;
+
+    const omnmAllocator*   allocator = omnmmsgAllocatorImpl_getDefault ();
+    omnmStreamDecoderImpl* impl      = (omnmStreamDecoderImpl*) omnmmsgAllocatorImpl_calloc (
+                                           allocator, sizeof(omnmStreamDecoderImpl));
+    if (NULL == impl)
+    {
+        return MAMA_STATUS_NOMEM;
+    }
+    impl->mAllocator     = allocator;
+    impl->mMaxFrameSize  = 0 == maxFrameSize ? OMNM_STREAM_DEFAULT_MAX_FRAME_SIZE : maxFrameSize;
+    impl->mSkipOversized = 0 != skipOversized;
+
+    mama_status status = omnmmsgPayloadImpl_createWithAllocator (&impl->mPayload, allocator);
+    if (MAMA_STATUS_OK != status)
+    {
+        omnmmsgAllocatorImpl_free (allocator, impl);
+        return status;
+    }
+    omnmmsgPayloadImpl_setViewMode (impl->mPayload, 1);
+    *decoder = impl;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_destroyStreamDecoder (omnmStreamDecoder decoder)
+{
+    if (NULL == decoder) return MAMA_STATUS_NULL_ARG;
+
+    const omnmAllocator* allocator = decoder->mAllocator;
+    omnmmsgPayload_destroy (decoder->mPayload);
+    if (NULL != decoder->mBuffer)
+    {
+        omnmmsgAccountingImpl_add (OMNM_GAUGE_BYTES_RESERVED, -(int64_t) decoder->mBufferSize);
+        omnmmsgAllocatorImpl_free (allocator, decoder->mBuffer);
+    }
+    omnmmsgAllocatorImpl_free (allocator, decoder);
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_resetStreamDecoder (omnmStreamDecoder decoder)
+{
+    if (NULL == decoder) return MAMA_STATUS_NULL_ARG;
+
+    decoder->mFailed      = false;
+    decoder->mHeaderFill  = 0;
+    decoder->mFrameLength = 0;
+    decoder->mFill        = 0;
+    decoder->mSkip        = 0;
+    return MAMA_STATUS_OK;
+}
+
+mama_status
+omnmmsgPayloadImpl_decodeStream (omnmStreamDecoder  decoder,
+                                 const void**       data,
+                                 mama_size_t*       dataLength,
+                                 msgPayload*        msg)
+{
+    if (NULL == decoder || NULL == data || NULL == dataLength || NULL == msg)
+        return MAMA_STATUS_NULL_ARG;
+
+    *msg = NULL;
+    if (decoder->mFailed) return MAMA_STATUS_INVALID_ARG;
+
+    const uint8_t* chunk  = (const uint8_t*) *data;
+    size_t         length = *dataLength;
+    mama_status    status = MAMA_STATUS_OK;
+
+    while (0 != length)
+    {
+        // What is left of an oversized frame goes without being looked at
+        if (0 != decoder->mSkip)
+        {
+            size_t skipped = decoder->mSkip < length ? decoder->mSkip : length;
+            decoder->mSkip -= skipped;
+            chunk          += skipped;
+            length         -= skipped;
+            continue;
+        }
+
+        if (decoder->mHeaderFill < sizeof(omnmStreamFrameHeader))
+        {
+            // A header which is all there is read where it lies
+            if (0 == decoder->mHeaderFill && length >= sizeof(omnmStreamFrameHeader))
+            {
+                status  = readFrameHeader (decoder, chunk);
+                chunk  += sizeof(omnmStreamFrameHeader);
+                length -= sizeof(omnmStreamFrameHeader);
+            }
+            else
+            {
+                size_t needed = sizeof(omnmStreamFrameHeader) - decoder->mHeaderFill;
+                size_t copied = needed < length ? needed : length;
+                memcpy (decoder->mHeader + decoder->mHeaderFill, chunk, copied);
+                decoder->mHeaderFill += copied;
+                chunk                += copied;
+                length               -= copied;
+                if (decoder->mHeaderFill == sizeof(omnmStreamFrameHeader))
+                {
+                    status = readFrameHeader (decoder, decoder->mHeader);
+                }
+            }
+            if (MAMA_STATUS_OK != status)
+            {
+                break;
+            }
+            continue;
+        }
+
+        // A frame which is all there is read where it lies too
+        if (0 == decoder->mFill && length >= decoder->mFrameLength)
+        {
+            const uint8_t* frame = chunk;
+            chunk  += decoder->mFrameLength;
+            length -= decoder->mFrameLength;
+            status  = completeFrame (decoder, frame, msg);
+            break;
+        }
+
+        // Otherwise it is gathered up until the rest arrives
+        status = reserveBuffer (decoder, decoder->mFrameLength);
+        if (MAMA_STATUS_OK != status)
+        {
+            break;
+        }
+        size_t needed = decoder->mFrameLength - decoder->mFill;
+        size_t copied = needed < length ? needed : length;
+        memcpy (decoder->mBuffer + decoder->mFill, chunk, copied);
+        decoder->mFill += copied;
+        chunk          += copied;
+        length         -= copied;
+        if (decoder->mFill == decoder->mFrameLength)
+        {
+            status = completeFrame (decoder, decoder->mBuffer, msg);
+            break;
+        }
+    }
+
+    *data       = chunk;
+    *dataLength = length;
+    return status;
+}
+
+mama_status
+omnmmsgPayloadImpl_getStreamSkipped (omnmStreamDecoder  decoder,
+                                     mama_u64_t*        frames)
+{
+    if (NULL == decoder || NULL == frames) return MAMA_STATUS_NULL_ARG;
+    *frames = decoder->mSkipped;
+    return MAMA_STATUS_OK;
+}
@@ -0,0 +1,76 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Frank Quinn (http://fquinner.github.io)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MAMA_BRIDGE_OMNM_STREAM_H__
+#define MAMA_BRIDGE_OMNM_STREAM_H__
+
+#include "Payload.h"
+
+// Marks the start of every frame, so a stream which has lost its place is
+// caught rather than read as lengths
+#define OMNM_STREAM_FRAME_ID                'F'
+
+// Largest frame a decoder accepts when the caller gives no limit
+#define OMNM_STREAM_DEFAULT_MAX_FRAME_SIZE  (16 * 1024 * 1024)
+
+typedef struct omnmStreamFrameHeader
+{
+    mama_u8_t   mType;      /* OMNM_STREAM_FRAME_ID */
+    mama_u8_t   mFlags;     /* OMNM_HEADER_FLAG_* byte order of mLength */
+    mama_u16_t  mReserved;
+    mama_u32_t  mLength;    /* bytes following the header */
+} omnmStreamFrameHeader;
+
+/*
+ * A frame is read straight out of the caller's chunk when it is all there,
+ * so mBuffer only ever holds one which straddles chunks. It is allocated at
+ * the size of the largest such frame, which is never more than
+ * mMaxFrameSize.
+ */
+struct omnmStreamDecoderImpl
+{
+    const omnmAllocator*  mAllocator;
+    size_t                mMaxFrameSize;
+    bool                  mSkipOversized;
+    bool                  mFailed;
+
+    // The header of the frame under way, which may itself straddle chunks
+    uint8_t               mHeader[sizeof(omnmStreamFrameHeader)];
+    size_t                mHeaderFill;
+    size_t                mFrameLength;
+
+    uint8_t*              mBuffer;
+    size_t                mBufferSize;
+    size_t                mFill;
+
+    // Bytes of an oversized frame still to be discarded, and how many have
+    // been altogether
+    size_t                mSkip;
+    mama_u64_t            mSkipped;
+
+    // Handed out as a view of each frame in turn
+    msgPayload            mPayload;
+};
+
+#endif /* MAMA_BRIDGE_OMNM_STREAM_H__ */
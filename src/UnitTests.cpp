@@ -23,10 +23,17 @@
  */
 
 #include <gtest/gtest.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
 #include <mama/mama.h>
 #include "mama/integration/bridge/omnmmsgpayloadfunctions.h"
+#include "mama/integration/bridge/omnmmsgpayloadimpl.h"
 #include "Payload.h"
 #include "Iterator.h"
+#include "Batch.h"
+#include "Stream.h"
 
 void parseField (const mamaMsg       msg,
                  const mamaMsgField  field,
@@ -440,3 +447,1904 @@ TEST_F(OmnmTests, CreateAndUpdateGrowingStrings)
     omnmmsgPayload_getString (mPayloadBase, NULL, fid, &actaulshort);
     EXPECT_STREQ (expectedshort, actaulshort);
 }
+
+TEST_F(OmnmTests, CrossEndianDecode)
+{
+    msgPayload          sub         = NULL;
+    msgPayload          decoded     = NULL;
+    const msgPayload*   subVector   = NULL;
+    const void*         buffer      = NULL;
+    mama_size_t         bufferLen   = 0;
+    mama_size_t         size        = 0;
+    mama_i16_t          i16         = 0;
+    mama_u32_t          u32         = 0;
+    mama_i64_t          i64         = 0;
+    mama_f64_t          f64         = 0;
+    const char*         str         = NULL;
+    const mama_u16_t*   u16s        = NULL;
+    const mama_u32_t*   u32s        = NULL;
+    const mama_f64_t*   f64s        = NULL;
+    mama_u16_t          u16Vector[] = {1, 2, 3, 4, 5, 6, 7, 8, 0xABCD};
+    mama_u32_t          u32Vector[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0xDEADBEEF};
+    mama_f64_t          f64Vector[] = {1.5, -2.25, 3e100, 4.125, 5.0};
+    mamaDateTime        expectedTime, actualTime;
+    mamaPrice           expectedPrice, actualPrice;
+    double              priceValue  = 0;
+
+    mamaDateTime_create (&expectedTime);
+    mamaDateTime_create (&actualTime);
+    mamaDateTime_setToNow (expectedTime);
+    mamaPrice_create (&expectedPrice);
+    mamaPrice_create (&actualPrice);
+    mamaPrice_setValue (expectedPrice, 101.25);
+
+    omnmmsgPayload_create (&sub);
+    omnmmsgPayload_addU32 (sub, NULL, 1, 0x01020304);
+    omnmmsgPayload_addString (sub, NULL, 2, "nested");
+
+    omnmmsgPayload_addI16 (mPayloadBase, NULL, 10, -1234);
+    omnmmsgPayload_addU32 (mPayloadBase, "u32", 11, 0xCAFEBABE);
+    omnmmsgPayload_addI64 (mPayloadBase, NULL, 12, -1234567890123LL);
+    omnmmsgPayload_addF64 (mPayloadBase, NULL, 13, 3.14159);
+    omnmmsgPayload_addString (mPayloadBase, NULL, 14, "unchanged");
+    omnmmsgPayload_addDateTime (mPayloadBase, NULL, 15, expectedTime);
+    omnmmsgPayload_addPrice (mPayloadBase, NULL, 16, expectedPrice);
+    omnmmsgPayload_addVectorU16 (mPayloadBase, NULL, 17, u16Vector, 9);
+    omnmmsgPayload_addVectorU32 (mPayloadBase, NULL, 18, u32Vector, 11);
+    omnmmsgPayload_addVectorF64 (mPayloadBase, NULL, 19, f64Vector, 5);
+    ((OmnmPayloadImpl*) mPayloadBase)->updateSubMsg (mPayloadBase, NULL, 20, sub);
+    omnmmsgPayloadImpl_updateVectorMsgPayload (mPayloadBase, NULL, 21, &sub, 1);
+
+    // Produce what a publisher of the opposite byte order would have sent
+    omnmmsgPayload_serialize (mPayloadBase, &buffer, &bufferLen);
+    std::vector<uint8_t> wire ((const uint8_t*) buffer, (const uint8_t*) buffer + bufferLen);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_swapByteOrder (wire.data(), wire.size()));
+    ASSERT_NE (0, memcmp (buffer, wire.data(), bufferLen));
+
+    omnmmsgPayload_create (&decoded);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (decoded, wire.data(), wire.size()));
+
+    // Once decoded the payload is byte for byte what the local host wrote
+    const void* decodedBuffer = NULL;
+    mama_size_t decodedLen = 0;
+    omnmmsgPayload_serialize (decoded, &decodedBuffer, &decodedLen);
+    ASSERT_EQ (bufferLen, decodedLen);
+    EXPECT_EQ (0, memcmp (buffer, decodedBuffer, bufferLen));
+
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getI16 (decoded, NULL, 10, &i16));
+    EXPECT_EQ (-1234, i16);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (decoded, "u32", 0, &u32));
+    EXPECT_EQ (0xCAFEBABE, u32);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getI64 (decoded, NULL, 12, &i64));
+    EXPECT_EQ (-1234567890123LL, i64);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getF64 (decoded, NULL, 13, &f64));
+    EXPECT_DOUBLE_EQ (3.14159, f64);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (decoded, NULL, 14, &str));
+    EXPECT_STREQ ("unchanged", str);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getDateTime (decoded, NULL, 15, actualTime));
+    EXPECT_TRUE (mamaDateTime_equal (expectedTime, actualTime));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getPrice (decoded, NULL, 16, actualPrice));
+    mamaPrice_getValue (actualPrice, &priceValue);
+    EXPECT_DOUBLE_EQ (101.25, priceValue);
+
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getVectorU16 (decoded, NULL, 17, &u16s, &size));
+    ASSERT_EQ (9u, size);
+    EXPECT_EQ (0, memcmp (u16Vector, u16s, sizeof(u16Vector)));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getVectorU32 (decoded, NULL, 18, &u32s, &size));
+    ASSERT_EQ (11u, size);
+    EXPECT_EQ (0, memcmp (u32Vector, u32s, sizeof(u32Vector)));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getVectorF64 (decoded, NULL, 19, &f64s, &size));
+    ASSERT_EQ (5u, size);
+    EXPECT_EQ (0, memcmp (f64Vector, f64s, sizeof(f64Vector)));
+
+    msgPayload nested = NULL;
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (decoded, NULL, 20, &nested));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (nested, NULL, 1, &u32));
+    EXPECT_EQ (0x01020304u, u32);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getVectorMsg (decoded, NULL, 21, &subVector, &size));
+    ASSERT_EQ (1u, size);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (subVector[0], NULL, 2, &str));
+    EXPECT_STREQ ("nested", str);
+
+    omnmmsgPayload_destroy (decoded);
+    omnmmsgPayload_destroy (sub);
+    mamaDateTime_destroy (expectedTime);
+    mamaDateTime_destroy (actualTime);
+    mamaPrice_destroy (expectedPrice);
+    mamaPrice_destroy (actualPrice);
+}
+
+TEST_F(OmnmTests, CrossEndianRejectsMalformed)
+{
+    const void* buffer = NULL;
+    mama_size_t bufferLen = 0;
+    msgPayload decoded = NULL;
+
+    omnmmsgPayload_addString (mPayloadBase, NULL, 1, "truncated");
+    omnmmsgPayload_serialize (mPayloadBase, &buffer, &bufferLen);
+    std::vector<uint8_t> wire ((const uint8_t*) buffer, (const uint8_t*) buffer + bufferLen);
+
+    // Drop the string terminator so the field runs off the end
+    std::vector<uint8_t> truncated (wire.begin(), wire.end() - 1);
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_swapByteOrder (truncated.data(), truncated.size()));
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_swapByteOrder (wire.data(), wire.size()));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_swapByteOrder (wire.data(), wire.size()));
+    EXPECT_EQ (0, memcmp (buffer, wire.data(), bufferLen));
+
+    omnmmsgPayload_create (&decoded);
+    wire[0] = 'O';
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayload_unSerialize (decoded, wire.data(), 2));
+    omnmmsgPayload_destroy (decoded);
+}
+
+TEST_F(OmnmTests, InlineBufferSpillsToHeap)
+{
+    // Pooled payloads keep whatever buffer they grew, so start from scratch
+    OmnmPayloadImpl* impl = OmnmPayloadImpl::allocate (NULL);
+    msgPayload msg = (msgPayload) impl;
+    mama_u64_t actual = 0;
+    mama_fid_t fid = 1;
+
+    // Small payloads never leave the object
+    omnmmsgPayload_addU64 (msg, NULL, fid, fid);
+    EXPECT_EQ (impl->getHeaderSize() + 12 <= OMNM_INLINE_BUFFER_SIZE, impl->isBufferInline());
+
+    // Keep adding until the inline buffer is outgrown
+    while (impl->isBufferInline())
+    {
+        fid++;
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_addU64 (msg, NULL, fid, fid));
+    }
+    EXPECT_GT (impl->mPayloadBufferSize, (size_t) OMNM_INLINE_BUFFER_SIZE);
+
+    // Everything written before and after the spill is intact
+    for (mama_fid_t i = 1; i <= fid; i++)
+    {
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU64 (msg, NULL, i, &actual));
+        EXPECT_EQ ((mama_u64_t) i, actual);
+    }
+    OmnmPayloadImpl::deallocate (impl);
+}
+
+TEST_F(OmnmTests, PooledPayloadIsReused)
+{
+    msgPayload           payload = NULL;
+    msgPayload           reused  = NULL;
+    omnmPayloadPoolStats before;
+    omnmPayloadPoolStats after;
+    const char*          value   = NULL;
+    char                 big[512];
+
+    memset (big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    omnmmsgPayloadImpl_drainPool ();
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getPoolStats (&before));
+
+    // Grow a payload onto the heap then hand it back
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&payload));
+    omnmmsgPayload_addString (payload, NULL, 1, big);
+    uint8_t* buffer = ((OmnmPayloadImpl*) payload)->mPayloadBuffer;
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_destroy (payload));
+
+    // The next create gets the same object back, buffer intact but empty
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&reused));
+    EXPECT_EQ (payload, reused);
+    EXPECT_EQ (buffer, ((OmnmPayloadImpl*) reused)->mPayloadBuffer);
+    EXPECT_EQ (MAMA_STATUS_NOT_FOUND, omnmmsgPayload_getString (reused, NULL, 1, &value));
+    omnmmsgPayload_addString (reused, NULL, 2, "reused");
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (reused, NULL, 2, &value));
+    EXPECT_STREQ ("reused", value);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_destroy (reused));
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getPoolStats (&after));
+    EXPECT_EQ (before.mHits + 1, after.mHits);
+    EXPECT_EQ (before.mReleases + 2, after.mReleases);
+    EXPECT_EQ (before.mCached + 1, after.mCached);
+
+    // A limit of zero turns pooling off
+    mama_size_t maxPayloads = 0;
+    mama_size_t maxBufferSize = 0;
+    omnmmsgPayloadImpl_getPoolLimits (&maxPayloads, &maxBufferSize);
+    omnmmsgPayloadImpl_drainPool ();
+    omnmmsgPayloadImpl_setPoolLimits (0, maxBufferSize);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&payload));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_destroy (payload));
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getPoolStats (&before));
+    EXPECT_EQ (after.mDiscards + 1, before.mDiscards);
+    EXPECT_EQ (after.mMisses + 1, before.mMisses);
+    EXPECT_EQ (after.mCached - 1, before.mCached);
+
+    omnmmsgPayloadImpl_setPoolLimits (maxPayloads, maxBufferSize);
+}
+
+TEST_F(OmnmTests, PooledPayloadReturnsToOwningThread)
+{
+    msgPayload           payload = NULL;
+    msgPayload           reused  = NULL;
+    omnmPayloadPoolStats before;
+    omnmPayloadPoolStats after;
+
+    omnmmsgPayloadImpl_drainPool ();
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getPoolStats (&before));
+
+    // Created here, destroyed on another thread
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&payload));
+    omnmmsgPayload_addU32 (payload, NULL, 1, 1);
+    std::thread worker ([payload] { omnmmsgPayload_destroy (payload); });
+    worker.join ();
+
+    // ... and back in this thread's pool for the next create
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&reused));
+    EXPECT_EQ (payload, reused);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_destroy (reused));
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getPoolStats (&after));
+    EXPECT_EQ (before.mRemoteReleases + 1, after.mRemoteReleases);
+    EXPECT_EQ (before.mHits + 1, after.mHits);
+
+    // A burst handed back by another thread isn't turned away just because
+    // this thread's own list is full
+    mama_size_t maxPayloads   = 0;
+    mama_size_t maxBufferSize = 0;
+    std::vector<msgPayload> burst (8);
+    omnmmsgPayloadImpl_getPoolLimits (&maxPayloads, &maxBufferSize);
+    omnmmsgPayloadImpl_setPoolLimits (4, maxBufferSize);
+    omnmmsgPayloadImpl_drainPool ();
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_warmPool (4, 0, 0));
+    for (msgPayload& created : burst)
+    {
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&created));
+    }
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_warmPool (4, 0, 0));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getPoolStats (&before));
+    std::thread consumer ([&burst] {
+        for (msgPayload destroyed : burst) omnmmsgPayload_destroy (destroyed);
+    });
+    consumer.join ();
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getPoolStats (&after));
+    EXPECT_EQ (before.mDiscards, after.mDiscards);
+    EXPECT_EQ (before.mCached + burst.size(), after.mCached);
+
+    omnmmsgPayloadImpl_setPoolLimits (maxPayloads, maxBufferSize);
+    omnmmsgPayloadImpl_drainPool ();
+}
+
+// Counts the blocks outstanding through the allocator hooks
+static void* countingMalloc (mama_size_t size, void* closure)
+{
+    (*(int*) closure)++;
+    return malloc (size);
+}
+
+static void* countingRealloc (void* memory, mama_size_t size, void* closure)
+{
+    if (NULL == memory) (*(int*) closure)++;
+    return realloc (memory, size);
+}
+
+static void countingFree (void* memory, void* closure)
+{
+    if (NULL != memory) (*(int*) closure)--;
+    free (memory);
+}
+
+TEST_F(OmnmTests, AllocatorHooksCoverPayloadMemory)
+{
+    int                  outstanding = 0;
+    omnmAllocator        counting    = { countingMalloc, countingRealloc, countingFree, &outstanding };
+    const omnmAllocator* previous    = NULL;
+    msgPayload           payload     = NULL;
+    msgPayload           sub         = NULL;
+    msgPayload           subResult   = NULL;
+    msgPayloadIter       iter        = NULL;
+    char                 big[512];
+
+    memset (big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getAllocator (&previous));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_setAllocator (&counting));
+
+    // Payload object, spilled buffer, sub-payload cache and iterator
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&payload));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&sub));
+    omnmmsgPayload_addString (sub, NULL, 1, big);
+    omnmmsgPayload_addString (payload, NULL, 1, big);
+    ((OmnmPayloadImpl*) payload)->updateSubMsg (payload, NULL, 2, sub);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (payload, NULL, 2, &subResult));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadIter_create (&iter, payload));
+    EXPECT_GE (outstanding, 6);
+
+    omnmmsgPayloadIter_destroy (iter);
+    omnmmsgPayload_destroy (sub);
+    omnmmsgPayload_destroy (payload);
+    omnmmsgPayloadImpl_drainPool ();
+    EXPECT_EQ (0, outstanding);
+
+    // A payload may have an allocator of its own too
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_setAllocator (previous));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createWithAllocator (&payload, &counting));
+    omnmmsgPayload_addString (payload, NULL, 1, big);
+    EXPECT_EQ (2, outstanding);
+    omnmmsgPayload_destroy (payload);
+    EXPECT_EQ (0, outstanding);
+}
+
+TEST_F(OmnmTests, UpdateFieldDoesNotCreepCapacity)
+{
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) mPayloadBase;
+    char             big[512];
+    char             small[8];
+
+    memset (big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    memset (small, 'y', sizeof(small) - 1);
+    small[sizeof(small) - 1] = '\0';
+
+    omnmmsgPayload_addString (mPayloadBase, NULL, 1, big);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_reserve (mPayloadBase, 4096));
+    size_t capacity = impl->mPayloadBufferSize;
+    EXPECT_GE (capacity, (size_t) 4096);
+
+    // Growing back into space the payload already has never reallocates
+    for (int i = 0; i < 100; i++)
+    {
+        omnmmsgPayload_updateString (mPayloadBase, NULL, 1, small);
+        omnmmsgPayload_updateString (mPayloadBase, NULL, 1, big);
+    }
+    EXPECT_EQ (capacity, impl->mPayloadBufferSize);
+}
+
+TEST_F(OmnmTests, ShapeLearnerPresizesPayloads)
+{
+    msgPayload payload  = NULL;
+    const void* buffer  = NULL;
+    mama_size_t length  = 0;
+    char        big[1024];
+
+    memset (big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    omnmmsgPayloadImpl_setShapeLearning (1);
+    omnmmsgPayloadImpl_drainPool ();
+
+    // Publish once to teach the learner the shape
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createForSubject (&payload, "SHAPE.TEST"));
+    omnmmsgPayload_addString (payload, NULL, 1, big);
+    omnmmsgPayload_addString (payload, NULL, 2, big);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_serialize (payload, &buffer, &length));
+    omnmmsgPayload_destroy (payload);
+    omnmmsgPayloadImpl_drainPool ();
+
+    // The next one starts out big enough for everything
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createForSubject (&payload, "SHAPE.TEST"));
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) payload;
+    EXPECT_GE (impl->mPayloadBufferSize, (size_t) length);
+    uint8_t* initial = impl->mPayloadBuffer;
+    omnmmsgPayload_addString (payload, NULL, 1, big);
+    omnmmsgPayload_addString (payload, NULL, 2, big);
+    EXPECT_EQ (initial, impl->mPayloadBuffer);
+    omnmmsgPayload_destroy (payload);
+
+    // Templates are learned the same way
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_createForTemplate (&payload, NULL, 42));
+    omnmmsgPayload_destroy (payload);
+
+    omnmmsgPayloadImpl_setShapeLearning (0);
+}
+
+TEST_F(OmnmTests, ReuseAfterLargePayload)
+{
+    msgPayload  small    = NULL;
+    const void* buffer   = NULL;
+    mama_size_t length   = 0;
+    mama_u32_t  value    = 0;
+    std::vector<char> big (64 * 1024, 'x');
+    big.back() = '\0';
+
+    omnmmsgPayload_create (&small);
+    omnmmsgPayload_addU32 (small, NULL, 2, 2);
+
+    // Grow to a high water mark, then reuse for something tiny
+    omnmmsgPayload_addString (mPayloadBase, NULL, 1, &big[0]);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_clear (mPayloadBase));
+    EXPECT_EQ (MAMA_STATUS_NOT_FOUND, omnmmsgPayload_getU32 (mPayloadBase, NULL, 1, &value));
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 1);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (mPayloadBase, NULL, 1, &value));
+    EXPECT_EQ (1u, value);
+
+    // Decoding over it only leaves the new fields behind
+    omnmmsgPayload_serialize (small, &buffer, &length);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (mPayloadBase, buffer, length));
+    EXPECT_EQ (MAMA_STATUS_NOT_FOUND, omnmmsgPayload_getU32 (mPayloadBase, NULL, 1, &value));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (mPayloadBase, NULL, 2, &value));
+    EXPECT_EQ (2u, value);
+
+    // Decoding a payload's own buffer back into it leaves it intact
+    omnmmsgPayload_serialize (small, &buffer, &length);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (small, buffer, length));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (small, NULL, 2, &value));
+    EXPECT_EQ (2u, value);
+
+    omnmmsgPayload_destroy (small);
+}
+
+TEST_F(OmnmTests, TrimPolicyShrinksAfterSmallUses)
+{
+    OmnmPayloadImpl*      impl   = (OmnmPayloadImpl*) mPayloadBase;
+    omnmPayloadTrimPolicy policy = { 1024, 3 };
+    std::vector<char>     big (64 * 1024, 'x');
+    big.back() = '\0';
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_setPayloadTrimPolicy (mPayloadBase, &policy));
+
+    // An outlier grows the buffer, which survives the first few small uses
+    omnmmsgPayload_addString (mPayloadBase, NULL, 1, &big[0]);
+    omnmmsgPayload_clear (mPayloadBase);
+    for (int i = 0; i < 2; i++)
+    {
+        omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 1);
+        omnmmsgPayload_clear (mPayloadBase);
+        EXPECT_GT (impl->mPayloadBufferSize, big.size());
+    }
+
+    // ... but not the third in a row
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 1);
+    omnmmsgPayload_clear (mPayloadBase);
+    EXPECT_LE (impl->mPayloadBufferSize, (size_t) 1024);
+
+    // Shrinking to fit keeps the contents
+    mama_u32_t value = 0;
+    omnmmsgPayload_addString (mPayloadBase, NULL, 1, &big[0]);
+    omnmmsgPayload_updateString (mPayloadBase, NULL, 1, "small");
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 2, 2);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_shrinkToFit (mPayloadBase));
+    EXPECT_LE (impl->mPayloadBufferSize, (size_t) 1024);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (mPayloadBase, NULL, 2, &value));
+    EXPECT_EQ (2u, value);
+
+    // Decoding its own buffer back into itself is left until after the
+    // contents have been read, however small they are
+    policy.mSmallUses = 1;
+    const void*       buffer = NULL;
+    mama_size_t       length = 0;
+    const char*       str    = NULL;
+    std::string       medium (600, 'm');
+    omnmmsgPayloadImpl_setPayloadTrimPolicy (mPayloadBase, &policy);
+    omnmmsgPayload_clear (mPayloadBase);
+    omnmmsgPayload_addString (mPayloadBase, NULL, 1, std::string (8000, 'l').c_str());
+    omnmmsgPayload_clear (mPayloadBase);
+    omnmmsgPayload_addString (mPayloadBase, NULL, 1, medium.c_str());
+    ASSERT_GT (impl->mPayloadBufferSize, (size_t) 1024);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_serialize (mPayloadBase, &buffer, &length));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (mPayloadBase, buffer, length));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (mPayloadBase, NULL, 1, &str));
+    EXPECT_EQ (medium, str);
+
+    // An outlier vector of messages leaves the field cache holding one
+    // element each, which is let go of just the same
+    const msgPayload* vector   = NULL;
+    msgPayload        element  = NULL;
+    mama_size_t       size     = 0;
+    omnmMemoryStats   grown;
+    omnmMemoryStats   trimmed;
+    omnmmsgPayload_clear (mPayloadBase);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_beginVectorMsg (mPayloadBase, NULL, 1));
+    for (mama_u32_t i = 0; i < 512; i++)
+    {
+        ASSERT_EQ (MAMA_STATUS_OK,
+                   omnmmsgPayloadImpl_beginVectorMsgElement (mPayloadBase, &element));
+        omnmmsgPayload_addU32 (element, NULL, 1, i);
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endSubMsg (mPayloadBase));
+    }
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endVectorMsg (mPayloadBase));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getVectorMsg (mPayloadBase, NULL, 1, &vector, &size));
+    ASSERT_EQ (512u, size);
+    ASSERT_GT (impl->mField.mCache->mVectorPayloadLen, (size_t) 1024);
+    omnmmsgPayloadImpl_getMemoryStats (&grown);
+
+    omnmmsgPayload_clear (mPayloadBase);
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 1);
+    omnmmsgPayload_clear (mPayloadBase);
+    EXPECT_EQ (NULL, impl->mField.mCache->mVectorPayload);
+    EXPECT_EQ (0u, impl->mField.mCache->mVectorPayloadLen);
+    omnmmsgPayloadImpl_getMemoryStats (&trimmed);
+    EXPECT_LE (trimmed.mCacheBytes + 512 * sizeof(msgPayload), grown.mCacheBytes);
+
+    omnmmsgPayloadImpl_setPayloadTrimPolicy (mPayloadBase, NULL);
+}
+
+TEST_F(OmnmTests, FieldCacheAllocatedOnlyWhenNeeded)
+{
+    msgPayloadIter      iter     = NULL;
+    msgFieldPayload     field    = NULL;
+    const char*         values[] = { "one", "two" };
+    const char**        result   = NULL;
+    mama_size_t         size     = 0;
+    mama_u32_t          value    = 0;
+
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 1);
+    omnmmsgPayload_addVectorString (mPayloadBase, NULL, 2, values, 2);
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadIter_create (&iter, mPayloadBase));
+
+    // Scalar reads never touch the cache
+    field = omnmmsgPayloadIter_next (iter, NULL, mPayloadBase);
+    ASSERT_TRUE (NULL != field);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgFieldPayload_getU32 (field, &value));
+    EXPECT_EQ (1u, value);
+    EXPECT_TRUE (NULL == ((omnmFieldImpl*) field)->mCache);
+
+    // ... whereas vector getters need somewhere to put their results
+    field = omnmmsgPayloadIter_next (iter, NULL, mPayloadBase);
+    ASSERT_TRUE (NULL != field);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgFieldPayload_getVectorString (field, &result, &size));
+    EXPECT_EQ (2u, size);
+    EXPECT_STREQ ("two", result[1]);
+    EXPECT_TRUE (NULL != ((omnmFieldImpl*) field)->mCache);
+
+    omnmmsgPayloadIter_destroy (iter);
+}
+
+TEST_F(OmnmTests, FrozenPayloadIsReadOnlyAndExactSize)
+{
+    msgPayload          payload   = NULL;
+    msgPayload          sub       = NULL;
+    msgPayload          result    = NULL;
+    const void*         before    = NULL;
+    const void*         after     = NULL;
+    mama_size_t         beforeLen = 0;
+    mama_size_t         afterLen  = 0;
+    mama_size_t         numFields = 0;
+    const char*         str       = NULL;
+    mama_u32_t          value     = 0;
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&payload));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&sub));
+    omnmmsgPayload_addU32 (sub, NULL, 1, 7);
+    omnmmsgPayload_addU32 (payload, NULL, 1, 42);
+    omnmmsgPayload_addString (payload, NULL, 2, "frozen");
+    ((OmnmPayloadImpl*) payload)->updateSubMsg (payload, NULL, 3, sub);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_reserve (payload, 4096));
+    omnmmsgPayload_serialize (payload, &before, &beforeLen);
+    std::vector<char> wire ((const char*) before, (const char*) before + beforeLen);
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_freeze (&payload));
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) payload;
+    EXPECT_EQ (impl->mPayloadBufferTail, impl->mPayloadBufferSize);
+
+    // Costing one payload object on top of the wire bytes, which follow it
+    EXPECT_TRUE (impl->isBufferInline());
+    EXPECT_EQ ((uint8_t*) impl + sizeof(OmnmPayloadImpl), impl->mPayloadBuffer);
+    EXPECT_EQ (sizeof(OmnmPayloadImpl) + beforeLen,
+               OmnmPayloadImpl::getAllocationSize (impl->mInlineCapacity));
+    EXPECT_EQ (NULL, impl->mModes);
+
+    // Everything which reads the payload still works
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_serialize (payload, &after, &afterLen));
+    ASSERT_EQ (beforeLen, afterLen);
+    EXPECT_EQ (0, memcmp (&wire[0], after, afterLen));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (payload, NULL, 1, &value));
+    EXPECT_EQ (42u, value);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (payload, NULL, 2, &str));
+    EXPECT_STREQ ("frozen", str);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (payload, NULL, 3, &result));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (result, NULL, 1, &value));
+    EXPECT_EQ (7u, value);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getNumFields (payload, &numFields));
+    EXPECT_EQ (3u, numFields);
+
+    // ... whereas anything which would change it is turned away
+    EXPECT_EQ (MAMA_STATUS_NOT_MODIFIABLE, omnmmsgPayload_addU32 (payload, NULL, 4, 1));
+    EXPECT_EQ (MAMA_STATUS_NOT_MODIFIABLE, omnmmsgPayload_updateU32 (payload, NULL, 1, 1));
+    EXPECT_EQ (MAMA_STATUS_NOT_MODIFIABLE, omnmmsgPayload_clear (payload));
+    EXPECT_EQ (MAMA_STATUS_NOT_MODIFIABLE,
+               omnmmsgPayload_unSerialize (payload, &wire[0], wire.size()));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (payload, NULL, 1, &value));
+    EXPECT_EQ (42u, value);
+
+    // Thawing gives back a payload which can be modified again
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_thaw (&payload));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_updateU32 (payload, NULL, 1, 1));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (payload, NULL, 2, &str));
+    EXPECT_STREQ ("frozen", str);
+
+    omnmmsgPayload_destroy (sub);
+    omnmmsgPayload_destroy (payload);
+}
+
+// Counts every call to the allocator rather than what is outstanding
+static void* tallyingMalloc (mama_size_t size, void* closure)
+{
+    (*(int*) closure)++;
+    return malloc (size);
+}
+
+static void* tallyingRealloc (void* memory, mama_size_t size, void* closure)
+{
+    (*(int*) closure)++;
+    return realloc (memory, size);
+}
+
+static void tallyingFree (void* memory, void* closure)
+{
+    free (memory);
+}
+
+TEST_F(OmnmTests, NestedReadsDoNotAllocatePerElement)
+{
+    int                 calls    = 0;
+    omnmAllocator       tallying = { tallyingMalloc, tallyingRealloc, tallyingFree, &calls };
+    msgPayload          payload  = NULL;
+    msgPayload          sub      = NULL;
+    msgPayload          result   = NULL;
+    msgPayloadIter      iter     = NULL;
+    msgFieldPayload     field    = NULL;
+    const msgPayload*   vector   = NULL;
+    msgPayload          elements[10];
+    const void*         buffer   = NULL;
+    mama_size_t         length   = 0;
+    mama_size_t         size     = 0;
+    mama_u32_t          value    = 0;
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&sub));
+    omnmmsgPayload_addU32 (sub, NULL, 1, 7);
+    for (size_t i = 0; i < 10; i++)
+    {
+        elements[i] = sub;
+    }
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createWithAllocator (&payload, &tallying));
+    ((OmnmPayloadImpl*) payload)->updateSubMsg (payload, NULL, 2, sub);
+    omnmmsgPayloadImpl_updateVectorMsgPayload (payload, NULL, 3, elements, 10);
+    omnmmsgPayload_serialize (payload, &buffer, &length);
+    std::vector<char> wire ((const char*) buffer, (const char*) buffer + length);
+
+    // Once the first message has set up the arena, reading through a fresh
+    // iterator only costs the iterator and its field cache, however many
+    // elements there are
+    int before = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        before = calls;
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (payload, &wire[0], wire.size()));
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadIter_create (&iter, payload));
+        field = omnmmsgPayloadIter_next (iter, NULL, payload);
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgFieldPayload_getMsg (field, &result));
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (result, NULL, 1, &value));
+        EXPECT_EQ (7u, value);
+        field = omnmmsgPayloadIter_next (iter, NULL, payload);
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgFieldPayload_getVectorMsg (field, &vector, &size));
+        ASSERT_EQ (10u, size);
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (vector[9], NULL, 1, &value));
+        EXPECT_EQ (7u, value);
+        omnmmsgPayloadIter_destroy (iter);
+    }
+    EXPECT_LE (calls - before, 4);
+
+    // Nor does the arena keep growing while the same message is read through
+    // one iterator after another, as each hands its sub-payloads back
+    omnmArena* arena    = &((OmnmPayloadImpl*) payload)->mArena;
+    size_t     capacity = 0;
+    for (int i = 0; i < 10000; i++)
+    {
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadIter_create (&iter, payload));
+        field = omnmmsgPayloadIter_next (iter, NULL, payload);
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgFieldPayload_getMsg (field, &result));
+        field = omnmmsgPayloadIter_next (iter, NULL, payload);
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgFieldPayload_getVectorMsg (field, &vector, &size));
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (vector[9], NULL, 1, &value));
+        EXPECT_EQ (7u, value);
+        omnmmsgPayloadIter_destroy (iter);
+        if (0 == i)
+        {
+            capacity = omnmmsgArenaImpl_getCapacity (arena);
+        }
+    }
+    EXPECT_EQ (capacity, omnmmsgArenaImpl_getCapacity (arena));
+
+    // The payload's own field cache is kept, so its getters need nothing
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getVectorMsg (payload, NULL, 3, &vector, &size));
+    before = calls;
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (payload, &wire[0], wire.size()));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (payload, NULL, 2, &result));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getVectorMsg (payload, NULL, 3, &vector, &size));
+    EXPECT_EQ (before, calls);
+
+    // An iterator may be destroyed after the message it read, with nothing
+    // left to hand its sub-payloads back to
+    msgPayload gone = NULL;
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&gone));
+    ((OmnmPayloadImpl*) gone)->updateSubMsg (gone, NULL, 2, sub);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadIter_create (&iter, gone));
+    field = omnmmsgPayloadIter_next (iter, NULL, gone);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgFieldPayload_getMsg (field, &result));
+    omnmmsgPayload_destroy (gone);
+    omnmmsgPayloadIter_destroy (iter);
+
+    omnmmsgPayload_destroy (payload);
+    omnmmsgPayload_destroy (sub);
+}
+
+TEST_F(OmnmTests, HugePageAllocatorBacksPayloads)
+{
+    const omnmAllocator* hugePages = NULL;
+    omnmHugePageStats    stats;
+    msgPayload           payload   = NULL;
+    msgPayload           sub       = NULL;
+    msgPayload           result    = NULL;
+    const char*          value     = NULL;
+    mama_u32_t           number    = 0;
+    char                 big[4096];
+    std::string          huge (4 * 1024 * 1024, 'z');
+
+    memset (big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getHugePageAllocator (&hugePages));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createWithAllocator (&payload, hugePages));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&sub));
+    omnmmsgPayload_addU32 (sub, NULL, 1, 7);
+
+    // Growing moves the buffer between block sizes and finally onto the heap
+    omnmmsgPayload_addString (payload, NULL, 1, big);
+    ((OmnmPayloadImpl*) payload)->updateSubMsg (payload, NULL, 2, sub);
+    omnmmsgPayload_addString (payload, NULL, 3, huge.c_str());
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (payload, NULL, 1, &value));
+    EXPECT_STREQ (big, value);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (payload, NULL, 2, &result));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (result, NULL, 1, &number));
+    EXPECT_EQ (7u, number);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (payload, NULL, 3, &value));
+    EXPECT_EQ (huge.size(), strlen (value));
+
+    // ... and shrinking moves it back again
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_clear (payload));
+    omnmmsgPayload_addString (payload, NULL, 1, big);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_shrinkToFit (payload));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (payload, NULL, 1, &value));
+    EXPECT_STREQ (big, value);
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getHugePageStats (&stats));
+    EXPECT_GE (stats.mHugeTlbRegions + stats.mTransparentRegions
+               + stats.mRegularRegions, 1u);
+    EXPECT_GE (stats.mOversizeAllocations, 1u);
+
+    omnmmsgPayload_destroy (payload);
+    omnmmsgPayload_destroy (sub);
+}
+
+TEST_F(OmnmTests, NodeAllocatorPlacesPayloadMemory)
+{
+    const omnmAllocator* allocator = NULL;
+    omnmNumaStats        before;
+    omnmNumaStats        after;
+    msgPayload           payload   = NULL;
+    int                  node      = -2;
+    char                 big[1024];
+
+    memset (big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getNumaStats (&before));
+    ASSERT_GE (before.mNodes, 1u);
+    EXPECT_LT (before.mLocalNode, before.mNodes);
+
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_getNodeAllocator ((int) before.mNodes, &allocator));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayloadImpl_getNodeAllocator (-2, &allocator));
+
+    ASSERT_EQ (MAMA_STATUS_OK,
+               omnmmsgPayloadImpl_getNodeAllocator ((int) before.mLocalNode, &allocator));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createWithAllocator (&payload, allocator));
+    omnmmsgPayload_addString (payload, NULL, 1, big);
+
+    // Where the pages can be queried, they are on the node asked for
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getNode (payload, &node));
+    EXPECT_TRUE (node == (int) before.mLocalNode || node == -1);
+
+    // Freeing on the node the memory came from isn't a remote free
+    omnmmsgPayload_destroy (payload);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getNumaStats (&after));
+    EXPECT_EQ (before.mRemoteFrees, after.mRemoteFrees);
+}
+
+// Kilobytes the process has locked in memory, or -1 where that can't be told
+static long
+lockedKilobytes ()
+{
+    long  locked = -1;
+#if defined(__linux__)
+    char  line[256];
+    FILE* status = fopen ("/proc/self/status", "r");
+    if (NULL == status) return -1;
+    while (NULL != fgets (line, sizeof(line), status))
+    {
+        if (0 == strncmp (line, "VmLck:", 6))
+        {
+            locked = atol (line + 6);
+        }
+    }
+    fclose (status);
+#endif
+    return locked;
+}
+
+TEST_F(OmnmTests, WarmPoolPrefillsPool)
+{
+    omnmPayloadPoolStats before;
+    omnmPayloadPoolStats after;
+    msgPayload           payload = NULL;
+    char                 big[900];
+
+    memset (big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    omnmmsgPayloadImpl_drainPool ();
+    omnmmsgPayloadImpl_getPoolStats (&before);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_warmPool (8, 1024, 0));
+    omnmmsgPayloadImpl_getPoolStats (&after);
+    EXPECT_EQ (before.mCached + 8, after.mCached);
+
+    // Warming again tops up rather than adding more
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_warmPool (8, 1024, 0));
+    omnmmsgPayloadImpl_getPoolStats (&after);
+    EXPECT_EQ (before.mCached + 8, after.mCached);
+
+    // The first message is served from the pool and doesn't need to grow
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&payload));
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) payload;
+    EXPECT_GE (impl->mPayloadBufferSize, (size_t) 1024);
+    uint8_t* buffer = impl->mPayloadBuffer;
+    omnmmsgPayload_addString (payload, NULL, 1, big);
+    EXPECT_EQ (buffer, impl->mPayloadBuffer);
+    omnmmsgPayload_destroy (payload);
+    omnmmsgPayloadImpl_getPoolStats (&after);
+    EXPECT_EQ (before.mHits + 1, after.mHits);
+
+    // Locking may be refused by the host's limits, but the pool still fills
+    omnmmsgPayloadImpl_drainPool ();
+    mama_status status = omnmmsgPayloadImpl_warmPool (2, 1024, 1);
+    EXPECT_TRUE (MAMA_STATUS_OK == status || MAMA_STATUS_PLATFORM == status);
+    omnmmsgPayloadImpl_getPoolStats (&after);
+    EXPECT_EQ (before.mCached + 2, after.mCached);
+
+    // What was locked is unlocked again as it is freed, such as a buffer
+    // being outgrown
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&payload));
+    impl = (OmnmPayloadImpl*) payload;
+    EXPECT_TRUE (impl->mLockedPages);
+    EXPECT_TRUE (impl->mLockedBuffer);
+    EXPECT_NE ((void*) NULL, impl->mField.mCache);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_reserve (payload, 4096));
+    EXPECT_FALSE (impl->mLockedBuffer);
+    omnmmsgPayload_destroy (payload);
+
+    omnmmsgPayloadImpl_drainPool ();
+
+    // ...down to the pages on the edges of each block, once nothing else
+    // locked is left on them
+    status = omnmmsgPayloadImpl_warmPool (16, 1024, 1);
+    omnmmsgPayloadImpl_drainPool ();
+    if (MAMA_STATUS_OK == status && lockedKilobytes() >= 0)
+    {
+        EXPECT_EQ (0, lockedKilobytes());
+    }
+}
+
+TEST_F(OmnmTests, MemoryStatsTrackPayloadMemory)
+{
+    omnmMemoryStats before;
+    omnmMemoryStats during;
+    omnmMemoryStats after;
+    msgPayload      payload = NULL;
+    msgPayload      sub     = NULL;
+    msgPayload      result  = NULL;
+    char            big[1024];
+
+    memset (big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    omnmmsgPayloadImpl_drainPool ();
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getMemoryStats (&before));
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&payload));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_create (&sub));
+    omnmmsgPayload_addU32 (sub, NULL, 1, 7);
+    omnmmsgPayload_addString (payload, NULL, 1, big);
+    ((OmnmPayloadImpl*) payload)->updateSubMsg (payload, NULL, 2, sub);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (payload, NULL, 2, &result));
+
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) payload;
+    OmnmPayloadImpl* subImpl = (OmnmPayloadImpl*) sub;
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getMemoryStats (&during));
+    EXPECT_EQ (before.mPayloads + 2, during.mPayloads);
+    EXPECT_EQ (before.mBytesReserved
+               + 2 * OmnmPayloadImpl::getAllocationSize (OMNM_INLINE_BUFFER_SIZE)
+               + impl->mPayloadBufferSize
+               + (subImpl->isBufferInline() ? 0 : subImpl->mPayloadBufferSize),
+               during.mBytesReserved);
+    EXPECT_GE (during.mBytesUsed,
+               before.mBytesUsed + impl->mPayloadBufferTail + subImpl->mPayloadBufferTail);
+    EXPECT_GT (during.mCacheBytes, before.mCacheBytes);
+    EXPECT_GT (during.mArenaBytes, before.mArenaBytes);
+    EXPECT_GE (during.mLargestBuffer, (mama_u64_t) impl->mPayloadBufferSize);
+    EXPECT_GE (during.mPeakPayloads, during.mPayloads);
+
+    // Everything is given back once the payloads are freed
+    omnmmsgPayload_destroy (payload);
+    omnmmsgPayload_destroy (sub);
+    omnmmsgPayloadImpl_drainPool ();
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getMemoryStats (&after));
+    EXPECT_EQ (before.mPayloads, after.mPayloads);
+    EXPECT_EQ (before.mBytesReserved, after.mBytesReserved);
+    EXPECT_EQ (before.mBytesUsed, after.mBytesUsed);
+    EXPECT_EQ (before.mCacheBytes, after.mCacheBytes);
+    EXPECT_EQ (before.mArenaBytes, after.mArenaBytes);
+    EXPECT_EQ (during.mPeakPayloads, after.mPeakPayloads);
+}
+
+TEST_F(OmnmTests, ViewModeBorrowsUntilFirstWrite)
+{
+    msgPayload  view   = NULL;
+    msgPayload  copy   = NULL;
+    const void* buffer = NULL;
+    mama_size_t bufferLen = 0;
+    const char* str    = NULL;
+    mama_u32_t  u32    = 0;
+
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 42);
+    omnmmsgPayload_addString (mPayloadBase, NULL, 2, "borrowed");
+    omnmmsgPayload_serialize (mPayloadBase, &buffer, &bufferLen);
+    std::vector<uint8_t> wire ((const uint8_t*) buffer, (const uint8_t*) buffer + bufferLen);
+    std::vector<uint8_t> original (wire);
+
+    // Reads come straight from the caller's buffer
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createView (&view, wire.data(), wire.size()));
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) view;
+    EXPECT_EQ (wire.data(), impl->mPayloadBuffer);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (view, NULL, 1, &u32));
+    EXPECT_EQ (42u, u32);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (view, NULL, 2, &str));
+    EXPECT_STREQ ("borrowed", str);
+
+    // A copy of a view has a buffer of its own
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_copy (view, &copy));
+    EXPECT_NE (wire.data(), ((OmnmPayloadImpl*) copy)->mPayloadBuffer);
+
+    // The first write copies, leaving the caller's buffer as it was
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_updateU32 (view, NULL, 1, 43));
+    EXPECT_NE (wire.data(), impl->mPayloadBuffer);
+    EXPECT_TRUE (original == wire);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (view, NULL, 1, &u32));
+    EXPECT_EQ (43u, u32);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (view, NULL, 2, &str));
+    EXPECT_STREQ ("borrowed", str);
+
+    // Growing a view copies too
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (view, wire.data(), wire.size()));
+    EXPECT_EQ (wire.data(), impl->mPayloadBuffer);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_addString (view, NULL, 3, "added"));
+    EXPECT_NE (wire.data(), impl->mPayloadBuffer);
+    EXPECT_TRUE (original == wire);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (view, NULL, 1, &u32));
+    EXPECT_EQ (42u, u32);
+
+    // Clearing hands the caller's buffer back without touching it
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (view, wire.data(), wire.size()));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_clear (view));
+    EXPECT_NE (wire.data(), impl->mPayloadBuffer);
+    EXPECT_TRUE (original == wire);
+
+    // Buffers in the other byte order are converted, so always copied
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_swapByteOrder (wire.data(), wire.size()));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (view, wire.data(), wire.size()));
+    EXPECT_NE (wire.data(), impl->mPayloadBuffer);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (view, NULL, 1, &u32));
+    EXPECT_EQ (42u, u32);
+
+    // Destroying a view leaves the caller's buffer alone
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_swapByteOrder (wire.data(), wire.size()));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (view, wire.data(), wire.size()));
+    omnmmsgPayload_destroy (view);
+    omnmmsgPayload_destroy (copy);
+    EXPECT_TRUE (original == wire);
+}
+
+TEST_F(OmnmTests, DetachAndAdoptBuffersWithoutCopying)
+{
+    msgPayload         received = NULL;
+    void*              buffer   = NULL;
+    mama_size_t        bufferLen = 0;
+    omnmBufferFreeFunc freeFunc = NULL;
+    void*              closure  = NULL;
+    const char*        str      = NULL;
+    mama_u32_t         u32      = 0;
+    char               big[1024];
+
+    memset (big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    // A payload on the heap hands over the very buffer it was built in
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 42);
+    omnmmsgPayload_addString (mPayloadBase, NULL, 2, big);
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) mPayloadBase;
+    uint8_t*    built    = impl->mPayloadBuffer;
+    mama_size_t builtLen = impl->mPayloadBufferTail;
+    size_t      capacity = impl->mPayloadBufferSize;
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_detachBuffer (mPayloadBase, &buffer,
+                                                                &bufferLen, &freeFunc,
+                                                                &closure));
+    EXPECT_EQ (built, buffer);
+    EXPECT_EQ (builtLen, bufferLen);
+    EXPECT_TRUE (NULL != freeFunc);
+
+    // ...and is left empty, with room for the next one
+    EXPECT_EQ (impl->getHeaderSize(), impl->mPayloadBufferTail);
+    EXPECT_NE (built, impl->mPayloadBuffer);
+    EXPECT_GE (impl->mPayloadBufferSize, capacity);
+    EXPECT_EQ (MAMA_STATUS_NOT_FOUND, omnmmsgPayload_getU32 (mPayloadBase, NULL, 1, &u32));
+
+    // The receiving side takes the same buffer over
+    omnmmsgPayload_create (&received);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_adoptBuffer (received, buffer,
+                                                               bufferLen, capacity));
+    EXPECT_EQ (buffer, ((OmnmPayloadImpl*) received)->mPayloadBuffer);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (received, NULL, 1, &u32));
+    EXPECT_EQ (42u, u32);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (received, NULL, 2, &str));
+    EXPECT_STREQ (big, str);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_addU32 (received, NULL, 3, 7));
+
+    // A payload still in its inline buffer has to be copied out
+    omnmmsgPayload_clear (mPayloadBase);
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 43);
+    bool inlined = impl->isBufferInline();
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_detachBuffer (mPayloadBase, &buffer,
+                                                                &bufferLen, &freeFunc,
+                                                                &closure));
+    if (inlined)
+    {
+        EXPECT_NE ((void*) impl->mInlineBuffer, buffer);
+    }
+
+    // Buffers in the other byte order are converted where they are
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_swapByteOrder (buffer, bufferLen));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_adoptBuffer (received, buffer,
+                                                               bufferLen, bufferLen));
+    EXPECT_EQ (buffer, ((OmnmPayloadImpl*) received)->mPayloadBuffer);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (received, NULL, 1, &u32));
+    EXPECT_EQ (43u, u32);
+
+    // A buffer in the other byte order which turns out to be cut short is
+    // rejected before any of it is converted
+    omnmmsgPayload_clear (mPayloadBase);
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 44);
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 2, 45);
+    omnmmsgPayload_addString (mPayloadBase, NULL, 3, "truncated");
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_detachBuffer (mPayloadBase, &buffer,
+                                                                &bufferLen, &freeFunc,
+                                                                &closure));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_swapByteOrder (buffer, bufferLen));
+    std::vector<uint8_t> before ((uint8_t*) buffer, (uint8_t*) buffer + bufferLen);
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_adoptBuffer (received, buffer,
+                                               bufferLen - 1, bufferLen));
+    EXPECT_EQ (0, memcmp (before.data(), buffer, bufferLen));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (received, NULL, 1, &u32));
+    EXPECT_EQ (43u, u32);
+    freeFunc (buffer, closure);
+
+    // Anything rejected is still the caller's to free
+    void* bad = calloc (1, 2);
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_adoptBuffer (received, bad, 2, 2));
+    freeFunc (bad, closure);
+
+    omnmmsgPayload_destroy (received);
+}
+
+struct OverflowRegion
+{
+    std::vector<uint8_t> mRegion;
+    int                  mCalls;
+    bool                 mRefuse;
+};
+
+static void*
+growRegion (msgPayload msg, mama_size_t required, mama_size_t* capacity, void* closure)
+{
+    OverflowRegion* overflow = (OverflowRegion*) closure;
+    overflow->mCalls++;
+    if (overflow->mRefuse)
+    {
+        return NULL;
+    }
+    overflow->mRegion.resize (required * 2);
+    *capacity = overflow->mRegion.size();
+    return overflow->mRegion.data();
+}
+
+TEST_F(OmnmTests, AttachedBufferIsBuiltInPlace)
+{
+    msgPayload     decoded   = NULL;
+    void*          region    = NULL;
+    mama_size_t    bufferLen = 0;
+    const char*    str       = NULL;
+    mama_u32_t     u32       = 0;
+    OverflowRegion overflow;
+    uint8_t        slot[64];
+
+    overflow.mCalls  = 0;
+    overflow.mRefuse = true;
+
+    // Fields are encoded straight into the slot
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) mPayloadBase;
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_attachBuffer (mPayloadBase, slot,
+                                                                sizeof(slot), growRegion,
+                                                                &overflow));
+    EXPECT_EQ (slot, impl->mPayloadBuffer);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 42));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_addString (mPayloadBase, NULL, 2, "ring"));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_updateString (mPayloadBase, NULL, 2, "ringslot"));
+    EXPECT_EQ (slot, impl->mPayloadBuffer);
+    EXPECT_EQ (0, overflow.mCalls);
+
+    // A refused overflow fails the write and leaves the message intact
+    mama_size_t before = impl->mPayloadBufferTail;
+    EXPECT_EQ (MAMA_STATUS_NOMEM,
+               omnmmsgPayload_addString (mPayloadBase, NULL, 3,
+                                         "far too long to fit in what is left of the slot"));
+    EXPECT_EQ (1, overflow.mCalls);
+    EXPECT_EQ (before, impl->mPayloadBufferTail);
+    EXPECT_EQ (slot, impl->mPayloadBuffer);
+
+    // Otherwise the message moves to the region the callback gives it
+    overflow.mRefuse = false;
+    EXPECT_EQ (MAMA_STATUS_OK,
+               omnmmsgPayload_addString (mPayloadBase, NULL, 3,
+                                         "far too long to fit in what is left of the slot"));
+    EXPECT_EQ (2, overflow.mCalls);
+    EXPECT_EQ (overflow.mRegion.data(), impl->mPayloadBuffer);
+
+    // Finishing hands back where the message is without copying it
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_finishBuffer (mPayloadBase, &region,
+                                                                &bufferLen));
+    EXPECT_EQ (overflow.mRegion.data(), region);
+    EXPECT_NE (region, impl->mPayloadBuffer);
+    EXPECT_EQ (impl->getHeaderSize(), impl->mPayloadBufferTail);
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_finishBuffer (mPayloadBase, &region, &bufferLen));
+
+    omnmmsgPayload_create (&decoded);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (decoded, region, bufferLen));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (decoded, NULL, 1, &u32));
+    EXPECT_EQ (42u, u32);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (decoded, NULL, 2, &str));
+    EXPECT_STREQ ("ringslot", str);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (decoded, NULL, 3, &str));
+    EXPECT_STREQ ("far too long to fit in what is left of the slot", str);
+    omnmmsgPayload_destroy (decoded);
+
+    // Without a callback anything which doesn't fit simply fails
+    ASSERT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_attachBuffer (mPayloadBase, slot, 2, NULL, NULL));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_attachBuffer (mPayloadBase, slot,
+                                                                sizeof(slot), NULL, NULL));
+    EXPECT_EQ (MAMA_STATUS_NOMEM,
+               omnmmsgPayload_addString (mPayloadBase, NULL, 3,
+                                         "far too long to fit in what is left of the slot"
+                                         " even when it is empty"));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 7));
+    EXPECT_EQ (slot, impl->mPayloadBuffer);
+    omnmmsgPayload_clear (mPayloadBase);
+    EXPECT_EQ (slot, impl->mPayloadBuffer);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_finishBuffer (mPayloadBase, &region,
+                                                                &bufferLen));
+    EXPECT_EQ ((void*) slot, region);
+    EXPECT_EQ ((mama_size_t) impl->getHeaderSize(), bufferLen);
+}
+
+TEST_F(OmnmTests, FieldsAddedByReferenceSerializeAsSegments)
+{
+    msgPayload         expected  = NULL;
+    const void*        buffer    = NULL;
+    mama_size_t        bufferLen = 0;
+    mama_size_t        size      = 0;
+    const void*        opaque    = NULL;
+    const mama_u32_t*  vector    = NULL;
+    const char*        str       = NULL;
+    omnmIoVec          segments[8];
+    mama_u32_t         count     = 1;
+    mama_size_t        segmentsLen = 0;
+    mama_u32_t         elements[1000];
+    std::string        blob (1 << 20, 'b');
+
+    for (mama_u32_t i = 0; i < 1000; i++)
+    {
+        elements[i] = i;
+    }
+
+    // The bodies stay where they are rather than being copied in
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 42);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_addOpaqueRef (mPayloadBase, NULL, 2,
+                                                                blob.data(), blob.size()));
+    omnmmsgPayload_addString (mPayloadBase, "name", 3, "between");
+    ASSERT_EQ (MAMA_STATUS_OK,
+               omnmmsgPayloadImpl_addVectorRef (mPayloadBase, NULL, 4,
+                                                MAMA_FIELD_TYPE_VECTOR_U32, elements, 1000));
+    EXPECT_EQ (MAMA_STATUS_WRONG_FIELD_TYPE,
+               omnmmsgPayloadImpl_addVectorRef (mPayloadBase, NULL, 5,
+                                                MAMA_FIELD_TYPE_VECTOR_STRING, elements, 1));
+    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) mPayloadBase;
+    EXPECT_LT (impl->mPayloadBufferTail, (size_t) 100);
+
+    // ...and are read from where they are
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getOpaque (mPayloadBase, NULL, 2, &opaque, &size));
+    EXPECT_EQ ((const void*) blob.data(), opaque);
+    EXPECT_EQ (blob.size(), size);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (mPayloadBase, NULL, 3, &str));
+    EXPECT_STREQ ("between", str);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getVectorU32 (mPayloadBase, NULL, 4, &vector, &size));
+    EXPECT_EQ (elements, vector);
+    EXPECT_EQ ((mama_size_t) 1000, size);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getNumFields (mPayloadBase, &size));
+    EXPECT_EQ ((mama_size_t) 4, size);
+
+    // The segments join up into exactly what copying everything in gives
+    omnmmsgPayload_create (&expected);
+    omnmmsgPayload_addU32 (expected, NULL, 1, 42);
+    omnmmsgPayload_addOpaque (expected, NULL, 2, blob.data(), blob.size());
+    omnmmsgPayload_addString (expected, "name", 3, "between");
+    omnmmsgPayload_addVectorU32 (expected, NULL, 4, elements, 1000);
+    omnmmsgPayload_serialize (expected, &buffer, &bufferLen);
+
+    ASSERT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_serializeSegments (mPayloadBase, segments, &count,
+                                                     &segmentsLen));
+    EXPECT_EQ (4u, count);
+    count = 8;
+    ASSERT_EQ (MAMA_STATUS_OK,
+               omnmmsgPayloadImpl_serializeSegments (mPayloadBase, segments, &count,
+                                                     &segmentsLen));
+    EXPECT_EQ (4u, count);
+    EXPECT_EQ ((const void*) blob.data(), segments[1].mBase);
+    std::string joined;
+    for (mama_u32_t i = 0; i < count; i++)
+    {
+        joined.append ((const char*) segments[i].mBase, segments[i].mLength);
+    }
+    ASSERT_EQ (bufferLen, segmentsLen);
+    ASSERT_EQ (bufferLen, joined.size());
+    EXPECT_EQ (0, memcmp (buffer, joined.data(), bufferLen));
+    omnmmsgPayload_getByteSize (mPayloadBase, &size);
+    EXPECT_EQ (bufferLen, size);
+
+    // Updating a field held by reference copies everything in first
+    const char replacement[] = "replaced";
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_updateOpaque (mPayloadBase, NULL, 2,
+                                                            replacement,
+                                                            sizeof(replacement)));
+    EXPECT_FALSE (impl->hasRefs());
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getOpaque (mPayloadBase, NULL, 2, &opaque, &size));
+    EXPECT_EQ (sizeof(replacement), size);
+    EXPECT_EQ (0, memcmp (replacement, opaque, size));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (mPayloadBase, "name", 3, &str));
+    EXPECT_STREQ ("between", str);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getVectorU32 (mPayloadBase, NULL, 4, &vector, &size));
+    EXPECT_NE (elements, vector);
+    EXPECT_EQ (0, memcmp (elements, vector, sizeof(elements)));
+
+    // Serializing gives a single buffer with the bodies copied in
+    omnmmsgPayload_clear (mPayloadBase);
+    omnmmsgPayloadImpl_addOpaqueRef (mPayloadBase, NULL, 2, blob.data(), blob.size());
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 42);
+    const void* flattened = NULL;
+    omnmmsgPayload_serialize (mPayloadBase, &flattened, &size);
+    EXPECT_FALSE (impl->hasRefs());
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getOpaque (mPayloadBase, NULL, 2, &opaque, &size));
+    EXPECT_NE ((const void*) blob.data(), opaque);
+    EXPECT_EQ (0, memcmp (blob.data(), opaque, blob.size()));
+    mama_u32_t u32 = 0;
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (mPayloadBase, NULL, 1, &u32));
+    EXPECT_EQ (42u, u32);
+
+    omnmmsgPayload_destroy (expected);
+}
+
+TEST_F(OmnmTests, NestedMessagesAreViewsOfTheParent)
+{
+    msgPayload        levels[4] = { NULL, NULL, NULL, NULL };
+    msgPayload        result    = NULL;
+    msgPayload        again     = NULL;
+    const msgPayload* vector    = NULL;
+    mama_size_t       count     = 0;
+    mama_u32_t        u32       = 0;
+    const char*       str       = NULL;
+
+    // Four levels deep, each with a field of its own
+    for (int i = 0; i < 4; i++)
+    {
+        omnmmsgPayload_create (&levels[i]);
+        omnmmsgPayload_addU32 (levels[i], NULL, 1, i);
+    }
+    omnmmsgPayload_addString (levels[3], NULL, 2, "innermost");
+    for (int i = 3; i > 0; i--)
+    {
+        ((OmnmPayloadImpl*) levels[i - 1])->updateSubMsg (levels[i - 1], NULL, 3, levels[i]);
+    }
+    ((OmnmPayloadImpl*) mPayloadBase)->updateSubMsg (mPayloadBase, NULL, 3, levels[0]);
+
+    // Every level reads the root's buffer in place
+    OmnmPayloadImpl* root = (OmnmPayloadImpl*) mPayloadBase;
+    msgPayload       current = mPayloadBase;
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (current, NULL, 3, &result));
+        OmnmPayloadImpl* view = (OmnmPayloadImpl*) result;
+        EXPECT_GE (view->mPayloadBuffer, root->mPayloadBuffer);
+        EXPECT_LT (view->mPayloadBuffer, root->mPayloadBuffer + root->mPayloadBufferTail);
+        EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (result, NULL, 1, &u32));
+        EXPECT_EQ ((mama_u32_t) i, u32);
+
+        // The same view is handed out again
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (current, NULL, 3, &again));
+        EXPECT_EQ (result, again);
+        current = result;
+    }
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (current, NULL, 2, &str));
+    EXPECT_STREQ ("innermost", str);
+
+    // Modifying a view copies it, leaving the parent as it was
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (mPayloadBase, NULL, 3, &result));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_updateU32 (result, NULL, 1, 99));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (result, NULL, 1, &u32));
+    EXPECT_EQ (99u, u32);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (mPayloadBase, NULL, 3, &again));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (again, NULL, 1, &u32));
+    EXPECT_EQ (0u, u32);
+
+    // A view can be written back into the payload it reads from, even when
+    // that has to grow
+    std::string padding (4096, 'p');
+    omnmmsgPayload_addString (mPayloadBase, NULL, 4, padding.c_str());
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (mPayloadBase, NULL, 3, &result));
+    EXPECT_EQ (MAMA_STATUS_OK,
+               ((OmnmPayloadImpl*) mPayloadBase)->updateSubMsg (mPayloadBase, NULL, 5, result));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (mPayloadBase, NULL, 5, &result));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (result, NULL, 1, &u32));
+    EXPECT_EQ (0u, u32);
+
+    // Or replace it outright, whether decoded from the view or copied
+    const void*  serialized    = NULL;
+    mama_size_t  serializedLen = 0;
+    msgPayload   destination   = mPayloadBase;
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (mPayloadBase, NULL, 3, &result));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_serialize (result, &serialized, &serializedLen));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (mPayloadBase, serialized, serializedLen));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (mPayloadBase, NULL, 1, &u32));
+    EXPECT_EQ (0u, u32);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (mPayloadBase, NULL, 3, &result));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (result, NULL, 1, &u32));
+    EXPECT_EQ (1u, u32);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_copy (result, &destination));
+    EXPECT_EQ (mPayloadBase, destination);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (mPayloadBase, NULL, 1, &u32));
+    EXPECT_EQ (1u, u32);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (mPayloadBase, NULL, 3, &result));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (result, NULL, 1, &u32));
+    EXPECT_EQ (2u, u32);
+
+    // Each message in a vector is found by its own length
+    omnmmsgPayloadImpl_updateVectorMsgPayload (mPayloadBase, NULL, 6, levels, 4);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getVectorMsg (mPayloadBase, NULL, 6,
+                                                            &vector, &count));
+    ASSERT_EQ ((mama_size_t) 4, count);
+    for (int i = 0; i < 4; i++)
+    {
+        EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (vector[i], NULL, 1, &u32));
+        EXPECT_EQ ((mama_u32_t) i, u32);
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        omnmmsgPayload_destroy (levels[i]);
+    }
+}
+
+TEST_F(OmnmTests, SubMessagesAreBuiltInPlace)
+{
+    msgPayload   expected       = NULL;
+    msgPayload   inner          = NULL;
+    msgPayload   outer          = NULL;
+    msgPayload   child          = NULL;
+    msgPayload   grandchild     = NULL;
+    msgPayload   elements[3]    = { NULL, NULL, NULL };
+    const void*  expectedBuffer = NULL;
+    const void*  builtBuffer    = NULL;
+    mama_size_t  expectedLen    = 0;
+    mama_size_t  builtLen       = 0;
+
+    // Large enough that the parent has to grow while children are open
+    std::string padding (4096, 'p');
+
+    // The conventional way, each sub-message built separately then copied
+    omnmmsgPayload_create (&expected);
+    omnmmsgPayload_create (&outer);
+    omnmmsgPayload_create (&inner);
+    omnmmsgPayload_addU32 (expected, NULL, 1, 1);
+    omnmmsgPayload_addU32 (inner, NULL, 1, 2);
+    omnmmsgPayload_addU32 (outer, NULL, 1, 1);
+    omnmmsgPayload_addString (outer, NULL, 2, padding.c_str());
+    ((OmnmPayloadImpl*) outer)->updateSubMsg (outer, NULL, 3, inner);
+    ((OmnmPayloadImpl*) expected)->updateSubMsg (expected, NULL, 3, outer);
+    for (int i = 0; i < 3; i++)
+    {
+        omnmmsgPayload_create (&elements[i]);
+        omnmmsgPayload_addU32 (elements[i], NULL, 1, i);
+        omnmmsgPayload_addString (elements[i], NULL, 2, padding.c_str());
+    }
+    omnmmsgPayloadImpl_updateVectorMsgPayload (expected, NULL, 6, elements, 3);
+    omnmmsgPayload_addU32 (expected, NULL, 7, 7);
+
+    // The same again, built in place
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 1);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_beginSubMsg (mPayloadBase, NULL, 3, &child));
+    omnmmsgPayload_addU32 (child, NULL, 1, 1);
+    omnmmsgPayload_addString (child, NULL, 2, padding.c_str());
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_beginSubMsg (child, NULL, 3, &grandchild));
+    omnmmsgPayload_addU32 (grandchild, NULL, 1, 2);
+
+    // Nothing can be finished out of order
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayloadImpl_endSubMsg (mPayloadBase));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_beginSubMsg (mPayloadBase, NULL, 4, &outer));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endSubMsg (child));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endSubMsg (mPayloadBase));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayloadImpl_endSubMsg (mPayloadBase));
+
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_beginVectorMsg (mPayloadBase, NULL, 6));
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT_EQ (MAMA_STATUS_OK,
+                   omnmmsgPayloadImpl_beginVectorMsgElement (mPayloadBase, &child));
+        omnmmsgPayload_addU32 (child, NULL, 1, i);
+        omnmmsgPayload_addString (child, NULL, 2, padding.c_str());
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endSubMsg (mPayloadBase));
+    }
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_beginSubMsg (mPayloadBase, NULL, 4, &child));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endVectorMsg (mPayloadBase));
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 7, 7);
+
+    // Byte for byte the same
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_serialize (expected, &expectedBuffer, &expectedLen));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_serialize (mPayloadBase, &builtBuffer, &builtLen));
+    ASSERT_EQ (expectedLen, builtLen);
+    EXPECT_EQ (0, memcmp (expectedBuffer, builtBuffer, builtLen));
+
+    // Nothing can be added to or updated in the parent while a child or
+    // vector is open, which leaves the child as it was
+    msgPayload view = NULL;
+    mama_u32_t u32  = 0;
+    omnmmsgPayload_clear (mPayloadBase);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_beginSubMsg (mPayloadBase, NULL, 3, &child));
+    omnmmsgPayload_addU32 (child, NULL, 1, 1);
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayload_addString (mPayloadBase, NULL, 2, padding.c_str()));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayload_updateU32 (mPayloadBase, NULL, 1, 1));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayloadImpl_reserve (mPayloadBase, 65536));
+    omnmmsgPayload_addString (child, NULL, 2, padding.c_str());
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endSubMsg (mPayloadBase));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (mPayloadBase, NULL, 3, &view));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (view, NULL, 1, &u32));
+    EXPECT_EQ (1u, u32);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_beginVectorMsg (mPayloadBase, NULL, 6));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayload_addU32 (mPayloadBase, NULL, 7, 7));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endVectorMsg (mPayloadBase));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_addU32 (mPayloadBase, NULL, 7, 7));
+
+    // Clearing the parent abandons the child, and it can be used again
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_beginSubMsg (mPayloadBase, NULL, 4, &child));
+    omnmmsgPayload_clear (mPayloadBase);
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayloadImpl_endSubMsg (mPayloadBase));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_beginSubMsg (mPayloadBase, NULL, 3, &child));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endSubMsg (mPayloadBase));
+
+    for (int i = 0; i < 3; i++)
+    {
+        omnmmsgPayload_destroy (elements[i]);
+    }
+    omnmmsgPayload_destroy (inner);
+    omnmmsgPayload_destroy (outer);
+    omnmmsgPayload_destroy (expected);
+}
+
+TEST_F(OmnmTests, SubMessagesAreUpdatedInPlace)
+{
+    msgPayload       outer          = NULL;
+    msgPayload       inner          = NULL;
+    msgPayload       expected       = NULL;
+    msgPayload       child          = NULL;
+    msgPayload       grandchild     = NULL;
+    msgPayload       result         = NULL;
+    msgFieldPayload  field          = NULL;
+    const void*      expectedBuffer = NULL;
+    const void*      updatedBuffer  = NULL;
+    mama_size_t      expectedLen    = 0;
+    mama_size_t      updatedLen     = 0;
+    mama_u32_t       u32            = 0;
+    const char*      str            = NULL;
+
+    omnmmsgPayload_create (&outer);
+    omnmmsgPayload_create (&inner);
+    omnmmsgPayload_addU32 (inner, NULL, 1, 5);
+    omnmmsgPayload_addString (inner, NULL, 2, "short");
+    omnmmsgPayload_addU32 (outer, NULL, 1, 1);
+    ((OmnmPayloadImpl*) outer)->updateSubMsg (outer, NULL, 3, inner);
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 1);
+    ((OmnmPayloadImpl*) mPayloadBase)->updateSubMsg (mPayloadBase, NULL, 2, outer);
+    omnmmsgPayload_addString (mPayloadBase, NULL, 9, "trailer");
+
+    // A sub-message of the same size goes straight over the old one, and
+    // one of a different size only moves the fields after it
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getField (mPayloadBase, NULL, 2, &field));
+    omnmmsgPayload_updateU32 (inner, NULL, 1, 6);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgFieldPayload_updateSubMsg (field, mPayloadBase, inner));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getMsg (mPayloadBase, NULL, 2, &result));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (result, NULL, 1, &u32));
+    EXPECT_EQ (6u, u32);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getField (mPayloadBase, NULL, 2, &field));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgFieldPayload_updateSubMsg (field, mPayloadBase, outer));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (mPayloadBase, NULL, 9, &str));
+    EXPECT_STREQ ("trailer", str);
+
+    // A leaf two levels down, changed to something large enough that the
+    // root has to grow
+    std::string padding (4096, 'p');
+    ASSERT_EQ (MAMA_STATUS_OK,
+               omnmmsgPayloadImpl_beginSubMsgUpdate (mPayloadBase, NULL, 2, &child));
+    ASSERT_EQ (MAMA_STATUS_OK,
+               omnmmsgPayloadImpl_beginSubMsgUpdate (child, NULL, 3, &grandchild));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_updateString (grandchild, NULL, 2, padding.c_str()));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_updateU32 (grandchild, NULL, 1, 7));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayloadImpl_endSubMsg (mPayloadBase));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endSubMsg (child));
+    omnmmsgPayload_updateU32 (child, NULL, 1, 2);
+
+    // Until then the fields after it are set aside, so the parent can't be
+    // read whole or sent
+    mama_size_t size = 0;
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (mPayloadBase, NULL, 1, &u32));
+    EXPECT_NE (MAMA_STATUS_OK, omnmmsgPayload_getString (mPayloadBase, NULL, 9, &str));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayload_serialize (mPayloadBase, &updatedBuffer, &updatedLen));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayload_getByteSize (mPayloadBase, &size));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endSubMsg (mPayloadBase));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (mPayloadBase, NULL, 9, &str));
+    EXPECT_STREQ ("trailer", str);
+
+    // Just as if it had been rebuilt from scratch
+    omnmmsgPayload_create (&expected);
+    omnmmsgPayload_updateU32 (inner, NULL, 1, 7);
+    omnmmsgPayload_updateString (inner, NULL, 2, padding.c_str());
+    omnmmsgPayload_updateU32 (outer, NULL, 1, 2);
+    ((OmnmPayloadImpl*) outer)->updateSubMsg (outer, NULL, 3, inner);
+    omnmmsgPayload_addU32 (expected, NULL, 1, 1);
+    ((OmnmPayloadImpl*) expected)->updateSubMsg (expected, NULL, 2, outer);
+    omnmmsgPayload_addString (expected, NULL, 9, "trailer");
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_serialize (expected, &expectedBuffer, &expectedLen));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_serialize (mPayloadBase, &updatedBuffer, &updatedLen));
+    ASSERT_EQ (expectedLen, updatedLen);
+    EXPECT_EQ (0, memcmp (expectedBuffer, updatedBuffer, updatedLen));
+
+    // Only sub-messages can be opened
+    EXPECT_EQ (MAMA_STATUS_WRONG_FIELD_TYPE,
+               omnmmsgPayloadImpl_beginSubMsgUpdate (mPayloadBase, NULL, 1, &child));
+    EXPECT_NE (MAMA_STATUS_OK,
+               omnmmsgPayloadImpl_beginSubMsgUpdate (mPayloadBase, NULL, 99, &child));
+
+    omnmmsgPayload_destroy (expected);
+    omnmmsgPayload_destroy (inner);
+    omnmmsgPayload_destroy (outer);
+}
+
+TEST_F(OmnmTests, CopiesShareBufferUntilWritten)
+{
+    msgPayload   copies[3] = { NULL, NULL, NULL };
+    mama_u32_t   u32       = 0;
+    const char*  str       = NULL;
+
+    // Large enough to be on the heap
+    std::string padding (4096, 'p');
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 1);
+    omnmmsgPayload_addString (mPayloadBase, NULL, 2, padding.c_str());
+
+    OmnmPayloadImpl* source = (OmnmPayloadImpl*) mPayloadBase;
+    uint8_t*         buffer = source->mPayloadBuffer;
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_copy (mPayloadBase, &copies[i]));
+        EXPECT_EQ (buffer, ((OmnmPayloadImpl*) copies[i])->mPayloadBuffer);
+    }
+    EXPECT_EQ (buffer, source->mPayloadBuffer);
+    ASSERT_TRUE (NULL != source->mShared);
+    EXPECT_EQ (4u, source->mShared->mRefs.load());
+
+    // The first write on either side takes a copy of its own
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_updateU32 (copies[0], NULL, 1, 2));
+    EXPECT_NE (buffer, ((OmnmPayloadImpl*) copies[0])->mPayloadBuffer);
+    EXPECT_EQ (3u, source->mShared->mRefs.load());
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_updateU32 (mPayloadBase, NULL, 1, 3));
+    EXPECT_NE (buffer, source->mPayloadBuffer);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (copies[0], NULL, 1, &u32));
+    EXPECT_EQ (2u, u32);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (mPayloadBase, NULL, 1, &u32));
+    EXPECT_EQ (3u, u32);
+
+    // The rest still read the shared buffer, which outlives the payload it
+    // came from, and can be let go of on any thread
+    omnmmsgPayload_destroy (copies[0]);
+    std::thread reader ([&copies, &padding] ()
+    {
+        mama_u32_t  value  = 0;
+        const char* result = NULL;
+        omnmmsgPayload_getU32 (copies[1], NULL, 1, &value);
+        omnmmsgPayload_getString (copies[1], NULL, 2, &result);
+        EXPECT_EQ (1u, value);
+        EXPECT_EQ (padding, result);
+        omnmmsgPayload_destroy (copies[1]);
+    });
+    reader.join();
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (copies[2], NULL, 2, &str));
+    EXPECT_EQ (padding, str);
+    EXPECT_EQ (buffer, ((OmnmPayloadImpl*) copies[2])->mPayloadBuffer);
+
+    // The last holder decoding the shared buffer back into itself lets go of
+    // it only once the contents have been copied out
+    const void*  serialized    = NULL;
+    mama_size_t  serializedLen = 0;
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_serialize (copies[2], &serialized, &serializedLen));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_unSerialize (copies[2], serialized, serializedLen));
+    EXPECT_TRUE (NULL == ((OmnmPayloadImpl*) copies[2])->mShared);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (copies[2], NULL, 1, &u32));
+    EXPECT_EQ (1u, u32);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (copies[2], NULL, 2, &str));
+    EXPECT_EQ (padding, str);
+    omnmmsgPayload_destroy (copies[2]);
+
+    // Payloads small enough to be held inline are still just copied
+    omnmmsgPayload_clear (mPayloadBase);
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 1);
+    copies[0] = NULL;
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayload_copy (mPayloadBase, &copies[0]));
+    EXPECT_EQ (source->mPayloadBufferTail <= OMNM_INLINE_BUFFER_SIZE,
+               NULL == ((OmnmPayloadImpl*) copies[0])->mShared);
+    omnmmsgPayload_destroy (copies[0]);
+}
+
+TEST_F(OmnmTests, BatchesRoundTripPayloadsAsViews)
+{
+    omnmBatch    batch     = NULL;
+    msgPayload   built     = NULL;
+    msgPayload   view      = NULL;
+    msgPayload   reused    = NULL;
+    const void*  frame     = NULL;
+    mama_size_t  frameLen  = 0;
+    mama_u32_t   count     = 0;
+    mama_u32_t   u32       = 0;
+    const char*  str       = NULL;
+    const void*  opaque    = NULL;
+    mama_size_t  opaqueLen = 0;
+
+    // Room for two up front, so the table has to grow along the way
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createBatch (&batch, 2));
+    std::string padding (4096, 'p');
+    char        reference[] = "held by reference";
+    omnmmsgPayload_addU32 (mPayloadBase, NULL, 1, 0);
+    omnmmsgPayloadImpl_addOpaqueRef (mPayloadBase, NULL, 2, reference, sizeof(reference));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_appendToBatch (batch, mPayloadBase));
+
+    // The rest are built in the frame, large enough for it to have to grow
+    // while they are
+    for (mama_u32_t i = 1; i < 5; i++)
+    {
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_beginBatchPayload (batch, &built));
+        EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayloadImpl_appendToBatch (batch, mPayloadBase));
+        omnmmsgPayload_addU32 (built, NULL, 1, i);
+        omnmmsgPayload_addString (built, NULL, 3, padding.c_str());
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_endBatchPayload (batch));
+    }
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG, omnmmsgPayloadImpl_endBatchPayload (batch));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_finishBatch (batch, &frame, &frameLen));
+
+    // Each comes back as a view of the frame
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getBatchCount (frame, frameLen, &count));
+    ASSERT_EQ (5u, count);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getBatchPayload (frame, frameLen, 0, &view));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getOpaque (view, NULL, 2, &opaque, &opaqueLen));
+    EXPECT_EQ (sizeof(reference), opaqueLen);
+    EXPECT_STREQ (reference, (const char*) opaque);
+    omnmmsgPayload_create (&reused);
+    for (mama_u32_t i = 0; i < count; i++)
+    {
+        ASSERT_EQ (MAMA_STATUS_OK,
+                   omnmmsgPayloadImpl_getBatchPayload (frame, frameLen, i, &reused));
+        OmnmPayloadImpl* impl = (OmnmPayloadImpl*) reused;
+        EXPECT_GE (impl->mPayloadBuffer, (const uint8_t*) frame);
+        EXPECT_LT (impl->mPayloadBuffer, (const uint8_t*) frame + frameLen);
+        EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (reused, NULL, 1, &u32));
+        EXPECT_EQ (i, u32);
+        if (0 != i)
+        {
+            EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (reused, NULL, 3, &str));
+            EXPECT_EQ (padding, str);
+        }
+    }
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_getBatchPayload (frame, frameLen, count, &reused));
+
+    // Anything truncated or not a batch at all is turned away
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_getBatchCount (frame, frameLen - 2 * 4096, &count));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_getBatchCount (frame, sizeof(omnmBatchHeader) + 4, &count));
+    const void* payload    = NULL;
+    mama_size_t payloadLen = 0;
+    omnmmsgPayload_serialize (mPayloadBase, &payload, &payloadLen);
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_getBatchCount (payload, payloadLen, &count));
+
+    // A cleared batch starts again from nothing
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_clearBatch (batch));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_finishBatch (batch, &frame, &frameLen));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getBatchCount (frame, frameLen, &count));
+    EXPECT_EQ (0u, count);
+
+    omnmmsgPayload_destroy (reused);
+    omnmmsgPayload_destroy (view);
+    omnmmsgPayloadImpl_destroyBatch (batch);
+}
+
+TEST_F(OmnmTests, StreamDecoderReassemblesFramesFromChunks)
+{
+    omnmStreamDecoder     decoder  = NULL;
+    msgPayload            payloads[3];
+    msgPayload            decoded  = NULL;
+    std::vector<uint8_t>  stream;
+    mama_u32_t            u32      = 0;
+    const char*           str      = NULL;
+
+    // The middle one is large, so straddles chunks of any size tried here
+    std::string padding (3000, 'p');
+    for (mama_u32_t i = 0; i < 3; i++)
+    {
+        const void* buffer = NULL;
+        mama_size_t length = 0;
+        uint8_t     header[OMNM_STREAM_FRAME_HEADER_SIZE];
+        omnmmsgPayload_create (&payloads[i]);
+        omnmmsgPayload_addU32 (payloads[i], NULL, 1, i);
+        if (1 == i)
+        {
+            omnmmsgPayload_addString (payloads[i], NULL, 2, padding.c_str());
+        }
+        omnmmsgPayload_serialize (payloads[i], &buffer, &length);
+        ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_writeFrameHeader (header, length));
+        stream.insert (stream.end(), header, header + sizeof(header));
+        stream.insert (stream.end(), (const uint8_t*) buffer, (const uint8_t*) buffer + length);
+    }
+
+    // However the stream is split up, the same payloads come out of it
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createStreamDecoder (&decoder, 0, 0));
+    size_t chunkSizes[] = { 1, 7, 1000, stream.size() };
+    for (size_t chunkSize : chunkSizes)
+    {
+        mama_u32_t frames = 0;
+        for (size_t offset = 0; offset < stream.size(); offset += chunkSize)
+        {
+            const void* data   = &stream[offset];
+            mama_size_t length = std::min (chunkSize, stream.size() - offset);
+            while (true)
+            {
+                ASSERT_EQ (MAMA_STATUS_OK,
+                           omnmmsgPayloadImpl_decodeStream (decoder, &data, &length, &decoded));
+                if (NULL == decoded)
+                {
+                    break;
+                }
+                EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (decoded, NULL, 1, &u32));
+                EXPECT_EQ (frames, u32);
+                if (1 == frames)
+                {
+                    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getString (decoded, NULL, 2, &str));
+                    EXPECT_EQ (padding, str);
+                }
+
+                // Given the whole stream at once, nothing is copied
+                if (chunkSize == stream.size())
+                {
+                    OmnmPayloadImpl* impl = (OmnmPayloadImpl*) decoded;
+                    EXPECT_GE (impl->mPayloadBuffer, &stream[0]);
+                    EXPECT_LT (impl->mPayloadBuffer, &stream[0] + stream.size());
+                }
+                frames++;
+            }
+            EXPECT_EQ (0u, length);
+        }
+        EXPECT_EQ (3u, frames);
+    }
+    omnmmsgPayloadImpl_destroyStreamDecoder (decoder);
+
+    // Frames over the limit are either skipped without being held...
+    mama_u64_t skipped = 0;
+    mama_u32_t frames  = 0;
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createStreamDecoder (&decoder, 1024, 1));
+    for (size_t offset = 0; offset < stream.size(); offset += 100)
+    {
+        const void* data   = &stream[offset];
+        mama_size_t length = std::min ((size_t) 100, stream.size() - offset);
+        while (MAMA_STATUS_OK == omnmmsgPayloadImpl_decodeStream (decoder, &data, &length, &decoded)
+               && NULL != decoded)
+        {
+            EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayload_getU32 (decoded, NULL, 1, &u32));
+            EXPECT_EQ (0 == frames ? 0u : 2u, u32);
+            frames++;
+        }
+    }
+    EXPECT_EQ (2u, frames);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_getStreamSkipped (decoder, &skipped));
+    EXPECT_EQ (1u, skipped);
+    EXPECT_TRUE (NULL == decoder->mBuffer);
+    omnmmsgPayloadImpl_destroyStreamDecoder (decoder);
+
+    // ...or fail the stream, as does anything which isn't a frame, until the
+    // decoder is reset
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createStreamDecoder (&decoder, 1024, 0));
+    const void* data   = &stream[0];
+    mama_size_t length = stream.size();
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_decodeStream (decoder, &data, &length, &decoded));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_decodeStream (decoder, &data, &length, &decoded));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_decodeStream (decoder, &data, &length, &decoded));
+    uint8_t garbage[OMNM_STREAM_FRAME_HEADER_SIZE] = { 'X' };
+    data   = garbage;
+    length = sizeof(garbage);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_resetStreamDecoder (decoder));
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_decodeStream (decoder, &data, &length, &decoded));
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_resetStreamDecoder (decoder));
+    data   = &stream[0];
+    length = stream.size();
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_decodeStream (decoder, &data, &length, &decoded));
+    EXPECT_TRUE (NULL != decoded);
+
+    // Only payloads are decoded, so a batch sent as a frame fails it too
+    omnmBatch             batch    = NULL;
+    const void*           frame    = NULL;
+    mama_size_t           frameLen = 0;
+    std::vector<uint8_t>  batched (OMNM_STREAM_FRAME_HEADER_SIZE);
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_createBatch (&batch, 0));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_appendToBatch (batch, payloads[0]));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_finishBatch (batch, &frame, &frameLen));
+    ASSERT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_writeFrameHeader (&batched[0], frameLen));
+    batched.insert (batched.end(), (const uint8_t*) frame, (const uint8_t*) frame + frameLen);
+    omnmmsgPayloadImpl_destroyBatch (batch);
+    EXPECT_EQ (MAMA_STATUS_OK, omnmmsgPayloadImpl_resetStreamDecoder (decoder));
+    data   = &batched[0];
+    length = batched.size();
+    EXPECT_EQ (MAMA_STATUS_INVALID_ARG,
+               omnmmsgPayloadImpl_decodeStream (decoder, &data, &length, &decoded));
+    EXPECT_TRUE (NULL == decoded);
+    omnmmsgPayloadImpl_destroyStreamDecoder (decoder);
+
+    for (int i = 0; i < 3; i++)
+    {
+        omnmmsgPayload_destroy (payloads[i]);
+    }
+}
@@ -47,6 +47,836 @@ omnmmsgPayloadImpl_updateVectorMsgPayload (msgPayload          msg,
                                            const msgPayload    value[],
                                            mama_size_t         size);
 
+/**
+ * Rewrites a serialized payload in place into the opposite byte order, as a
+ * host of the other endianness would have published it. Decoding the result
+ * exercises the cross-endian path on little endian hosts.
+ *
+ * @param buffer The serialized payload, as returned by serialize.
+ * @param bufferLength The length of the serialized payload.
+ *
+ * @return MAMA_STATUS_INVALID_ARG if the payload is malformed or doesn't
+ *         declare its byte order.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_swapByteOrder (void* buffer, mama_size_t bufferLength);
+
+/*
+ * Destroyed payloads are kept on a per-thread free list, buffer and all, and
+ * handed out again by create. A payload destroyed on another thread goes back
+ * to the thread which created it. These counters cover every thread,
+ * including those which have since exited.
+ */
+typedef struct omnmPayloadPoolStats
+{
+    mama_u64_t mHits;           /* creates served from a pool */
+    mama_u64_t mMisses;         /* creates which had to allocate */
+    mama_u64_t mReleases;       /* destroys which returned the payload to a pool */
+    mama_u64_t mRemoteReleases; /* ... of which went to another thread's pool */
+    mama_u64_t mDiscards;       /* destroys which found the pool full */
+    mama_u64_t mCached;         /* payloads currently held by pools */
+} omnmPayloadPoolStats;
+
+/**
+ * Sets the payload pool limits for every thread.
+ *
+ * @param maxPayloadsPerThread The most payloads each thread will keep. Other
+ *        threads may hand back up to 16 times as many of its payloads
+ *        before it next takes them. 0 disables pooling.
+ * @param maxBufferSize Payloads whose buffer has grown beyond this give it
+ *        up before going back into the pool.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_setPoolLimits (mama_size_t maxPayloadsPerThread,
+                                  mama_size_t maxBufferSize);
+
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getPoolLimits (mama_size_t* maxPayloadsPerThread,
+                                  mama_size_t* maxBufferSize);
+
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getPoolStats (omnmPayloadPoolStats* stats);
+
+/**
+ * Frees every payload held in the calling thread's pool.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_drainPool (void);
+
+/**
+ * Fills the calling thread's pool ahead of the first messages, so that
+ * creating them neither allocates nor page faults. Each payload is given a
+ * buffer of the requested capacity and a field cache, and every page of
+ * both is touched.
+ *
+ * @param payloads The number of payloads the pool should hold, capped at
+ *        the pool limit.
+ * @param capacity The buffer capacity of each, capped at the pool's
+ *        largest buffer size.
+ * @param lockPages Non-zero to also mlock the pages. They are unlocked as
+ *        the memory is freed, whether by draining or trimming the pool or
+ *        by a buffer being grown or shrunk. A page shared by several
+ *        payloads stays locked until the last of them is freed.
+ *
+ * @return MAMA_STATUS_PLATFORM if the pool was filled but the pages could
+ *         not all be locked, e.g. because of RLIMIT_MEMLOCK.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_warmPool (mama_size_t payloads,
+                             mama_size_t capacity,
+                             int         lockPages);
+
+/*
+ * How much memory the bridge holds, summed over counters each thread keeps
+ * for itself. Pooled payloads count as they still hold their memory; the
+ * pool stats say how many of them there are.
+ */
+typedef struct omnmMemoryStats
+{
+    mama_u64_t mPayloads;          /* payload objects, pooled ones included */
+    mama_u64_t mBytesReserved;     /* those objects plus every heap buffer */
+    mama_u64_t mBytesUsed;         /* serialized bytes held in the buffers */
+    mama_u64_t mCacheBytes;        /* field caches and the vectors they hold */
+    mama_u64_t mArenaBytes;        /* arena blocks holding sub-payloads */
+    mama_u64_t mLargestBuffer;     /* largest heap buffer any payload has had */
+    mama_u64_t mPeakPayloads;      /* highest mPayloads returned so far */
+    mama_u64_t mPeakBytesReserved; /* highest mBytesReserved returned so far */
+} omnmMemoryStats;
+
+/**
+ * Sums the memory gauges of every thread, including those which have since
+ * exited. Cheap enough to poll, which is also what keeps the peaks current.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getMemoryStats (omnmMemoryStats* stats);
+
+/*
+ * Memory callbacks used for everything the payload allocates: the payload
+ * objects themselves, their buffers, field caches, sub-payloads and
+ * iterators. Each callback is handed mClosure. Memory returned by mMalloc and
+ * mRealloc must be suitably aligned for any type, as malloc's is.
+ *
+ * The library keeps a pointer to the struct rather than a copy, so it must
+ * outlive every payload created with it.
+ */
+typedef struct omnmAllocator
+{
+    void* (*mMalloc)  (mama_size_t size, void* closure);
+    void* (*mRealloc) (void* memory, mama_size_t size, void* closure);
+    void  (*mFree)    (void* memory, void* closure);
+    void*  mClosure;
+} omnmAllocator;
+
+/**
+ * Sets the allocator used by payloads subsequently created through the
+ * bridge. Existing payloads keep using the allocator they were created with,
+ * as do any left in the payload pools until those are drained.
+ *
+ * @param allocator The allocator to use, or NULL to go back to the heap.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_setAllocator (const omnmAllocator* allocator);
+
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getAllocator (const omnmAllocator** allocator);
+
+/**
+ * Creates a payload which uses its own allocator rather than the bridge
+ * wide one. Sub-payloads and field caches of this payload use it too. Such
+ * payloads bypass the payload pools.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_createWithAllocator (msgPayload*           msg,
+                                        const omnmAllocator*  allocator);
+
+/*
+ * The bridge provides an allocator which carves memory out of 2MB regions,
+ * each backed by a huge page where the platform allows, to cut TLB misses
+ * when many payloads are live at once. It falls back to transparent huge
+ * pages and then to regular pages without any action from the caller.
+ * Setting the property mama.omnmmsg.hugepages=true makes it the bridge wide
+ * allocator when the bridge is loaded.
+ */
+typedef struct omnmHugePageStats
+{
+    mama_u64_t mHugeTlbRegions;      /* regions backed by reserved huge pages */
+    mama_u64_t mTransparentRegions;  /* regions advised to use transparent ones */
+    mama_u64_t mRegularRegions;      /* regions using regular pages */
+    mama_u64_t mOversizeAllocations; /* allocations too large for a region */
+} omnmHugePageStats;
+
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getHugePageAllocator (const omnmAllocator** allocator);
+
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getHugePageStats (omnmHugePageStats* stats);
+
+/*
+ * The huge page allocator keeps separate regions per NUMA node and carves
+ * from the calling thread's node, so payloads built and pooled on a thread
+ * stay close to it. Placement needs the bridge to be built WITH_NUMA; it is
+ * then used by default on hosts with several nodes, unless the property
+ * mama.omnmmsg.numa=false is set. Otherwise the host counts as one node.
+ */
+#define OMNM_NUMA_LOCAL_NODE -1
+
+typedef struct omnmNumaStats
+{
+    mama_u32_t mNodes;       /* nodes memory may be placed on */
+    mama_u32_t mLocalNode;   /* node of the calling thread */
+    mama_u64_t mRemoteFrees; /* blocks freed by a thread on another node */
+} omnmNumaStats;
+
+/**
+ * Gets an allocator which places everything on the given node, to pass to
+ * omnmmsgPayloadImpl_createWithAllocator.
+ *
+ * @param node The node, or OMNM_NUMA_LOCAL_NODE for whichever node the
+ *        allocating thread is on.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getNodeAllocator (int node, const omnmAllocator** allocator);
+
+/**
+ * Gets the node a payload's buffer is on, or -1 if it can't be told.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getNode (msgPayload msg, int* node);
+
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getNumaStats (omnmNumaStats* stats);
+
+/**
+ * Makes sure the payload can grow to the given serialized size (header
+ * included) without reallocating.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_reserve (msgPayload msg, mama_size_t bytes);
+
+/**
+ * Turns the shape learner on or off (it is off by default). While on, the
+ * size of payloads created for a subject or template is recorded when they
+ * are serialized, and new payloads for the same subject or template are
+ * created with that capacity up front.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_setShapeLearning (mama_bool_t enabled);
+
+/**
+ * Creates a payload sized by what the shape learner knows about payloads
+ * published on this subject.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_createForSubject (msgPayload* msg, const char* subject);
+
+/*
+ * Payload buffers and field caches only grow while a payload is reused, so
+ * one outlier message leaves it holding that much memory indefinitely. With
+ * a trim policy, a payload which has been reused (cleared or unserialized
+ * into) mSmallUses times in a row without exceeding mTargetCapacity bytes
+ * shrinks back to mTargetCapacity. A payload's scratch field buffers are
+ * trimmed to the same target at that point.
+ */
+typedef struct omnmPayloadTrimPolicy
+{
+    mama_size_t mTargetCapacity;
+    mama_u32_t  mSmallUses;     /* 0 never trims */
+} omnmPayloadTrimPolicy;
+
+/**
+ * Sets the trim policy for every payload which doesn't have its own. By
+ * default payloads are never trimmed.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_setTrimPolicy (const omnmPayloadTrimPolicy* policy);
+
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getTrimPolicy (omnmPayloadTrimPolicy* policy);
+
+/**
+ * Gives a payload a trim policy of its own.
+ *
+ * @param msg The payload.
+ * @param policy The policy, or NULL to follow the global one again.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_setPayloadTrimPolicy (msgPayload                    msg,
+                                         const omnmPayloadTrimPolicy*  policy);
+
+/**
+ * Shrinks the payload's buffer to what its current contents need (moving it
+ * back inside the payload object if it fits) and frees all of its field
+ * caches. Sub-messages and vectors previously returned by the payload's
+ * getters are no longer valid afterwards.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_shrinkToFit (msgPayload msg);
+
+/**
+ * Puts a payload in view mode, where unSerialize and setByteBuffer read the
+ * caller's buffer in place rather than copying it. The first modification
+ * copies the contents into the payload's own buffer, after which the
+ * caller's buffer is no longer used. Buffers from a host of the other byte
+ * order are still copied, as they have to be converted.
+ *
+ * The caller's buffer must stay valid and unchanged until the payload is
+ * next unserialized into, modified, cleared or destroyed. Returning the
+ * payload to its pool turns view mode off again.
+ *
+ * @param msg The payload.
+ * @param enabled Non-zero to borrow buffers, zero to copy them as usual.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_setViewMode (msgPayload msg, int enabled);
+
+/**
+ * Creates a payload in view mode over the given buffer. See
+ * omnmmsgPayloadImpl_setViewMode for how long the buffer must be kept.
+ *
+ * Sub-messages returned by getMsg and getVectorMsg are views of their
+ * parent's buffer in the same way, so reading nested messages copies
+ * nothing however deep they go. Each is reused by later calls for the same
+ * field and is only valid until the parent is next modified.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_createView (msgPayload*  msg,
+                               const void*  buffer,
+                               mama_size_t  bufferLength);
+
+/*
+ * Frees a buffer handed over by omnmmsgPayloadImpl_detachBuffer. It has the
+ * same form as the free callbacks zero copy transports take, so can be
+ * passed straight on along with its closure.
+ */
+typedef void (*omnmBufferFreeFunc) (void* buffer, void* closure);
+
+/**
+ * Hands the payload's serialized buffer over to the caller, so that it can
+ * be sent without copying. The payload is left empty and ready for the next
+ * message. A payload small enough to still be held inside the payload
+ * object is copied out once instead.
+ *
+ * @param msg The payload.
+ * @param buffer Set to the serialized buffer, which is now the caller's.
+ * @param bufferLength Set to its length.
+ * @param freeFunc Set to the function which frees the buffer. It belongs to
+ *        the payload's allocator, which must outlive the buffer.
+ * @param closure Set to the closure to pass to freeFunc.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_detachBuffer (msgPayload          msg,
+                                 void**              buffer,
+                                 mama_size_t*        bufferLength,
+                                 omnmBufferFreeFunc* freeFunc,
+                                 void**              closure);
+
+/**
+ * Unserializes a buffer into the payload by taking ownership of it rather
+ * than copying it. The buffer must have come from the payload's allocator
+ * (plain malloc unless one has been set), as that is what frees it. It is
+ * converted in place if it came from a host of the other byte order.
+ *
+ * @param msg The payload.
+ * @param buffer The serialized buffer. On success it belongs to the
+ *        payload; on failure it is still the caller's.
+ * @param bufferLength The length of the serialized contents.
+ * @param bufferCapacity The size of the allocation, which the payload may
+ *        grow into. Must be at least bufferLength.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_adoptBuffer (msgPayload   msg,
+                                void*        buffer,
+                                mama_size_t  bufferLength,
+                                mama_size_t  bufferCapacity);
+
+/*
+ * Called when a payload attached to an external region needs more room than
+ * the region has. It may return a region of at least required bytes, with
+ * its size in *capacity, which the payload moves what it has written so far
+ * into (it may overlap, or be the same region grown in place). Returning
+ * NULL fails whatever was being written with MAMA_STATUS_NOMEM and leaves
+ * the payload as it was.
+ */
+typedef void* (*omnmBufferOverflowFunc) (msgPayload   msg,
+                                         mama_size_t  required,
+                                         mama_size_t* capacity,
+                                         void*        closure);
+
+/**
+ * Empties the payload and attaches it to an external writable region, such
+ * as a slot in a shared memory ring, so that fields are encoded straight
+ * into it. The header is written at the start of the region immediately.
+ * Clearing the payload starts a new message in the same region.
+ *
+ * The region stays in use until omnmmsgPayloadImpl_finishBuffer is called,
+ * or the payload is unserialized into, destroyed or returned to its pool.
+ *
+ * @param msg The payload.
+ * @param region The region to build in, which must stay valid while
+ *        attached.
+ * @param capacity The size of the region, which must at least hold the
+ *        4 byte payload header.
+ * @param overflow Called when the region fills up, or NULL to simply fail
+ *        writes which don't fit.
+ * @param closure Passed to overflow.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_attachBuffer (msgPayload             msg,
+                                 void*                  region,
+                                 mama_size_t            capacity,
+                                 omnmBufferOverflowFunc overflow,
+                                 void*                  closure);
+
+/**
+ * Completes the message built in an attached region and detaches the
+ * payload from it, leaving the payload empty in its own buffer. Nothing is
+ * copied: the message is the first bufferLength bytes of region, ready to
+ * be published by advancing the ring's tail.
+ *
+ * @param msg The payload.
+ * @param region Set to the region the message ended up in, which is the
+ *        one last returned by the overflow callback if it was called.
+ * @param bufferLength Set to the length of the message.
+ *
+ * @return MAMA_STATUS_INVALID_ARG if the payload isn't attached to a region.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_finishBuffer (msgPayload    msg,
+                                 void**        region,
+                                 mama_size_t*  bufferLength);
+
+/*
+ * Large opaque and vector fields can be added by reference, leaving their
+ * bodies in the caller's memory instead of copying them into the payload.
+ * The memory must stay valid and unchanged until the payload is flattened,
+ * cleared, unserialized into or destroyed. Everything else works as usual:
+ * getters return the caller's memory, and anything needing the payload in
+ * one buffer (serialize, copy, updates and so on) flattens it first, copying
+ * the bodies in at that point.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_addOpaqueRef (msgPayload   msg,
+                                 const char*  name,
+                                 mama_fid_t   fid,
+                                 const void*  value,
+                                 mama_size_t  size);
+
+/**
+ * Adds a vector of fixed width scalars (any of the MAMA_FIELD_TYPE_VECTOR_
+ * types from BOOL and CHAR through to F64) by reference.
+ *
+ * @param type The vector type, which gives the width of each element.
+ * @param elements The elements, laid out as the matching addVector would
+ *        take them.
+ * @param count The number of elements.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_addVectorRef (msgPayload     msg,
+                                 const char*    name,
+                                 mama_fid_t     fid,
+                                 mamaFieldType  type,
+                                 const void*    elements,
+                                 mama_size_t    count);
+
+/*
+ * One piece of a serialized payload. Laid out as struct iovec is on POSIX
+ * hosts, so an array of these can be handed to writev or sendmsg directly.
+ */
+typedef struct omnmIoVec
+{
+    const void*  mBase;
+    mama_size_t  mLength;
+} omnmIoVec;
+
+/**
+ * Serializes the payload as a list of segments to be sent one after the
+ * other, without copying field bodies held by reference. Segments alternate
+ * between the payload's buffer and the caller's memory; a payload without
+ * any references is a single segment.
+ *
+ * @param msg The payload.
+ * @param segments Filled in with the segments.
+ * @param count The number of segments there is room for, set to the number
+ *        used. At most twice the number of fields added by reference plus
+ *        one are needed.
+ * @param bufferLength Set to the total length of the segments.
+ *
+ * @return MAMA_STATUS_INVALID_ARG if there isn't room for them all, with
+ *         count set to the number needed.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_serializeSegments (msgPayload    msg,
+                                      omnmIoVec*    segments,
+                                      mama_u32_t*   count,
+                                      mama_size_t*  bufferLength);
+
+/**
+ * Copies every field body held by reference into the payload, for callers
+ * which need it in a single buffer. Serializing does this automatically.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_flatten (msgPayload msg);
+
+/**
+ * Starts a sub-message field which is built directly in the parent's
+ * buffer, rather than in a payload of its own which is then copied in.
+ * Fields added to the child land in place, and the parent grows as needed
+ * to make room for them. Until omnmmsgPayloadImpl_endSubMsg is called the
+ * parent holds an empty sub-message.
+ *
+ * The child is owned by the parent and must not be destroyed. Nothing may
+ * be added to the parent while a child is open - adding or updating a field
+ * fails with MAMA_STATUS_INVALID_ARG, and clearing or unserializing into the
+ * parent abandons the child - though a child may itself begin sub-messages
+ * of its own.
+ *
+ * @param msg The parent payload.
+ * @param name The name of the field.
+ * @param fid The field identifier.
+ * @param child Set to the payload to add the sub-message's fields to.
+ *
+ * @return MAMA_STATUS_INVALID_ARG if a sub-message is already open.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_beginSubMsg (msgPayload   msg,
+                                const char*  name,
+                                mama_fid_t   fid,
+                                msgPayload*  child);
+
+/**
+ * Opens an existing sub-message field so that its fields can be updated
+ * where they lie in the parent's buffer, rather than getting a copy of it,
+ * modifying that and writing the whole of it back. Whatever follows the
+ * field is set aside until omnmmsgPayloadImpl_endSubMsg puts it back after
+ * the modified sub-message, so is copied only once however many fields are
+ * changed. A child may in turn open one of its own sub-messages, to reach
+ * a field several levels down.
+ *
+ * As with omnmmsgPayloadImpl_beginSubMsg the child is owned by the parent,
+ * and nothing may be added to the parent while it is open. Unlike it, the
+ * parent isn't readable whole meanwhile: the fields after the sub-message
+ * aren't found until omnmmsgPayloadImpl_endSubMsg puts them back, and
+ * serializing the parent or asking its size fails with
+ * MAMA_STATUS_INVALID_ARG rather than giving a truncated message.
+ *
+ * @param msg The parent payload.
+ * @param name The name of the field.
+ * @param fid The field identifier.
+ * @param child Set to the payload to update the sub-message's fields in.
+ *
+ * @return MAMA_STATUS_WRONG_FIELD_TYPE if the field isn't a sub-message.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_beginSubMsgUpdate (msgPayload   msg,
+                                      const char*  name,
+                                      mama_fid_t   fid,
+                                      msgPayload*  child);
+
+/**
+ * Completes the sub-message opened by omnmmsgPayloadImpl_beginSubMsg,
+ * omnmmsgPayloadImpl_beginSubMsgUpdate or
+ * omnmmsgPayloadImpl_beginVectorMsgElement. The child may not be used
+ * afterwards.
+ *
+ * @return MAMA_STATUS_INVALID_ARG if none is open, the child still has one
+ *         of its own open, or the parent was modified in the meantime.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_endSubMsg (msgPayload msg);
+
+/**
+ * Starts a vector of sub-messages built in place, one element at a time
+ * with omnmmsgPayloadImpl_beginVectorMsgElement and
+ * omnmmsgPayloadImpl_endSubMsg. The vector is valid, with the elements
+ * completed so far, at any point.
+ *
+ * @param msg The parent payload.
+ * @param name The name of the field.
+ * @param fid The field identifier.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_beginVectorMsg (msgPayload   msg,
+                                   const char*  name,
+                                   mama_fid_t   fid);
+
+/**
+ * Starts the next element of the vector opened by
+ * omnmmsgPayloadImpl_beginVectorMsg. As with omnmmsgPayloadImpl_beginSubMsg
+ * the child is owned by the parent.
+ *
+ * @param msg The parent payload.
+ * @param child Set to the payload to add the element's fields to.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_beginVectorMsgElement (msgPayload   msg,
+                                          msgPayload*  child);
+
+/**
+ * Completes the vector opened by omnmmsgPayloadImpl_beginVectorMsg, after
+ * which fields may be added to the parent again.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_endVectorMsg (msgPayload msg);
+
+/**
+ * Replaces a payload with an immutable copy held in a single allocation of
+ * exactly the size its contents need. Intended for payloads kept around for
+ * a long time, such as last value caches. All of the get, iterate and
+ * serialize functions work as before, while anything which would modify it
+ * returns MAMA_STATUS_NOT_MODIFIABLE.
+ *
+ * The original payload is destroyed, so this must not be used on a payload
+ * owned by a mamaMsg.
+ *
+ * @param msg The payload, replaced by its frozen copy on success.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_freeze (msgPayload* msg);
+
+/**
+ * Replaces a frozen payload with an ordinary one with the same contents.
+ * Does nothing to a payload which isn't frozen.
+ *
+ * @param msg The payload, replaced by its modifiable copy on success.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_thaw (msgPayload* msg);
+
+/*
+ * A batch packs many serialized payloads into a single frame, so that a
+ * transport sends fewer, larger frames. The frame is a small header with the
+ * count, a table of offsets, then the payloads back to back.
+ */
+typedef struct omnmBatchImpl* omnmBatch;
+
+/**
+ * Creates an empty batch, using the bridge wide allocator.
+ *
+ * @param batch Set to the new batch.
+ * @param capacity How many payloads it is expected to hold, or 0 for a
+ *        default. More can be added, at the cost of moving those already
+ *        added along to make room for a larger offset table.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_createBatch (omnmBatch* batch, mama_u32_t capacity);
+
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_destroyBatch (omnmBatch batch);
+
+/**
+ * Adds a payload to the batch, serializing it straight into the frame. Any
+ * fields it holds by reference are gathered in without being copied into
+ * the payload first.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_appendToBatch (omnmBatch batch, msgPayload msg);
+
+/**
+ * Starts a payload built directly in the frame, for callers producing
+ * messages only to batch them. The batch grows as needed while fields are
+ * added. The payload is owned by the batch, must not be destroyed, and is
+ * reused for the next one.
+ *
+ * @param batch The batch.
+ * @param msg Set to the empty payload to add fields to.
+ *
+ * @return MAMA_STATUS_INVALID_ARG if a payload is already being built.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_beginBatchPayload (omnmBatch batch, msgPayload* msg);
+
+/**
+ * Completes the payload started by omnmmsgPayloadImpl_beginBatchPayload,
+ * after which it may not be used until it is next handed out.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_endBatchPayload (omnmBatch batch);
+
+/**
+ * Completes the frame. It stays valid until the batch is next added to,
+ * cleared or destroyed; more payloads can be added afterwards and the batch
+ * finished again.
+ *
+ * @param batch The batch.
+ * @param buffer Set to the start of the frame.
+ * @param bufferLength Set to the length of the frame.
+ *
+ * @return MAMA_STATUS_INVALID_ARG if a payload is still being built.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_finishBatch (omnmBatch     batch,
+                                const void**  buffer,
+                                mama_size_t*  bufferLength);
+
+/**
+ * Empties the batch for reuse, keeping its memory. A payload being built is
+ * abandoned.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_clearBatch (omnmBatch batch);
+
+/**
+ * Checks a received frame and gets the number of payloads in it.
+ *
+ * @return MAMA_STATUS_INVALID_ARG if the frame isn't a batch, or is
+ *         truncated or malformed.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getBatchCount (const void*  buffer,
+                                  mama_size_t  bufferLength,
+                                  mama_u32_t*  count);
+
+/**
+ * Gets a payload out of a received frame as a view of it, without copying.
+ * The frame must be kept as long as a view of it would need it; see
+ * omnmmsgPayloadImpl_setViewMode.
+ *
+ * @param buffer The frame.
+ * @param bufferLength The length of the frame.
+ * @param index Which payload to get.
+ * @param msg A payload to unserialize into, which is put into view mode, or
+ *        NULL to have one created with omnmmsgPayloadImpl_createView.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getBatchPayload (const void*  buffer,
+                                    mama_size_t  bufferLength,
+                                    mama_u32_t   index,
+                                    msgPayload*  msg);
+
+/*
+ * Payloads carry no length of their own, so on a stream transport each is
+ * sent as a frame: a header of this many bytes holding its length, then the
+ * serialized payload. The header is written separately so it can go out
+ * alongside the segments from omnmmsgPayloadImpl_serializeSegments.
+ */
+#define OMNM_STREAM_FRAME_HEADER_SIZE 8
+
+/**
+ * Writes the header for a frame holding bufferLength bytes.
+ *
+ * @param header Where to write OMNM_STREAM_FRAME_HEADER_SIZE bytes.
+ * @param bufferLength The length of what follows it.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_writeFrameHeader (void* header, mama_size_t bufferLength);
+
+/*
+ * Splits a stream back into frames, whatever size the chunks it arrives in.
+ * Only a frame which straddles chunks is copied, into a buffer of the
+ * decoder's own; one which arrives whole is read where it lies.
+ */
+typedef struct omnmStreamDecoderImpl* omnmStreamDecoder;
+
+/**
+ * Creates a stream decoder, using the bridge wide allocator.
+ *
+ * @param decoder Set to the new decoder.
+ * @param maxFrameSize The largest frame accepted, which bounds the memory the
+ *        decoder holds, or 0 for a default of 16MB.
+ * @param skipOversized Non-zero to discard larger frames as they arrive
+ *        without holding on to any of them, zero to fail the stream.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_createStreamDecoder (omnmStreamDecoder*  decoder,
+                                        mama_size_t         maxFrameSize,
+                                        int                 skipOversized);
+
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_destroyStreamDecoder (omnmStreamDecoder decoder);
+
+/**
+ * Discards any partial frame, ready for a new stream such as after a
+ * reconnect. Needed to carry on after decoding fails.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_resetStreamDecoder (omnmStreamDecoder decoder);
+
+/**
+ * Decodes the next frame from a chunk of the stream. Call repeatedly until
+ * msg comes back NULL, which means the chunk has been used up and the
+ * decoder is waiting on the next one.
+ *
+ * The payload belongs to the decoder and is a view of either the chunk or
+ * the decoder's buffer, valid until the next call. See
+ * omnmmsgPayloadImpl_setViewMode for what that allows.
+ *
+ * @param decoder The decoder.
+ * @param data The chunk, moved past whatever was used.
+ * @param dataLength The length of the chunk, reduced by whatever was used.
+ * @param msg Set to the payload of the completed frame, or NULL.
+ *
+ * @return MAMA_STATUS_INVALID_ARG if the stream is corrupt, a frame is too
+ *         large or doesn't hold a payload (such as a batch), after which the
+ *         decoder has to be reset.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_decodeStream (omnmStreamDecoder  decoder,
+                                 const void**       data,
+                                 mama_size_t*       dataLength,
+                                 msgPayload*        msg);
+
+/**
+ * Gets how many oversized frames the decoder has discarded.
+ */
+MAMAExpBridgeDLL
+mama_status
+omnmmsgPayloadImpl_getStreamSkipped (omnmStreamDecoder  decoder,
+                                     mama_u64_t*        frames);
+
 #if defined(__cplusplus)
 }
 #endif